@@ -25,6 +25,7 @@
 #include <dai/exactinf.h>
 #include <dai/evidence.h>
 #include <dai/emalg.h>
+#include <dai/pseudolikelihood.h>
 #ifdef DAI_WITH_BP
     #include <dai/bp.h>
 #endif
@@ -78,10 +78,10 @@ class BBP {
         std::vector<Prob> _adj_psi_V;
         /// Factor adjoints
         std::vector<Prob> _adj_psi_F;
-        /// Variable->factor message adjoints (indexed [i][_I])
-        std::vector<std::vector<Prob> > _adj_n;
-        /// Factor->variable message adjoints (indexed [i][_I])
-        std::vector<std::vector<Prob> > _adj_m;
+        /// Variable->factor message adjoints (flat, see _varOffsets)
+        std::vector<Real> _adj_n;
+        /// Factor->variable message adjoints (flat, see _varOffsets)
+        std::vector<Real> _adj_m;
         /// Normalized variable belief adjoints
         std::vector<Prob> _adj_b_V;
         /// Normalized factor belief adjoints
@@ -95,56 +95,76 @@ class BBP {
         /// Initial factor adjoints
         std::vector<Prob> _init_adj_psi_F;
 
-        /// Unnormalized variable->factor message adjoint (indexed [i][_I])
-        std::vector<std::vector<Prob> > _adj_n_unnorm;
-        /// Unnormalized factor->variable message adjoint (indexed [i][_I])
-        std::vector<std::vector<Prob> > _adj_m_unnorm;
-        /// Updated normalized variable->factor message adjoint (indexed [i][_I])
-        std::vector<std::vector<Prob> > _new_adj_n;
-        /// Updated normalized factor->variable message adjoint (indexed [i][_I])
-        std::vector<std::vector<Prob> > _new_adj_m;
+        /// Unnormalized variable->factor message adjoints (flat, see _varOffsets)
+        std::vector<Real> _adj_n_unnorm;
+        /// Unnormalized factor->variable message adjoints (flat, see _varOffsets)
+        std::vector<Real> _adj_m_unnorm;
+        /// Updated normalized variable->factor message adjoints (flat, see _varOffsets)
+        std::vector<Real> _new_adj_n;
+        /// Updated normalized factor->variable message adjoints (flat, see _varOffsets)
+        std::vector<Real> _new_adj_m;
         /// Unnormalized variable belief adjoints
         std::vector<Prob> _adj_b_V_unnorm;
         /// Unnormalized factor belief adjoints
         std::vector<Prob> _adj_b_F_unnorm;
 
-        /// _Tmsg[i][_I] (see eqn. (41) in [\ref EaG09])
-        std::vector<std::vector<Prob > > _Tmsg;
-        /// _Umsg[I][_i] (see eqn. (42) in [\ref EaG09])
-        std::vector<std::vector<Prob > > _Umsg;
-        /// _Smsg[i][_I][_j] (see eqn. (43) in [\ref EaG09])
-        std::vector<std::vector<std::vector<Prob > > > _Smsg;
-        /// _Rmsg[I][_i][_J] (see eqn. (44) in [\ref EaG09])
-        std::vector<std::vector<std::vector<Prob > > > _Rmsg;
+        /// T values (flat, see _varOffsets; see eqn. (41) in [\ref EaG09])
+        std::vector<Real> _Tmsg;
+        /// U values (flat, see _factorOffsets; see eqn. (42) in [\ref EaG09])
+        std::vector<Real> _Umsg;
+        /// S values (flat, see _SOffsets; see eqn. (43) in [\ref EaG09])
+        std::vector<Real> _Smsg;
+        /// R values (flat, see _ROffsets; see eqn. (44) in [\ref EaG09])
+        std::vector<Real> _Rmsg;
 
         /// Number of iterations done
         size_t _iters;
     //@}
 
-    /// \name Index cache management (for performance)
+    /// \name Edge layout and index cache (for performance)
+    /** The edges of the factor graph are numbered consecutively, variable by variable (the edge between
+     *  variable \a i and its \a _I 'th neighbor gets number _edgeOffsets[i] + \a _I). All quantities
+     *  living on edges are stored back to back in a single std::vector<Real> per array family.
+     */
     //@{
         /// Index type
         typedef std::vector<size_t>  _ind_t;
-        /// Cached indices (indexed [i][_I])
-        std::vector<std::vector<_ind_t> >  _indices;
-        /// Prepares index cache _indices
-        /** \see bp.cpp
+        /// Number of the first edge of each variable (indexed [i]; the last entry is the number of edges)
+        std::vector<size_t> _edgeOffsets;
+        /// Offsets of the variable-sized edge vectors (indexed [e]; the last entry is the total size)
+        std::vector<size_t> _varOffsets;
+        /// Offsets of the factor-sized edge vectors (indexed [e]; the last entry is the total size)
+        std::vector<size_t> _factorOffsets;
+        /// Offsets of the R values; those of edge \a e occupy one variable-sized vector for each neighbor of the variable
+        std::vector<size_t> _ROffsets;
+        /// Offsets of the S values (indexed [_SFirst[e] + _j])
+        std::vector<size_t> _SOffsets;
+        /// Position of the first S value of each edge in _SOffsets (indexed [e])
+        std::vector<size_t> _SFirst;
+        /// Cached indices (indexed [e]); these point into the BP object if possible, otherwise into _ownIndices
+        std::vector<const _ind_t*> _indices;
+        /// Indices that are not available from the BP object
+        std::vector<_ind_t> _ownIndices;
+        /// Prepares the edge layout and the index cache _indices
+        /** The index tables of the BP object are shared if available (see BP::edgeIndex()).
          */
         void RegenerateInds();
+        /// Returns the number of the edge between variable \a i and its \a _I 'th neighbor
+        size_t _edge(size_t i, size_t _I) const { return _edgeOffsets[i] + _I; }
         /// Returns an index from the cache
-        const _ind_t& _index(size_t i, size_t _I) const { return _indices[i][_I]; }
+        const _ind_t& _index(size_t i, size_t _I) const { return *_indices[_edge(i,_I)]; }
     //@}
 
     /// \name Initialization helper functions
     //@{
-        /// Calculate T values; see eqn. (41) in [\ref EaG09]
-        void RegenerateT();
-        /// Calculate U values; see eqn. (42) in [\ref EaG09]
-        void RegenerateU();
-        /// Calculate S values; see eqn. (43) in [\ref EaG09]
-        void RegenerateS();
-        /// Calculate R values; see eqn. (44) in [\ref EaG09]
-        void RegenerateR();
+        /// Calculate T values of the variables \a vars; see eqn. (41) in [\ref EaG09]
+        void RegenerateT( const std::vector<size_t> &vars );
+        /// Calculate U values of the factors \a factors; see eqn. (42) in [\ref EaG09]
+        void RegenerateU( const std::vector<size_t> &factors );
+        /// Calculate S values of the factors \a factors; see eqn. (43) in [\ref EaG09]
+        void RegenerateS( const std::vector<size_t> &factors );
+        /// Calculate R values of the variables \a vars; see eqn. (44) in [\ref EaG09]
+        void RegenerateR( const std::vector<size_t> &vars );
         /// Calculate _adj_b_V_unnorm and _adj_b_F_unnorm from _adj_b_V and _adj_b_F
         void RegenerateInputs();
         /// Initialise members for factor adjoints
@@ -162,36 +182,47 @@ class BBP {
          */
         void RegenerateSeqMessageAdjoints();
         /// Called by \a init, recalculates intermediate values
+        /** Brings _bp_dual up to date with the inference algorithm first; only the T, U, S and R
+         *  values that depend on changed messages of _bp_dual are recalculated.
+         */
         void Regenerate();
     //@}
 
     /// \name Accessors/mutators
     //@{
-        /// Returns reference to T value; see eqn. (41) in [\ref EaG09]
-        Prob & T(size_t i, size_t _I) { return _Tmsg[i][_I]; }
-        /// Returns constant reference to T value; see eqn. (41) in [\ref EaG09]
-        const Prob & T(size_t i, size_t _I) const { return _Tmsg[i][_I]; }
-        /// Returns reference to U value; see eqn. (42) in [\ref EaG09]
-        Prob & U(size_t I, size_t _i) { return _Umsg[I][_i]; }
-        /// Returns constant reference to U value; see eqn. (42) in [\ref EaG09]
-        const Prob & U(size_t I, size_t _i) const { return _Umsg[I][_i]; }
-        /// Returns reference to S value; see eqn. (43) in [\ref EaG09]
-        Prob & S(size_t i, size_t _I, size_t _j) { return _Smsg[i][_I][_j]; }
-        /// Returns constant reference to S value; see eqn. (43) in [\ref EaG09]
-        const Prob & S(size_t i, size_t _I, size_t _j) const { return _Smsg[i][_I][_j]; }
-        /// Returns reference to R value; see eqn. (44) in [\ref EaG09]
-        Prob & R(size_t I, size_t _i, size_t _J) { return _Rmsg[I][_i][_J]; }
-        /// Returns constant reference to R value; see eqn. (44) in [\ref EaG09]
-        const Prob & R(size_t I, size_t _i, size_t _J) const { return _Rmsg[I][_i][_J]; }
-
-        /// Returns reference to variable->factor message adjoint
-        Prob& adj_n(size_t i, size_t _I) { return _adj_n[i][_I]; }
-        /// Returns constant reference to variable->factor message adjoint
-        const Prob& adj_n(size_t i, size_t _I) const { return _adj_n[i][_I]; }
-        /// Returns reference to factor->variable message adjoint
-        Prob& adj_m(size_t i, size_t _I) { return _adj_m[i][_I]; }
-        /// Returns constant reference to factor->variable message adjoint
-        const Prob& adj_m(size_t i, size_t _I) const { return _adj_m[i][_I]; }
+        /// Returns pointer to T value; see eqn. (41) in [\ref EaG09]
+        Real* T(size_t i, size_t _I) { return &_Tmsg[_varOffsets[_edge(i,_I)]]; }
+        /// Returns constant pointer to T value; see eqn. (41) in [\ref EaG09]
+        const Real* T(size_t i, size_t _I) const { return &_Tmsg[_varOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to U value for the factor that is the \a _I 'th neighbor of \a i; see eqn. (42) in [\ref EaG09]
+        Real* U(size_t i, size_t _I) { return &_Umsg[_factorOffsets[_edge(i,_I)]]; }
+        /// Returns constant pointer to U value for the factor that is the \a _I 'th neighbor of \a i; see eqn. (42) in [\ref EaG09]
+        const Real* U(size_t i, size_t _I) const { return &_Umsg[_factorOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to S value; see eqn. (43) in [\ref EaG09]
+        Real* S(size_t i, size_t _I, size_t _j) { return &_Smsg[_SOffsets[_SFirst[_edge(i,_I)] + _j]]; }
+        /// Returns constant pointer to S value; see eqn. (43) in [\ref EaG09]
+        const Real* S(size_t i, size_t _I, size_t _j) const { return &_Smsg[_SOffsets[_SFirst[_edge(i,_I)] + _j]]; }
+        /// Returns pointer to R value for the factor that is the \a _I 'th neighbor of \a i and the factor that is its \a _J 'th neighbor; see eqn. (44) in [\ref EaG09]
+        Real* R(size_t i, size_t _I, size_t _J) { return &_Rmsg[_ROffsets[_edge(i,_I)] + _J * _fg->var(i).states()]; }
+        /// Returns constant pointer to R value; see eqn. (44) in [\ref EaG09]
+        const Real* R(size_t i, size_t _I, size_t _J) const { return &_Rmsg[_ROffsets[_edge(i,_I)] + _J * _fg->var(i).states()]; }
+
+        /// Returns pointer to variable->factor message adjoint
+        Real* adj_n(size_t i, size_t _I) { return &_adj_n[_varOffsets[_edge(i,_I)]]; }
+        /// Returns constant pointer to variable->factor message adjoint
+        const Real* adj_n(size_t i, size_t _I) const { return &_adj_n[_varOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to factor->variable message adjoint
+        Real* adj_m(size_t i, size_t _I) { return &_adj_m[_varOffsets[_edge(i,_I)]]; }
+        /// Returns constant pointer to factor->variable message adjoint
+        const Real* adj_m(size_t i, size_t _I) const { return &_adj_m[_varOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to unnormalized variable->factor message adjoint
+        Real* adj_n_unnorm(size_t i, size_t _I) { return &_adj_n_unnorm[_varOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to unnormalized factor->variable message adjoint
+        Real* adj_m_unnorm(size_t i, size_t _I) { return &_adj_m_unnorm[_varOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to updated variable->factor message adjoint
+        Real* new_adj_n(size_t i, size_t _I) { return &_new_adj_n[_varOffsets[_edge(i,_I)]]; }
+        /// Returns pointer to updated factor->variable message adjoint
+        Real* new_adj_m(size_t i, size_t _I) { return &_new_adj_m[_varOffsets[_edge(i,_I)]]; }
     //@}
 
     /// \name Parallel algorithm
@@ -202,10 +233,11 @@ class BBP {
          */
         void calcNewN( size_t i, size_t _I );
         /// Calculates new factor->variable message adjoint
-        /** Increases factor adjoint according to eqn. (28) in [\ref EaG09] and
-         *  calculates the new factor->variable message adjoint according to the r.h.s. of eqn. (30) in [\ref EaG09].
+        /** Calculates the new factor->variable message adjoint according to the r.h.s. of eqn. (30) in [\ref EaG09].
          */
         void calcNewM( size_t i, size_t _I );
+        /// Increases factor adjoint of factor \a I according to eqn. (28) in [\ref EaG09]
+        void calcNewPsiF( size_t I );
         /// Calculates unnormalized variable->factor message adjoint from the normalized one
         void calcUnnormMsgN( size_t i, size_t _I );
         /// Calculates unnormalized factor->variable message adjoint from the normalized one
@@ -215,17 +247,19 @@ class BBP {
         /// Updates (un)normalized factor->variable message adjoints
         void upMsgM( size_t i, size_t _I );
         /// Do one parallel update of all message adjoints
+        /** The sweeps over factors and variables are distributed over threads (if OpenMP is enabled).
+         */
         void doParUpdate();
     //@}
 
     /// \name Sequential algorithm
     //@{
-        /// Helper function for sendSeqMsgM(): increases factor->variable message adjoint by \a p and calculates the corresponding unnormalized adjoint
-        void incrSeqMsgM( size_t i, size_t _I, const Prob& p );
+        /// Helper function for sendSeqMsgN(): increases factor->variable message adjoint by \a f * \a r and calculates the corresponding unnormalized adjoint
+        void incrSeqMsgM( size_t i, size_t _I, const Prob &f, const Real *r );
         //  DISABLED BECAUSE IT IS BUGGY:
         //  void updateSeqMsgM( size_t i, size_t _I );
-        /// Sets normalized factor->variable message adjoint and calculates the corresponding unnormalized adjoint
-        void setSeqMsgM( size_t i, size_t _I, const Prob &p );
+        /// Multiplies normalized factor->variable message adjoint by \a c and calculates the corresponding unnormalized adjoint
+        void scaleSeqMsgM( size_t i, size_t _I, Real c );
         /// Implements routine Send-n in Figure 5 in [\ref EaG09]
         void sendSeqMsgN( size_t i, size_t _I, const Prob &f );
         /// Implements routine Send-m in Figure 5 in [\ref EaG09]
@@ -236,6 +270,10 @@ class BBP {
         /** \see eqn. (13) in [\ref EaG09]
          */
         Prob unnormAdjoint( const Prob &w, Real Z_w, const Prob &adj_w );
+        /// Same as unnormAdjoint( const Prob&, Real, const Prob& ), but reads \a adj_w from and writes \a adj_w_unnorm to flat storage
+        static void unnormAdjoint( const Prob &w, Real Z_w, const Real *adj_w, Real *adj_w_unnorm );
+        /// Returns the L1 norm of the vector of length \a n starting at \a p
+        static Real sumAbs( const Real *p, size_t n );
 
         /// Calculates averaged L1 norm of unnormalized message adjoints
         Real getUnMsgMag();
@@ -92,6 +92,30 @@ class BP : public DAIAlgFG {
         /// Stores the update schedule
         std::vector<Edge> _updateSeq;
 
+        /// State of BP saved by pushState()
+        struct SavedState {
+            /// Old messages, in the order of the edges
+            std::vector<Prob> messages;
+            /// New messages, in the order of the edges
+            std::vector<Prob> newMessages;
+            /// Residuals, in the order of the edges
+            std::vector<Real> residuals;
+            /// Entries of the lookup table, in their original order (only used for maximum-residual BP)
+            std::vector<std::pair<Real, std::pair<std::size_t, std::size_t> > > lut;
+            /// Maximum difference between variable beliefs encountered so far
+            Real maxdiff;
+            /// Number of iterations needed
+            size_t iters;
+            /// Length of the history of message updates
+            size_t nrSentMessages;
+            /// Variable beliefs of previous iteration
+            std::vector<Factor> oldBeliefsV;
+            /// Factor beliefs of previous iteration
+            std::vector<Factor> oldBeliefsF;
+        };
+        /// Stack of states saved by pushState()
+        std::vector<SavedState> _savedStates;
+
     public:
         /// Parameters for BP
         struct Properties {
@@ -143,19 +167,19 @@ class BP : public DAIAlgFG {
     /// \name Constructors/destructors
     //@{
         /// Default constructor
-        BP() : DAIAlgFG(), _edges(), _edge2lut(), _lut(), _maxdiff(0.0), _iters(0U), _sentMessages(), _oldBeliefsV(), _oldBeliefsF(), _updateSeq(), props(), recordSentMessages(false) {}
+        BP() : DAIAlgFG(), _edges(), _edge2lut(), _lut(), _maxdiff(0.0), _iters(0U), _sentMessages(), _oldBeliefsV(), _oldBeliefsF(), _updateSeq(), _savedStates(), props(), recordSentMessages(false) {}
 
         /// Construct from FactorGraph \a fg and PropertySet \a opts
         /** \param fg Factor graph.
          *  \param opts Parameters @see Properties
          */
-        BP( const FactorGraph & fg, const PropertySet &opts ) : DAIAlgFG(fg), _edges(), _maxdiff(0.0), _iters(0U), _sentMessages(), _oldBeliefsV(), _oldBeliefsF(), _updateSeq(), props(), recordSentMessages(false) {
+        BP( const FactorGraph & fg, const PropertySet &opts ) : DAIAlgFG(fg), _edges(), _maxdiff(0.0), _iters(0U), _sentMessages(), _oldBeliefsV(), _oldBeliefsF(), _updateSeq(), _savedStates(), props(), recordSentMessages(false) {
             setProperties( opts );
             construct();
         }
 
         /// Copy constructor
-        BP( const BP &x ) : DAIAlgFG(x), _edges(x._edges), _edge2lut(x._edge2lut), _lut(x._lut), _maxdiff(x._maxdiff), _iters(x._iters), _sentMessages(x._sentMessages), _oldBeliefsV(x._oldBeliefsV), _oldBeliefsF(x._oldBeliefsF), _updateSeq(x._updateSeq), props(x.props), recordSentMessages(x.recordSentMessages) {
+        BP( const BP &x ) : DAIAlgFG(x), _edges(x._edges), _edge2lut(x._edge2lut), _lut(x._lut), _maxdiff(x._maxdiff), _iters(x._iters), _sentMessages(x._sentMessages), _oldBeliefsV(x._oldBeliefsV), _oldBeliefsF(x._oldBeliefsF), _updateSeq(x._updateSeq), _savedStates(x._savedStates), props(x.props), recordSentMessages(x.recordSentMessages) {
             for( LutType::iterator l = _lut.begin(); l != _lut.end(); ++l )
                 _edge2lut[l->second.first][l->second.second] = l;
         }
@@ -174,6 +198,7 @@ class BP : public DAIAlgFG {
                 _oldBeliefsV = x._oldBeliefsV;
                 _oldBeliefsF = x._oldBeliefsF;
                 _updateSeq = x._updateSeq;
+                _savedStates = x._savedStates;
                 props = x.props;
                 recordSentMessages = x.recordSentMessages;
             }
@@ -204,6 +229,13 @@ class BP : public DAIAlgFG {
         virtual void setProperties( const PropertySet &opts );
         virtual PropertySet getProperties() const;
         virtual std::string printProperties() const;
+        /// Saves the messages, residuals and beliefs of the previous iteration
+        virtual void pushState();
+        /// Restores the state saved by the matching pushState()
+        /** The history of message updates is truncated to its length at the time of pushState().
+         *  \throw OBJECT_NOT_FOUND if there is no saved state
+         */
+        virtual void popState();
     //@}
 
     /// \name Additional interface specific for BP
@@ -215,6 +247,11 @@ class BP : public DAIAlgFG {
 
         /// Clears history of which messages have been updated
         void clearSentMessages() { _sentMessages.clear(); }
+
+        /// Returns the cached index for the edge between variable \a i and its \a _I 'th neighbor
+        /** The index is empty if the index cache is disabled (see DAI_BP_FAST in bp.cpp).
+         */
+        const std::vector<size_t>& edgeIndex( size_t i, size_t _I ) const { return _edges[i][_I].index; }
     //@}
 
     protected:
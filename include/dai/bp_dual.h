@@ -66,6 +66,16 @@ class BP_dual {
         /// Stores all beliefs
         beliefs _beliefs;
 
+        /// Groups together the factor beliefs of the InfAlg object and the factors from which the messages were calculated
+        struct snapshot {
+            /// Factor beliefs of the InfAlg object
+            std::vector<Prob> b2;
+            /// Factor values
+            std::vector<Prob> psi;
+        };
+        /// Stores the InfAlg beliefs and factors at the last synchronization
+        snapshot _synced;
+
         /// Pointer to the InfAlg object
         const InfAlg *_ia;
 
@@ -76,15 +86,17 @@ class BP_dual {
         /// Allocates space for \a _beliefs
         void regenerateBeliefs();
 
-        /// Calculate all messages from InfAlg beliefs
-        void calcMessages();
+        /// Calculate the messages that depend on the factors \a changed from InfAlg beliefs
+        /** On return, \a vars flags the variables whose messages to factors were recalculated.
+         */
+        void calcMessages( const std::vector<size_t> &changed, std::vector<bool> &vars );
         /// Update factor->variable message (\a i -> \a I)
         void calcNewM(size_t i, size_t _I);
         /// Update variable->factor message (\a I -> \a i)
         void calcNewN(size_t i, size_t _I);
 
-        /// Calculate all variable and factor beliefs from messages
-        void calcBeliefs();
+        /// Calculate the beliefs of the variables flagged in \a vars, of their neighboring factors and of the factors \a changed from messages
+        void calcBeliefs( const std::vector<bool> &vars, const std::vector<size_t> &changed );
         /// Calculate belief of variable \a i
         void calcBeliefV(size_t i);
         /// Calculate belief of factor \a I
@@ -97,6 +109,14 @@ class BP_dual {
          */
         BP_dual( const InfAlg *ia ) : _ia(ia) { init(); }
 
+        /// Brings the messages and beliefs up to date with the current beliefs and factors of the InfAlg object
+        /** Only the messages and beliefs that depend on factors whose belief or value changed since
+         *  the previous synchronization are recalculated; the result is the same as that of
+         *  constructing a new BP_dual object.
+         *  \returns the indices of the factors whose belief or value changed
+         */
+        std::vector<size_t> refresh();
+
         /// Returns the underlying FactorGraph
         const FactorGraph& fg() const { return _ia->fg(); }
 
@@ -15,6 +15,7 @@
 
 
 #include <fstream>
+#include <map>
 #include <boost/shared_ptr.hpp>
 
 #include <dai/daialg.h>
@@ -56,10 +57,18 @@ class CBP : public DAIAlgFG {
         /// Output stream where information about the clampings is written
         boost::shared_ptr<std::ofstream> _clamp_ofstream;
 
+        /// Number of clones of the inference algorithm that currently exist in the recursion
+        size_t _live_clones;
+        /// First exception thrown while exploring a subtree of the recursion concurrently
+        boost::shared_ptr<Exception> _error;
+
+        /// BBP objects kept between calls of chooseNextClampVar(), indexed by the inference algorithm they were constructed from
+        std::map<const InfAlg*, boost::shared_ptr<BBP> > _bbps;
+
 
     public:
         /// Default constructor
-        CBP() : DAIAlgFG(), _beliefsV(), _beliefsF(), _logZ(0.0), _iters(0), _maxdiff(0.0), _sum_level(0.0), _num_leaves(0), _clamp_ofstream() {}
+        CBP() : DAIAlgFG(), _beliefsV(), _beliefsF(), _logZ(0.0), _iters(0), _maxdiff(0.0), _sum_level(0.0), _num_leaves(0), _clamp_ofstream(), _live_clones(0), _error(), _bbps() {}
 
         /// Construct CBP object from FactorGraph \a fg and PropertySet \a opts
         /** \param fg Factor graph.
@@ -136,6 +145,9 @@ class CBP : public DAIAlgFG {
 
             /// If non-empty, write clamping choices to this file
             std::string clamp_outfile = "";
+
+            /// Subtrees of the recursion are explored concurrently (if OpenMP is enabled) as long as less than this number of clones of the inference algorithm exist
+            size_t max_clones = 64;
         }
         */
 /* {{{ GENERATED CODE: DO NOT EDIT. Created by
@@ -178,6 +190,8 @@ class CBP : public DAIAlgFG {
             size_t rand_seed;
             /// If non-empty, write clamping choices to this file
             std::string clamp_outfile;
+            /// Subtrees of the recursion are explored concurrently (if OpenMP is enabled) as long as less than this number of clones of the inference algorithm exist
+            size_t max_clones;
 
             /// Set members from PropertySet
             /** \throw UNKNOWN_PROPERTY if a Property key is not recognized
@@ -199,10 +213,30 @@ class CBP : public DAIAlgFG {
         /** Chooses a variable to clamp, recurses, combines the partition sum 
          *  and belief estimates of the children, and returns the improved
          *  estimates in \a lz_out and \a beliefs_out to its parent.
+         *  On return, \a bp is in the same state as before the call.
          */
         void runRecurse( InfAlg *bp, Real orig_logZ, std::vector<size_t> clamped_vars_list, size_t &num_leaves,
                          size_t &choose_count, Real &sum_level, Real &lz_out, std::vector<Factor> &beliefs_out );
 
+        /// Clamps variable (or factor) \a i of \a bp to the states \a xis (making a backup of the changed factors if \a backup == \c true) and runs \a bp
+        void runClamped( InfAlg *bp, size_t i, const std::vector<size_t> &xis, bool backup );
+
+        /// Returns a clone of \a bp, keeping track of the number of live clones
+        InfAlg* newClone( const InfAlg *bp );
+
+        /// Deletes a clone created by newClone() (if not \c NULL)
+        void deleteClone( InfAlg *bp_c );
+
+        /// Returns the BBP object for \a bp, constructing it on first use
+        BBP& getBBP( const InfAlg *bp );
+
+        /// Returns whether a subtree of the recursion should be explored as a separate task
+        /** This is the case if no randomness is involved in choosing the clamping variables
+         *  (so that the result does not depend on the order in which tasks are executed),
+         *  no task has failed, and the number of live clones is below \a props.max_clones.
+         */
+        bool spawnTask();
+
         /// Choose the next variable to clamp.
         /** Choose the next variable to clamp, given a converged InfAlg \a bp,
          *  and a vector of variables that are already clamped (\a
@@ -244,6 +278,14 @@ class CBP : public DAIAlgFG {
  */
 std::pair<size_t, size_t> BBPFindClampVar( const InfAlg &in_bp, bool clampingVar, const PropertySet &bbp_props, const BBPCostFunction &cfn, Real *maxVarOut );
 
+/// Find the best variable/factor to clamp using the BBP object \a bbp
+/** Same as the other overload, but reuses \a bbp, which should have been constructed
+ *  from \a in_bp; only the part of \a bbp that depends on beliefs or factors that changed
+ *  since its previous use is recalculated.
+ *  \relates CBP
+ */
+std::pair<size_t, size_t> BBPFindClampVar( const InfAlg &in_bp, BBP &bbp, bool clampingVar, const BBPCostFunction &cfn, Real *maxVarOut );
+
 
 } // end of namespace dai
 
@@ -168,16 +168,9 @@ namespace dai {
             }
 
             /// Erases all clusters that are not maximal
-            ClusterGraph& eraseNonMaximal() {
-                for( size_t I = 0; I < _G.nrNodes2(); ) {
-                    if( !isMaximal(I) ) {
-                        _clusters.erase( _clusters.begin() + I );
-                        _G.eraseNode2(I);
-                    } else
-                        I++;
-                }
-                return *this;
-            }
+            /** \note The graph structure is rebuilt only once, after all non-maximal clusters have been determined.
+             */
+            ClusterGraph& eraseNonMaximal();
 
             /// Erases all clusters that contain the \a i 'th variable
             ClusterGraph& eraseSubsuming( size_t i ) {
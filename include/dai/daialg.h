@@ -152,6 +152,13 @@ class InfAlg {
         /** If \a backup == \c true, make a backup of all factors that are changed.
          */
         virtual void makeCavity( size_t i, bool backup = false ) = 0;
+
+        /// Replaces the contents of all factors by those of the corresponding factors of \a fg, which should have the same structure as fg()
+        /** The data structures that only depend on the structure of the factor graph (e.g., a junction
+         *  tree and its index tables) are not reconstructed; init() should be called afterwards.
+         *  \throw NOT_IMPLEMENTED if not implemented/supported
+         */
+        virtual void reloadFactors( const FactorGraph &/*fg*/ ) { DAI_THROW(NOT_IMPLEMENTED); }
     //@}
 
     /// \name Backup/restore mechanism for factors
@@ -169,6 +176,25 @@ class InfAlg {
         virtual void restoreFactor( size_t I ) = 0;
         /// Restore the factors involving the variables in \a vs from their backup copies
         virtual void restoreFactors( const VarSet &vs ) = 0;
+
+        /// Opens a new nested level of backups and saves the state of the algorithm
+        /** Until the matching popBackups(), the factors that are changed with \a backup == \c true
+         *  are backed up at this level. Together with popBackups(), this allows recursive
+         *  conditioning on a single object instead of on clones.
+         */
+        virtual void pushBackups() = 0;
+        /// Restores the factors that have been backed up since the matching pushBackups(), and the saved state of the algorithm
+        /** \throw OBJECT_NOT_FOUND if no nested level of backups is open
+         */
+        virtual void popBackups() = 0;
+
+        /// Saves the state of the algorithm (e.g., its messages) on a stack; called by pushBackups()
+        /** The default implementation does nothing, in which case the algorithm should be initialized
+         *  again after popBackups().
+         */
+        virtual void pushState() {}
+        /// Restores the state of the algorithm saved by the matching pushState(); called by popBackups()
+        virtual void popState() {}
     //@}
 
     /// \name Managing parameters
@@ -229,6 +255,15 @@ class DAIAlg : public InfAlg, public GRM {
         /** If \a backup == \c true, make a backup of all factors that are changed.
          */
         void makeCavity( size_t i, bool backup = false ) { GRM::makeCavity( i, backup ); }
+
+        /// Replaces the contents of all factors by those of the corresponding factors of \a fg, which should have the same structure as fg()
+        void reloadFactors( const FactorGraph &fg ) {
+            DAI_ASSERT( fg.nrFactors() == GRM::nrFactors() );
+            std::map<size_t, Factor> facs;
+            for( size_t I = 0; I < fg.nrFactors(); I++ )
+                facs.insert( facs.end(), std::make_pair( I, fg.factor(I) ) );
+            GRM::setFactors( facs );
+        }
     //@}
 
     /// \name Backup/restore mechanism for factors
@@ -242,6 +277,11 @@ class DAIAlg : public InfAlg, public GRM {
         void restoreFactor( size_t I ) { GRM::restoreFactor( I ); }
         /// Restore the factors involving the variables in \a vs from their backup copies
         void restoreFactors( const VarSet &vs ) { GRM::restoreFactors( vs ); }
+
+        /// Opens a new nested level of backups and saves the state of the algorithm
+        void pushBackups() { GRM::pushBackups(); pushState(); }
+        /// Restores the factors that have been backed up since the matching pushBackups(), and the saved state of the algorithm
+        void popBackups() { GRM::popBackups(); popState(); }
     //@}
 };
 
@@ -256,6 +296,7 @@ typedef DAIAlg<RegionGraph> DAIAlgRG;
 /// Calculates the marginal probability distribution for \a vs using inference algorithm \a obj.
 /** calcMarginal() works by clamping all variables in \a vs and calculating the partition sum for each clamped state.
  *  Therefore, it can be used in combination with any inference algorithm that can calculate/approximate partition sums.
+ *  The clamped states are handled concurrently (if libDAI is built with OpenMP), each thread using its own clone of \a obj.
  *  \param obj instance of inference algorithm to be used 
  *  \param vs variables for which the marginal should be calculated
  *  \param reInit should be set to \c true if at least one of the possible clamped states would be invalid (leading to a factor graph with zero partition sum).
@@ -269,7 +310,8 @@ Factor calcMarginal( const InfAlg& obj, const VarSet& vs, bool reInit );
  *  - clamping pairs of variables in \a vs and calculating the partition sum for each clamped state, if \a accurate == \c true.
  *
  *  Therefore, it can be used in combination with any inference algorithm that can calculate/approximate partition sums (and single variable beliefs, if
- *  \a accurate == \c true).
+ *  \a accurate == \c true). The clamped states are handled concurrently (if libDAI is built with OpenMP), each thread
+ *  using its own clone of \a obj; the results are combined in a fixed order.
  *  \param obj instance of inference algorithm to be used 
  *  \param vs variables for which the pair beliefs should be calculated
  *  \param reInit should be set to \c true if at least one of the possible clamped states would be invalid (leading to a factor graph with zero partition sum).
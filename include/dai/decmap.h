@@ -23,7 +23,12 @@ namespace dai {
 /// Approximate inference algorithm DecMAP, which constructs a MAP state by decimation
 /** Decimation involves repeating the following two steps until no free variables remain:
  *  - run an approximate inference algorithm,
- *  - clamp the factor with the lowest entropy to its most probable state
+ *  - clamp the factor with the lowest entropy (or the \a batch factors with the lowest
+ *    entropies that share no variables) to its most probable state
+ *
+ *  If \a tol is positive, the entropies of the beliefs of the free variables and factors
+ *  are cached; they are only recalculated when the corresponding belief changed by more
+ *  than \a tol (in the \f$\ell_\infty\f$ norm) since it was last used.
  */
 class DecMAP : public DAIAlgFG {
     private:
@@ -45,6 +50,15 @@ class DecMAP : public DAIAlgFG {
             /// Complete or partial reinitialization of clamped subgraphs?
             bool reinit;
 
+            /// If \a reinit is false, continue from the previous messages instead of reinitializing the clamped subgraphs?
+            bool warmstart;
+
+            /// Maximum number of factors that are clamped after each run
+            size_t batch;
+
+            /// If positive, entropies are only recalculated for beliefs that changed by more than this tolerance
+            Real tol;
+
             /// Name of the algorithm used to calculate the beliefs on clamped subgraphs
             std::string ianame;
 
@@ -494,7 +494,9 @@
  *
  *  In addition, libDAI supports parameter learning of conditional probability
  *  tables by Expectation Maximization (or Maximum Likelihood, if there is no
- *  missing data). This is implemented in dai::EMAlg.
+ *  missing data). This is implemented in dai::EMAlg. For fully observed data,
+ *  the factors of undirected models can be estimated by maximizing the
+ *  pseudo-likelihood, which is implemented in dai::PseudoLikelihood.
  *  
  *  \section terminology-variables-states Variables and states
  *
@@ -669,6 +671,24 @@
  *  \end{array}
  *  \f]
  *
+ *  \subsection fileformats-factorgraph-binary Binary factor graph (.fgb) file format
+ *
+ *  A factor graph can also be stored in a binary file (with extension .fgb), which
+ *  is much faster to read than a .fg file because it does not have to be parsed.
+ *  The file consists of 64-bit words in the native byte order:
+ *    - a header of seven words: the characters "libDAIfg", the version number (1),
+ *      the number 0x0102030405060708 (for checking the byte order), the number of
+ *      variables \f$N\f$, the number of factors \f$F\f$, the total number of
+ *      variables of all factors \f$M\f$ and the total number of entries of all factor tables \f$T\f$;
+ *    - for each of the \f$N\f$ variables, two words: its label and its number of states;
+ *    - for each of the \f$F\f$ factors, one word: its number of variables;
+ *    - \f$M\f$ words: for each factor, the indices (in the list of variables above) of
+ *      its variables, ordered by label;
+ *    - zero words up to the next multiple of eight words (64 bytes);
+ *    - \f$T\f$ double precision floating point numbers: the tables of the factors,
+ *      one after the other, in the internal representation of libDAI (i.e., the
+ *      variable with the smallest label changes fastest).
+ *
  *
  *  \section fileformats-evidence Evidence (.tab) file format
  *
@@ -703,6 +723,22 @@
  *  \f$x_1 = 1, x_3 = 0, x_2 = 1\f$, and the third observation being
  *  \f$x_1 = 1, x_2 = 1\f$ (where the state of \f$x_3\f$ is missing).
  *
+ *  \subsection fileformats-evidence-binary Binary evidence file format
+ *
+ *  A dai::EvidenceTable can also be stored in a binary file, which can be
+ *  memory-mapped. The file consists of 64-bit words in the native byte order:
+ *    - a header of six words: the characters "libDAIev", the version number (1),
+ *      the number 0x0102030405060708 (for checking the byte order), the number of
+ *      variables \f$N\f$, the number of samples \f$S\f$ and the number of data words \f$W\f$;
+ *    - for each of the \f$N\f$ variables (columns), five words: its label, its number of
+ *      states, the number of bits \f$b\f$ per state (the smallest of 1, 2, 4, ..., 64 that
+ *      fits the number of states), and the offsets of its states and of its mask in the data words;
+ *    - \f$W\f$ data words. The states of a column occupy \f$\lceil S b / 64 \rceil\f$
+ *      words, where the state of sample \f$s\f$ is stored in bits \f$(s b \bmod 64), \dots, (s b \bmod 64) + b - 1\f$
+ *      of word \f$\lfloor s b / 64 \rfloor\f$; the mask of a column occupies \f$\lceil S / 64 \rceil\f$
+ *      words, where bit \f$(s \bmod 64)\f$ of word \f$\lfloor s / 64 \rfloor\f$ is set if the state of sample
+ *      \f$s\f$ has been observed.
+ *
  *  \section fileformats-emalg Expectation Maximization (.em) file format
  *
  *  This section describes the file format of .em files, which are used
@@ -767,6 +803,11 @@
  */
 
 /** \page bibliography Bibliography
+ *  \anchor Bes75 \ref Bes75
+ *  J. Besag (1975):
+ *  "Statistical Analysis of Non-Lattice Data",
+ *  <em>Journal of the Royal Statistical Society. Series D (The Statistician)</em> 24(3):179-195
+ *
  *  \anchor EaG09 \ref EaG09
  *  F. Eaton and Z. Ghahramani (2009):
  *  "Choosing a Variable to Clamp",
@@ -796,6 +837,11 @@
  *  <em>Probabilistic Graphical Models - Principles and Techniques</em>,
  *  The MIT Press, Cambridge, Massachusetts, London, England.
 
+ *  \anchor LiK09 \ref LiK09
+ *  P. Liang and D. Klein (2009):
+ *  "Online EM for Unsupervised Models",
+ *  <em>Proceedings of Human Language Technologies: NAACL 2009</em>, pp. 611-619
+ *
  *  \anchor Min05 \ref Min05
  *  T. Minka (2005):
  *  "Divergence measures and message passing",
@@ -832,6 +878,11 @@
  *  <em>Journal of Statistical Mechanics: Theory and Experiment</em> 2005(10)-P10011,
  *  http://stacks.iop.org/1742-5468/2005/P10011
  *
+ *  \anchor NoW06 \ref NoW06
+ *  J. Nocedal and S. J. Wright (2006):
+ *  <em>Numerical Optimization</em>, Second Edition,
+ *  Springer, New York.
+ *
  *  \anchor StW99 \ref StW99
  *  A. Steger and N. C. Wormald (1999):
  *  "Generating Random Regular Graphs Quickly",
@@ -18,6 +18,7 @@
 #include <dai/evidence.h>
 #include <dai/index.h>
 #include <dai/properties.h>
+#include <boost/shared_ptr.hpp>
 
 
 /// \file
@@ -219,6 +220,17 @@ class SharedParameters {
          */
         void collectSufficientStatistics( InfAlg &alg );
 
+        /// Calculates the expected values of the parameters according to \a alg, without adding them as sufficient statistics
+        /** For each of the relevant factors, a vector of expected values of the parameters is
+         *  appended to \a stats, as in collectSufficientStatistics().
+         */
+        void calcSufficientStatistics( const InfAlg &alg, std::vector<Prob> &stats ) const;
+
+        /// Adds the sufficient statistics calculated by calcSufficientStatistics(), starting at \a stats[\a pos], multiplied by \a weight
+        /** \return The position in \a stats following the last sufficient statistics that have been added
+         */
+        size_t addSufficientStatistics( const std::vector<Prob> &stats, size_t pos, Real weight = 1.0 );
+
         /// Estimate and set the shared parameters
         /** Based on the sufficient statistics collected so far, the shared parameters are estimated
          *  using the parameter estimation subclass method estimate(). Then, each of the relevant
@@ -252,6 +264,18 @@ class MaximizationStep {
         /// Collect the beliefs from this InfAlg as expectations for the next Maximization step
         void addExpectations( InfAlg &alg );
 
+        /// Calculates the expectations according to \a alg and appends them to \a stats, without adding them
+        /** Calling addExpectations( const std::vector<Prob>& ) with the result is equivalent to
+         *  calling addExpectations( InfAlg& ); this allows to calculate the expectations concurrently.
+         */
+        void calcExpectations( const InfAlg &alg, std::vector<Prob> &stats ) const;
+
+        /// Adds the expectations that have been calculated by calcExpectations(), multiplied by \a weight
+        /** Calling this with \a weight == \a n is equivalent to adding the same expectations \a n times
+         *  (up to rounding errors).
+         */
+        void addExpectations( const std::vector<Prob> &stats, Real weight = 1.0 );
+
         /// Using all of the currently added expectations, make new factors with maximized parameters and set them in the FactorGraph.
         void maximize( FactorGraph &fg );
 
@@ -290,6 +314,23 @@ class MaximizationStep {
  *  parameters, performing another E-step, and then maximizing separate
  *  parameters, which may result in faster convergence in some cases.
  *
+ *  Identical samples in the evidence are handled by a single inference run,
+ *  whose expectations are weighted by the number of occurrences of the sample.
+ *  The inference runs of the E-step are performed concurrently (if libDAI is
+ *  built with OpenMP), each thread reusing a single copy of the inference
+ *  algorithm, whose factors are reloaded after each maximization step; the likelihoods and expectations are added in the order of the
+ *  samples, so the result does not depend on the number of threads (unless the
+ *  inference algorithm itself uses random numbers).
+ *
+ *  For data sets that do not fit into memory, or to speed up convergence on
+ *  large data sets, EMAlg also implements stepwise (online) EM [\ref LiK09]:
+ *  iterateOnline() reads the samples in mini-batches from an EvidenceReader,
+ *  and after each mini-batch, the parameters are estimated from a running
+ *  average of the expected sufficient statistics, in which the statistics of
+ *  the k'th mini-batch (counting from one) get weight \f$ k^{-\alpha} \f$.
+ *  The samples within a mini-batch are processed concurrently, as above.
+ *  The Evidence passed to the constructor is not used by the online methods.
+ *
  *  \author Charles Vaske
  */
 class EMAlg {
@@ -315,6 +356,33 @@ class EMAlg {
         /// Convergence tolerance
         Real _log_z_tol;
 
+        /// Copies of the E-step algorithm, one for each thread, which are kept between iterations
+        /** At the start of each iteration, their factors are updated by InfAlg::reloadFactors().
+         */
+        std::vector<boost::shared_ptr<InfAlg> > _workers;
+
+        /// Step size exponent \f$ \alpha \f$ for online EM
+        Real _step_alpha;
+
+        /// Number of mini-batches processed by online EM
+        size_t _onlineSteps;
+
+        /// Number of samples processed by online EM
+        size_t _onlineSamples;
+
+        /// Number of samples in one pass over the data, if known (zero otherwise)
+        size_t _onlinePassSamples;
+
+        /// Running averages of the expected sufficient statistics per sample, for each maximization step (online EM)
+        std::vector<std::vector<Prob> > _onlineStats;
+
+        /// Performs the E-step for \a mstep on the samples in \a evidence
+        /** If \a sum is NULL, the expectations are added to \a mstep; otherwise,
+         *  \a sum is set to the sum of the expectations over all samples.
+         *  \return The log-likelihood of \a evidence
+         */
+        Real eStep( const Evidence &evidence, MaximizationStep &mstep, std::vector<Prob> *sum );
+
     public:
         /// Key for setting maximum iterations
         static const std::string MAX_ITERS_KEY;
@@ -324,6 +392,10 @@ class EMAlg {
         static const std::string LOG_Z_TOL_KEY;
         /// Default likelihood tolerance
         static const Real LOG_Z_TOL_DEFAULT;
+        /// Key for setting the step size exponent of online EM
+        static const std::string STEP_ALPHA_KEY;
+        /// Default step size exponent of online EM
+        static const Real STEP_ALPHA_DEFAULT;
 
         /// Construct an EMAlg from several objects
         /** \param evidence Specifies the observed evidence
@@ -332,7 +404,7 @@ class EMAlg {
          *  \param termconditions Termination conditions @see setTermConditions()
          */
         EMAlg( const Evidence &evidence, InfAlg &estep, std::vector<MaximizationStep> &msteps, const PropertySet &termconditions )
-          : _evidence(evidence), _estep(estep), _msteps(msteps), _iters(0), _lastLogZ(), _max_iters(MAX_ITERS_DEFAULT), _log_z_tol(LOG_Z_TOL_DEFAULT)
+          : _evidence(evidence), _estep(estep), _msteps(msteps), _iters(0), _lastLogZ(), _max_iters(MAX_ITERS_DEFAULT), _log_z_tol(LOG_Z_TOL_DEFAULT), _workers(), _step_alpha(STEP_ALPHA_DEFAULT), _onlineSteps(0), _onlineSamples(0), _onlinePassSamples(0), _onlineStats()
         {
               setTermConditions( termconditions );
         }
@@ -343,11 +415,13 @@ class EMAlg {
         EMAlg( const Evidence &evidence, InfAlg &estep, std::istream &mstep_file );
 
         /// Change the conditions for termination
-        /** There are two possible parameters in the PropertySet \a p:
+        /** There are three possible parameters in the PropertySet \a p:
          *    - \a max_iters maximum number of iterations
          *    - \a log_z_tol critical proportion of increase in logZ
+         *    - \a step_alpha step size exponent \f$ \alpha \f$ of online EM, which should satisfy \f$ 0.5 < \alpha \le 1 \f$
          *
          *  \see hasSatisifiedTermConditions()
+         *  \throw MALFORMED_PROPERTY if \a step_alpha is out of range
          */
         void setTermConditions( const PropertySet &p );
 
@@ -357,6 +431,10 @@ class EMAlg {
          *    -# the ratio of logZ increase over previous logZ is less than the
          *       tolerance, i.e.,
          *       \f$ \frac{\log(Z_t) - \log(Z_{t-1})}{| \log(Z_{t-1}) | } < \mathrm{tol} \f$.
+         *
+         *  For online EM, an iteration is a pass over the data, and as the log-likelihood
+         *  of a pass is not guaranteed to increase, the absolute value of the change is
+         *  used in the second condition.
          */
         bool hasSatisfiedTermConditions() const;
 
@@ -380,6 +458,19 @@ class EMAlg {
         /// Iterate until termination conditions are satisfied
         void run();
 
+        /// Performs a step of online EM on the mini-batch \a batch, for each maximization step
+        /** \return Log-likelihood of \a batch before the parameters were updated
+         */
+        Real iterateOnline( const Evidence &batch );
+
+        /// Performs a pass of online EM over all samples of \a reader, in mini-batches of \a batchSize samples
+        /** \return Log-likelihood of the pass, i.e., the sum of the log-likelihoods of the mini-batches
+         */
+        Real iterateOnline( EvidenceReader &reader, size_t batchSize );
+
+        /// Performs passes of online EM over the samples of \a reader until the termination conditions are satisfied
+        void runOnline( EvidenceReader &reader, size_t batchSize );
+
     /// \name Iterator interface
     //@{
         /// Iterator over the maximization steps
@@ -7,7 +7,7 @@
 
 
 /// \file
-/// \brief Defines class Evidence, which stores multiple observations of joint states of variables
+/// \brief Defines classes Evidence and EvidenceTable, which store multiple observations of joint states of variables, and classes EvidenceReader, EvidenceTabReader and EvidenceTableReader, which read observations in batches
 
 
 #ifndef __defined_libdai_evidence_h
@@ -16,6 +16,8 @@
 
 #include <istream>
 #include <dai/daialg.h>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
 
 
 namespace dai {
@@ -46,6 +48,7 @@ class Evidence {
         /// Read in tabular data from a stream and add the read samples to \c *this.
         /** \param is Input stream in .tab file format, describing joint observations of variables in \a fg
          *  \param fg Factor graph describing the corresponding variables
+         *  \note The lines are parsed concurrently (if libDAI is built with OpenMP).
          *  \see \ref fileformats-evidence
          *  \throw INVALID_EVIDENCE_FILE if the input stream is not valid
          */
@@ -54,6 +57,18 @@ class Evidence {
         /// Returns number of stored samples
         size_t nrSamples() const { return _samples.size(); }
 
+        /// Adds the sample \a sample
+        void addSample( const Observation &sample ) { _samples.push_back( sample ); }
+
+        /// Removes all samples
+        void clear() { _samples.clear(); }
+
+        /// Finds the distinct samples and their multiplicities
+        /** \param patterns is set to the indices of the first occurrences of the distinct samples, in increasing order
+         *  \param counts is set to the number of occurrences of each of these samples
+         */
+        void findPatterns( std::vector<size_t> &patterns, std::vector<size_t> &counts ) const;
+
     /// \name Iterator interface
     //@{
         /// Iterator over the samples
@@ -77,6 +92,190 @@ class Evidence {
 };
 
 
+/// Stores a data set consisting of multiple samples of the joint state of a fixed set of variables, some of which may be missing, in a compact columnar format
+/** For each variable (column), the states of all samples are stored consecutively,
+ *  using the smallest number of bits per state among 1, 2, 4, ..., 64 that fits
+ *  the number of states of the variable, together with a bit mask that indicates
+ *  which states have been observed. For example, a data set of binary variables
+ *  takes 2 bits per value, whereas an Evidence object takes a tree node per value.
+ *
+ *  An EvidenceTable can be read from a .tab file (which is parsed concurrently if
+ *  libDAI is built with OpenMP) and can be written to and read from a binary file
+ *  (see \ref fileformats-evidence-binary), which is memory-mapped when read, so
+ *  the samples are only loaded from disk when they are accessed.
+ */
+class EvidenceTable {
+    private:
+        /// Variables corresponding to the columns
+        std::vector<Var> _vars;
+        /// Number of samples
+        size_t _nrSamples;
+        /// Number of bits per state, for each column
+        std::vector<size_t> _bits;
+        /// Offset of the states of each column, in words
+        std::vector<size_t> _valueOffsets;
+        /// Offset of the observation masks of each column, in words
+        std::vector<size_t> _maskOffsets;
+        /// Total number of words
+        size_t _nrWords;
+        /// Words containing the states and masks of all columns (unless the table has been memory-mapped)
+        std::vector<boost::uint64_t> _storage;
+        /// Memory-mapped binary file (if any)
+        boost::shared_ptr<MappedFile> _file;
+        /// Offset of the words in the memory-mapped file, in bytes
+        size_t _fileOffset;
+
+        /// Returns pointer to the words containing the states and masks of all columns
+        const boost::uint64_t* words() const {
+            if( _file )
+                return reinterpret_cast<const boost::uint64_t *>( _file->data() + _fileOffset );
+            else
+                return _storage.empty() ? NULL : &(_storage[0]);
+        }
+
+        /// Sets the variables, the number of samples and the layout of the columns, and allocates zeroed storage
+        void allocate( const std::vector<Var> &vars, size_t nrSamples );
+
+    public:
+        /// Default constructor
+        EvidenceTable() : _vars(), _nrSamples(0), _bits(), _valueOffsets(), _maskOffsets(), _nrWords(0), _storage(), _file(), _fileOffset(0) {}
+
+        /// Construct from the samples in \a evidence
+        /** The columns correspond with all variables that have been observed in some sample.
+         */
+        EvidenceTable( const Evidence &evidence );
+
+    /// \name Queries
+    //@{
+        /// Returns number of samples
+        size_t nrSamples() const { return _nrSamples; }
+
+        /// Returns number of variables (columns)
+        size_t nrVars() const { return _vars.size(); }
+
+        /// Returns the variables corresponding to the columns
+        const std::vector<Var>& vars() const { return _vars; }
+
+        /// Returns whether the state of the variable of column \a col has been observed in sample \a sample
+        bool observed( size_t sample, size_t col ) const {
+            DAI_DEBASSERT( sample < _nrSamples && col < _vars.size() );
+            return (words()[_maskOffsets[col] + sample / 64] >> (sample % 64)) & 1;
+        }
+
+        /// Returns the observed state of the variable of column \a col in sample \a sample (0 if it has not been observed)
+        size_t state( size_t sample, size_t col ) const {
+            DAI_DEBASSERT( sample < _nrSamples && col < _vars.size() );
+            size_t bits = _bits[col];
+            size_t pos = sample * bits;
+            boost::uint64_t w = words()[_valueOffsets[col] + pos / 64] >> (pos % 64);
+            return (bits == 64) ? w : (w & ((((boost::uint64_t)1) << bits) - 1));
+        }
+
+        /// Returns the observed joint state of sample \a sample
+        Evidence::Observation observation( size_t sample ) const;
+
+        /// Adds the samples \a first, \a first + 1, ..., \a first + \a n - 1 to \a evidence
+        void getSamples( Evidence &evidence, size_t first, size_t n ) const;
+
+        /// Returns the number of bytes used for storing the samples
+        size_t bytes() const { return _nrWords * sizeof(boost::uint64_t); }
+    //@}
+
+    /// \name Input/output
+    //@{
+        /// Reads the samples from a file in .tab file format, replacing the contents of \c *this
+        /** \param filename Name of the file, describing joint observations of variables in \a fg
+         *  \param fg Factor graph describing the corresponding variables
+         *  \see \ref fileformats-evidence
+         *  \throw CANNOT_READ_FILE if the file cannot be opened
+         *  \throw INVALID_EVIDENCE_FILE if the file is not valid
+         */
+        void ReadTabFile( const char *filename, const FactorGraph &fg );
+
+        /// Reads the samples from a binary file, replacing the contents of \c *this
+        /** The file is memory-mapped and stays mapped as long as \c *this (or a copy) refers to it.
+         *  \see \ref fileformats-evidence-binary
+         *  \throw CANNOT_READ_FILE if the file cannot be opened
+         *  \throw INVALID_EVIDENCE_FILE if the file is not valid
+         */
+        void ReadFromFile( const char *filename );
+
+        /// Writes the samples to a binary file
+        /** \see \ref fileformats-evidence-binary
+         *  \throw CANNOT_WRITE_FILE if the file cannot be written
+         */
+        void WriteToFile( const char *filename ) const;
+    //@}
+};
+
+
+/// Interface for reading samples in batches from a data set that does not need to fit in memory
+class EvidenceReader {
+    public:
+        /// Virtual destructor
+        virtual ~EvidenceReader() {}
+
+        /// Replaces the samples in \a batch by the next (at most) \a n samples
+        /** \return The number of samples read (zero if all samples have been read)
+         */
+        virtual size_t read( Evidence &batch, size_t n ) = 0;
+
+        /// Continues reading from the first sample
+        virtual void rewind() = 0;
+};
+
+
+/// Reads the samples from a stream in .tab file format in batches
+/** \see \ref fileformats-evidence
+ */
+class EvidenceTabReader : public EvidenceReader {
+    private:
+        /// Stream from which the samples are read
+        std::istream &_is;
+        /// Variables corresponding to the columns
+        std::vector<Var> _vars;
+        /// Position of the first sample in the stream
+        std::streampos _first;
+        /// Number of the line that has been read last
+        size_t _line_number;
+
+    public:
+        /// Construct from an input stream \a is, describing joint observations of variables in \a fg, and read the header
+        /** \note In order to use rewind(), \a is should support seeking.
+         *  \throw INVALID_EVIDENCE_FILE if the header is not valid
+         */
+        EvidenceTabReader( std::istream &is, const FactorGraph &fg );
+
+        /// Replaces the samples in \a batch by the next (at most) \a n samples
+        /** \throw INVALID_EVIDENCE_FILE if a sample is not valid
+         */
+        virtual size_t read( Evidence &batch, size_t n );
+
+        /// Continues reading from the first sample
+        virtual void rewind();
+};
+
+
+/// Reads the samples of an EvidenceTable in batches
+class EvidenceTableReader : public EvidenceReader {
+    private:
+        /// Table from which the samples are read
+        const EvidenceTable &_table;
+        /// Index of the next sample
+        size_t _pos;
+
+    public:
+        /// Construct from the table \a table
+        EvidenceTableReader( const EvidenceTable &table ) : _table(table), _pos(0) {}
+
+        /// Replaces the samples in \a batch by the next (at most) \a n samples
+        virtual size_t read( Evidence &batch, size_t n );
+
+        /// Continues reading from the first sample
+        virtual void rewind() { _pos = 0; }
+};
+
+
 } // end of namespace dai
 
 
@@ -58,7 +58,7 @@ namespace dai {
  *  could also be implemented in the TFactor itself, which could maintain its state
  *  (ones/delta/full) and act accordingly. Update: it seems that the proposed functionality 
  *  would not be enough for CBP, for which it would make more sense to add more levels of
- *  backup/restore.
+ *  backup/restore (which are now provided by pushBackups() and popBackups()).
  *
  *  \todo Write a method that applies evidence (should we represent evidence as a map<Var,size_t> or as a map<size_t,size_t>?)
  */ 
@@ -72,12 +72,18 @@ class FactorGraph {
         std::vector<Factor>      _factors;
         /// Stores backups of some factors
         std::map<size_t,Factor>  _backup;
+        /// Stores the nested levels of backups opened by pushBackups()
+        std::vector<std::map<size_t,Factor> > _backupLevels;
+        /// Maps the labels of the variables to their indices
+        hash_map<size_t,size_t>  _varIndex;
+        /// Maps the hash values of the VarSets of the factors to the index of the first factor with that hash value
+        hash_map<size_t,size_t>  _factorIndex;
 
     public:
     /// \name Constructors and destructors
     //@{
         /// Default constructor
-        FactorGraph() : _G(), _vars(), _factors(), _backup() {}
+        FactorGraph() : _G(), _vars(), _factors(), _backup(), _backupLevels(), _varIndex(), _factorIndex() {}
 
         /// Constructs a factor graph from a vector of factors
         FactorGraph( const std::vector<Factor>& P );
@@ -140,18 +146,18 @@ class FactorGraph {
         size_t nrEdges() const { return _G.nrEdges(); }
 
         /// Returns the index of a particular variable
-        /** \note Time complexity: O(nrVars())
+        /** \note Time complexity: O(1) (expected)
          *  \throw OBJECT_NOT_FOUND if the variable is not part of this factor graph
          */
         size_t findVar( const Var& n ) const {
-            size_t i = find( vars().begin(), vars().end(), n ) - vars().begin();
-            if( i == nrVars() )
+            hash_map<size_t,size_t>::const_iterator it = _varIndex.find( n.label() );
+            if( it == _varIndex.end() )
                 DAI_THROW(OBJECT_NOT_FOUND);
-            return i;
+            return it->second;
         }
 
         /// Returns a set of indexes corresponding to a set of variables
-        /** \note Time complexity: O( nrVars() * ns.size() )
+        /** \note Time complexity: O( ns.size() ) (expected)
          *  \throw OBJECT_NOT_FOUND if one of the variables is not part of this factor graph
          */
         SmallSet<size_t> findVars( const VarSet& ns ) const {
@@ -162,10 +168,17 @@ class FactorGraph {
         }
 
         /// Returns index of the first factor that depends on the variables
-        /** \note Time complexity: O(nrFactors())
+        /** \note Time complexity: O( ns.size() ) (expected), or O(nrFactors()) if the
+         *  VarSets of different factors have the same hash value
          *  \throw OBJECT_NOT_FOUND if no factor in this factor graph depends on those variables
          */
         size_t findFactor( const VarSet& ns ) const {
+            hash_map<size_t,size_t>::const_iterator it = _factorIndex.find( hash_value( ns ) );
+            if( it == _factorIndex.end() )
+                DAI_THROW(OBJECT_NOT_FOUND);
+            if( factor(it->second).vars() == ns )
+                return it->second;
+            // hash collision: fall back to a linear search
             size_t I;
             for( I = 0; I < nrFactors(); I++ )
                 if( factor(I).vars() == ns )
@@ -251,7 +264,9 @@ class FactorGraph {
         }
 
         /// Makes a backup of the \a I 'th factor
-        /** \throw MULTIPLE_UNDO if a backup already exists
+        /** If a nested level of backups has been opened by pushBackups(), the backup is made
+         *  at that level, unless the factor has already been backed up at that level.
+         *  \throw MULTIPLE_UNDO if no nested level is open and a backup already exists
          */
         void backupFactor( size_t I );
 
@@ -260,6 +275,21 @@ class FactorGraph {
          */
         void restoreFactor( size_t I );
 
+        /// Opens a new nested level of backups
+        /** Until the matching popBackups(), all backups are made at this level. Since only the
+         *  first backup of each factor is kept at each level, the memory needed for a level
+         *  is proportional to the number of factors changed at that level.
+         */
+        virtual void pushBackups() { _backupLevels.push_back( std::map<size_t,Factor>() ); }
+
+        /// Restores all factors that have been backed up since the matching pushBackups() and closes that level
+        /** \throw OBJECT_NOT_FOUND if no nested level of backups is open
+         */
+        virtual void popBackups();
+
+        /// Returns the number of nested levels of backups that are currently open
+        size_t nrBackupLevels() const { return _backupLevels.size(); }
+
         /// Backup the factors specified by indices in \a facs
         /** \throw MULTIPLE_UNDO if a backup already exists
          */
@@ -277,6 +307,11 @@ class FactorGraph {
         void restoreFactors( const VarSet& ns );
     //@}
 
+    private:
+        /// Returns the backups at the innermost open level
+        std::map<size_t,Factor>& currentBackups() { return _backupLevels.empty() ? _backup : _backupLevels.back(); }
+
+    public:
     /// \name Transformations
     //@{
         /// Returns a copy of \c *this, where all factors that are subsumed by some larger factor are merged with the larger factors.
@@ -315,14 +350,20 @@ class FactorGraph {
     /// \name Input/Output
     //@{
         /// Reads a factor graph from a file
-        /** \see \ref fileformats-factorgraph
+        /** If the name of the file ends with ".fgb", the file should be in the binary format; otherwise, it should be a .fg file.
+         *  The file is mapped into memory. A .fg file is scanned quickly for the start of each factor block, after which the
+         *  factors are parsed concurrently (if libDAI is built with OpenMP) and constructed in place; the factor tables
+         *  of a binary file are copied directly from the mapped file.
+         *  \see \ref fileformats-factorgraph, \ref fileformats-factorgraph-binary
          *  \throw CANNOT_READ_FILE if the file cannot be opened
          *  \throw INVALID_FACTORGRAPH_FILE if the file is not valid
          */
         virtual void ReadFromFile( const char *filename );
 
         /// Writes a factor graph to a file
-        /** \see \ref fileformats-factorgraph
+        /** If the name of the file ends with ".fgb", the binary format is used (and \a precision is ignored);
+         *  otherwise, a .fg file is written.
+         *  \see \ref fileformats-factorgraph, \ref fileformats-factorgraph-binary
          *  \throw CANNOT_WRITE_FILE if the file cannot be written
          */
         virtual void WriteToFile( const char *filename, size_t precision=15 ) const;
@@ -343,13 +384,26 @@ class FactorGraph {
     //@}
 
     private:
-        /// Part of constructors (creates edges, neighbors and adjacency matrix)
+        /// Part of constructors (creates edges, neighbors and adjacency matrix, and the indices of the variables and factors)
         void constructGraph( size_t nrEdges );
+
+        /// Replaces the factor graph by the one described (in the .fg file format) by the characters [\a begin, \a end)
+        /** \throw INVALID_FACTORGRAPH_FILE if the characters do not form a valid .fg file
+         */
+        void parseFg( const char *begin, const char *end );
+
+        /// Replaces the factor graph by the one stored (in the binary format) in the \a size bytes at \a data
+        /** \throw INVALID_FACTORGRAPH_FILE if the data do not form a valid binary factor graph file
+         */
+        void loadFgb( const char *data, size_t size );
+
+        /// Writes the factor graph in the binary format to \a os
+        void writeFgb( std::ostream &os ) const;
 };
 
 
 template<typename FactorInputIterator, typename VarInputIterator>
-FactorGraph::FactorGraph(FactorInputIterator facBegin, FactorInputIterator facEnd, VarInputIterator varBegin, VarInputIterator varEnd, size_t nrFacHint, size_t nrVarHint ) : _G(), _backup() {
+FactorGraph::FactorGraph(FactorInputIterator facBegin, FactorInputIterator facEnd, VarInputIterator varBegin, VarInputIterator varEnd, size_t nrFacHint, size_t nrVarHint ) : _G(), _backup(), _backupLevels(), _varIndex(), _factorIndex() {
     // add factors
     size_t nrEdges = 0;
     _factors.reserve( nrFacHint );
@@ -31,6 +31,9 @@ namespace dai {
 /// Approximate inference algorithm: implementation of single-loop ("Generalized Belief Propagation") and double-loop algorithms by Heskes, Albers and Kappen [\ref HAK03]
 class HAK : public DAIAlgRG {
     private:
+        /// Type used for index cache
+        typedef std::vector<size_t> ind_t;
+
         /// Outer region beliefs
         std::vector<Factor>                _Qa;
         /// Inner region beliefs
@@ -39,6 +42,18 @@ class HAK : public DAIAlgRG {
         std::vector<std::vector<Factor> >  _muab;
         /// Messages from inner to outer regions
         std::vector<std::vector<Factor> >  _muba;
+        /// Index cache: _indices[alpha][_beta][x] is the state of the \a _beta 'th neighboring inner region of outer region \a alpha that corresponds with state \a x of \a alpha
+        std::vector<std::vector<ind_t> >   _indices;
+        /// Groups of inner regions that do not share outer regions (used for COLORED updates)
+        std::vector<std::vector<size_t> >  _IRcolors;
+        /// For each variable, the region whose belief is marginalized in beliefV() (\a beta for inner region \a beta, nrIRs() + \a alpha for outer region \a alpha)
+        std::vector<size_t>                _beliefRegionV;
+        /// For each factor, the region whose belief is marginalized in beliefF() (\a beta for inner region \a beta, nrIRs() + \a alpha for outer region \a alpha)
+        std::vector<size_t>                _beliefRegionF;
+        /// Workspace of doGBP(): single variable beliefs after the previous iteration
+        std::vector<Factor>                _oldBeliefsV;
+        /// Workspace of doGBP(): factor beliefs after the previous iteration
+        std::vector<Factor>                _oldBeliefsF;
         /// Maximum difference encountered so far
         Real _maxdiff;
         /// Number of iterations needed
@@ -59,6 +74,15 @@ class HAK : public DAIAlgRG {
             /// Enumeration of possible message initializations
             DAI_ENUM(InitType,UNIFORM,RANDOM);
 
+            /// Enumeration of possible update schedules
+            /** The following update schedules are defined:
+             *   - SEQFIX inner regions are updated sequentially, in a fixed order
+             *   - COLORED inner regions are updated group by group, where each group consists of
+             *     inner regions that have no outer regions in common; the inner regions within one
+             *     group are updated in parallel (if libDAI is built with OpenMP support)
+             */
+            DAI_ENUM(UpdateType,SEQFIX,COLORED);
+
             /// Verbosity (amount of output sent to stderr)
             size_t verbose;
 
@@ -80,18 +104,27 @@ class HAK : public DAIAlgRG {
             /// How to initialize the messages
             InitType init;
 
+            /// Update schedule for the single-loop algorithm
+            UpdateType updates;
+
             /// Use single-loop (GBP) or double-loop (HAK)
             bool doubleloop;
 
             /// Depth of loops (only relevant for \a clusters == \c ClustersType::LOOP)
             size_t loopdepth;
+
+            /// Maximum number of loop clusters to search for (only relevant for \a clusters == \c ClustersType::LOOP; 0 means no limit)
+            size_t maxloops;
+
+            /// Maximum time (in seconds) for searching loop clusters (only relevant for \a clusters == \c ClustersType::LOOP)
+            double maxlooptime;
         } props;
 
     public:
     /// \name Constructors/destructors
     //@{
         /// Default constructor
-        HAK() : DAIAlgRG(), _Qa(), _Qb(), _muab(), _muba(), _maxdiff(0.0), _iters(0U), props() {}
+        HAK() : DAIAlgRG(), _Qa(), _Qb(), _muab(), _muba(), _indices(), _IRcolors(), _beliefRegionV(), _beliefRegionF(), _oldBeliefsV(), _oldBeliefsF(), _maxdiff(0.0), _iters(0U), props() {}
 
         /// Construct from FactorGraph \a fg and PropertySet \a opts
         /** \param fg Factor graph.
@@ -110,6 +143,8 @@ class HAK : public DAIAlgRG {
         virtual HAK* construct( const FactorGraph &fg, const PropertySet &opts ) const { return new HAK( fg, opts ); }
         virtual std::string name() const { return "HAK"; }
         virtual Factor belief( const VarSet &vs ) const;
+        virtual Factor beliefV( size_t i ) const;
+        virtual Factor beliefF( size_t I ) const;
         virtual std::vector<Factor> beliefs() const;
         virtual Real logZ() const;
         virtual void init();
@@ -138,22 +173,38 @@ class HAK : public DAIAlgRG {
         /// Runs single-loop algorithm (algorithm 1 in [\ref HAK03])
         Real doGBP();
         /// Runs double-loop algorithm (as described in section 4.2 of [\ref HAK03]), which always convergences
+        /** The inner loop (doGBP()) is warm-started from the messages and beliefs of the previous outer iteration
+         *  and reuses the same workspace. The outer region potentials are updated concurrently if OpenMP is enabled.
+         */
         Real doDoubleLoop();
     //@}
 
     private:
         /// Helper function for constructors
         void construct();
-        /// Recursive procedure for finding clusters of variables containing loops of length at most \a length
-        /** \param fg the factor graph
-         *  \param allcl the clusters found so far
-         *  \param newcl partial candidate cluster
-         *  \param root start (and end) point of the loop
-         *  \param length number of variables that may be added to \a newcl
-         *  \param vars neighboring variables of \a newcl
-         *  \return allcl all clusters of variables with loops of length at most \a length passing through root
+        /// Updates the messages and beliefs of inner region \a beta and of its neighboring outer regions
+        /** \return \c false if NaNs were encountered, \c true otherwise
+         */
+        bool updateInnerRegion( size_t beta );
+        /// Returns the marginal on \a vs of the belief of region \a r (\a beta for inner region \a beta, nrIRs() + \a alpha for outer region \a alpha)
+        Factor regionBelief( size_t r, const VarSet &vs ) const;
+        /// Calculates the new single variable and factor beliefs and stores them in \a oldBeliefsV and \a oldBeliefsF
+        /** \return the maximum distance (in DISTLINF sense) between the new and old beliefs
+         */
+        Real updateOldBeliefs( std::vector<Factor> &oldBeliefsV, std::vector<Factor> &oldBeliefsF ) const;
+        /// Finds all clusters of variables containing loops of length at most \a props.loopdepth
+        /** A loop cluster consists of the variables on a loop in the Markov graph of \a fg, where at least
+         *  one of these variables has no other neighbors in the cluster than its two neighbors on the loop.
+         *
+         *  The loops are enumerated by an iterative depth-first search on the Markov graph (stored in
+         *  compressed sparse row format). Each loop is only generated from its variable with the smallest
+         *  index (and in only one direction), so that each loop cluster is found exactly once. The search
+         *  is parallelized over these root variables, and is aborted when it exceeds the limits
+         *  \a props.maxloops or \a props.maxlooptime.
+         *  \param fg the factor graph
+         *  \return all loop clusters, in sorted order
          */
-        void findLoopClusters( const FactorGraph &fg, std::set<VarSet> &allcl, VarSet newcl, const Var & root, size_t length, VarSet vars );
+        std::vector<VarSet> findLoopClusters( const FactorGraph &fg ) const;
 };
 
 
@@ -36,6 +36,10 @@ class LC : public DAIAlgFG {
         std::vector<std::vector<Factor> > _phis;
         /// Single variable beliefs
         std::vector<Factor> _beliefs;
+        /// Pointwise inverses of the factors (recalculated at the start of run())
+        std::vector<Factor> _invfactors;
+        /// Groups of variables that are not in each other's Markov blanket (used for COLORED updates)
+        std::vector<std::vector<size_t> > _colors;
         /// Maximum difference encountered so far
         Real _maxdiff;
         /// Number of iterations needed
@@ -57,8 +61,10 @@ class LC : public DAIAlgFG {
             /** The following update schedules are defined:
              *  - SEQFIX sequential fixed schedule
              *  - SEQRND sequential random schedule
+             *  - COLORED variables that are not in each other's Markov blanket are updated concurrently
+             *    (if OpenMP is enabled); the factors of each variable are processed in a fixed order
              */
-            DAI_ENUM(UpdateType,SEQFIX,SEQRND);
+            DAI_ENUM(UpdateType,SEQFIX,SEQRND,COLORED);
 
             /// Verbosity (amount of output sent to stderr)
             size_t verbose;
@@ -86,11 +92,17 @@ class LC : public DAIAlgFG {
 
             /// Parameters for the algorithm used to initialize the cavity distributions
             PropertySet cavaiopts;
+
+            /// File in which the cavity distributions are cached (if nonempty)
+            /** If this file exists, the cavity distributions are read from it;
+             *  otherwise, they are calculated and written to it.
+             */
+            std::string cavfile;
         } props;
 
     public:
         /// Default constructor
-        LC() : DAIAlgFG(), _pancakes(), _cavitydists(), _phis(), _beliefs(), _maxdiff(), _iters(), props() {}
+        LC() : DAIAlgFG(), _pancakes(), _cavitydists(), _phis(), _beliefs(), _invfactors(), _colors(), _maxdiff(), _iters(), props() {}
 
         /// Construct from FactorGraph \a fg and PropertySet \a opts
         /** \param fg Factor graph.
@@ -125,9 +137,21 @@ class LC : public DAIAlgFG {
         /// Approximates the cavity distribution of variable \a i, using the inference algorithm \a name with parameters \a opts
         Real CalcCavityDist( size_t i, const std::string &name, const PropertySet &opts );
         /// Approximates all cavity distributions using inference algorithm \a name with parameters \a opts
+        /** The cavity distributions are independent of each other, so they are calculated concurrently
+         *  (if OpenMP is enabled), each by its own clone of the inference algorithm.
+         */
         Real InitCavityDists( const std::string &name, const PropertySet &opts );
         /// Sets approximate cavity distributions to \a Q
         long SetCavityDists( std::vector<Factor> &Q );
+        /// Writes the approximate cavity distributions to the file \a filename (in .fg format)
+        /** \throw CANNOT_WRITE_FILE if the file cannot be written
+         */
+        void SaveCavityDists( const std::string &filename ) const;
+        /// Reads the approximate cavity distributions from the file \a filename, which should have been written by SaveCavityDists()
+        /** \throw CANNOT_READ_FILE if the file cannot be read
+         *  \throw INVALID_FACTORGRAPH_FILE if the file does not contain cavity distributions for this factor graph
+         */
+        void LoadCavityDists( const std::string &filename );
         /// Updates the belief of the Markov blanket of variable \a i based upon the information from its \a _I 'th neighboring factor
         Factor NewPancake (size_t i, size_t _I, bool & hasNaNs);
         /// Calculates the belief of variable \a i
@@ -137,6 +161,14 @@ class LC : public DAIAlgFG {
         /// Returns the approximate cavity distribution for variable \a i
         const Factor &cavitydist (size_t i) const { return _cavitydists[i]; };
     //@}
+
+    private:
+        /// Approximates the cavity distribution of variable \a i, using a clone of \a cavai (which should be \c NULL if \a props.cavity == \c UNIFORM)
+        Real calcCavityDist( size_t i, const InfAlg *cavai );
+        /// Calculates the marginal on \a ns of the product of \a pancake with the inverse of factor \a I (and \a invphi, if not \c NULL), without constructing the product
+        /** \pre The variables of factor \a I and \a ns should be contained in those of \a pancake, and \a invphi should be a factor on \a ns.
+         */
+        Factor pancakeMarginal( const Factor &pancake, size_t I, const Factor *invphi, const VarSet &ns ) const;
 };
 
 
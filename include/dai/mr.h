@@ -51,6 +51,9 @@ class MR : public DAIAlgFG {
 
         /// Type used for managing a subset of neighbors
         typedef boost::dynamic_bitset<> sub_nb;
+
+        /// Type used for managing a subset of neighbors as a bitmask (used for \a props.updates == \c FULL)
+        typedef size_t sub_mask;
         
         /// Magnetizations
         std::vector<Real> Mag;
@@ -135,12 +138,6 @@ class MR : public DAIAlgFG {
         /// Calculate magnetizations
         void calcMagnetizations();
 
-        /// Calculate the product of all tJ[i][_j] for _j in A
-        /** \param i variable index
-         *  \param A subset of neighbors of variable \a i
-         */
-        Real _tJ(size_t i, sub_nb A);
-        
         /// Calculate \f$ \Omega^{(i)}_{j,l} \f$ as defined in [\ref MoR05] eqn. (2.15)
         Real Omega(size_t i, size_t _j, size_t _l);
         
@@ -159,24 +156,27 @@ class MR : public DAIAlgFG {
         /// Calculates \f$ \Gamma^{(i)}_{l_1l_2} \f$ as defined in [\ref MoK07] on page 1141
         Real Gamma(size_t i, size_t _l1, size_t _l2);
         
-        /// Approximates moments of variables in \a A
-        /** Calculate the moment of variables in \a A from M and cors, neglecting higher order cumulants,
-         *  defined as the sum over all partitions of A into subsets of cardinality two at most of the
-         *  product of the cumulants (either first order, i.e. M, or second order, i.e. cors) of the
-         *  entries of the partitions.
+        /// Calculates the products of tJ and the approximate moments for all subsets of neighbors of \a i
+        /** The approximate moment of the variables in a subset \a A of neighbors of \a i is calculated
+         *  from M and cors, neglecting higher order cumulants, as the sum over all partitions of \a A into
+         *  subsets of cardinality two at most of the product of the cumulants (either first order, i.e. M,
+         *  or second order, i.e. cors) of the entries of the partitions. Both tables are filled by dynamic
+         *  programming over the subsets, in order of increasing bitmask.
          *
          *  \param i variable index
-         *  \param A subset of neighbors of variable \a i
+         *  \param tJs on return, tJs[A] will contain the product of all tJ[i][_j] for _j in \a A
+         *  \param appMs on return, appMs[A] will contain the approximate moment of the variables in \a A
          */
-        Real appM(size_t i, sub_nb A);
-        
-        /// Calculate sum over all even/odd subsets B of \a A of _tJ(j,B) appM(j,B)
-        /** \param j variable index
-         *  \param A subset of neighbors of variable \a j
+        void calcSubsetTables( size_t i, std::vector<Real> &tJs, std::vector<Real> &appMs ) const;
+
+        /// Calculate sum over all even/odd subsets B of \a A of tJs[B] appMs[B]
+        /** \param A subset of neighbors of some variable
+         *  \param tJs products of tJ for that variable, as calculated by calcSubsetTables()
+         *  \param appMs approximate moments for that variable, as calculated by calcSubsetTables()
          *  \param sum_even on return, will contain the sum over all even subsets
          *  \param sum_odd on return, will contain the sum over all odd subsets
          */
-        void sum_subs(size_t j, sub_nb A, Real *sum_even, Real *sum_odd);
+        void sum_subs( sub_mask A, const std::vector<Real> &tJs, const std::vector<Real> &appMs, Real *sum_even, Real *sum_odd ) const;
 };
 
 
@@ -0,0 +1,165 @@
+/*  This file is part of libDAI - http://www.libdai.org/
+ *
+ *  Copyright (c) 2006-2011, The libDAI authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license that can be found in the LICENSE file.
+ */
+
+
+/// \file
+/// \brief Defines class PseudoLikelihood, which estimates factor parameters from fully observed data by maximizing the pseudo-likelihood
+
+
+#ifndef __defined_libdai_pseudolikelihood_h
+#define __defined_libdai_pseudolikelihood_h
+
+
+#include <vector>
+#include <dai/factorgraph.h>
+#include <dai/evidence.h>
+#include <dai/properties.h>
+
+
+namespace dai {
+
+
+/// Estimates the parameters of (some of) the factors of a factor graph from fully observed data by maximizing the pseudo-likelihood
+/** The pseudo-likelihood [\ref Bes75] of a sample \f$x\f$ is the product over all variables
+ *  \f$x_i\f$ of the conditional probability \f$P(x_i \mid x_{\delta i})\f$ of the state of the
+ *  variable, given the states of its Markov blanket \f$\delta i\f$. As opposed to the likelihood,
+ *  it does not involve the partition sum, so it can be evaluated without running an inference
+ *  algorithm, in time linear in the number of samples and in the total size of the factors.
+ *  Maximizing the pseudo-likelihood yields a consistent estimator of the parameters of an
+ *  undirected model; in contrast with EMAlg, it only handles fully observed data.
+ *
+ *  The logarithms of the entries of the factors to be estimated are the parameters, which
+ *  are optimized by the limited-memory BFGS quasi-Newton method [\ref NoW06], starting from
+ *  uniform factors. The objective is the average negative log pseudo-likelihood of the samples,
+ *  plus an optional L2 regularization term \f$\frac{\lambda}{2} \sum \theta^2\f$. The samples
+ *  are processed in blocks, which are evaluated concurrently (if libDAI is built with OpenMP);
+ *  the result does not depend on the number of threads.
+ */
+class PseudoLikelihood {
+    private:
+        /// Factor graph whose factors are estimated
+        FactorGraph &_fg;
+
+        /// Indicates for each factor of _fg whether its parameters are estimated
+        std::vector<char> _estimate;
+
+        /// Offsets of the parameters of each factor; the parameters of the estimated factors come first
+        std::vector<size_t> _offsets;
+
+        /// Number of parameters that are estimated
+        size_t _nrEstimated;
+
+        /// Indices of the variables of each factor, in the canonical ordering of its VarSet
+        std::vector<std::vector<size_t> > _factorVars;
+
+        /// Strides of the variables of each factor (corresponding with _factorVars)
+        std::vector<std::vector<size_t> > _factorStrides;
+
+        /// For each variable, the stride of the variable in each neighboring factor (corresponding with _fg.nbV())
+        std::vector<std::vector<size_t> > _varStrides;
+
+        /// Maximum number of iterations
+        size_t _max_iters;
+
+        /// Convergence tolerance
+        Real _tol;
+
+        /// L2 regularization constant
+        Real _l2;
+
+        /// Number of correction pairs used by L-BFGS
+        size_t _history;
+
+        /// Verbosity
+        size_t _verbose;
+
+        /// Number of iterations done
+        size_t _iters;
+
+        /// Sets up the data structures
+        void construct( const std::vector<size_t> &factors );
+
+        /// Returns the logarithms of the entries of the factors of _fg
+        std::vector<Real> parameters() const;
+
+        /// Calculates the average negative log pseudo-likelihood and (if \a grad is not NULL) its gradient for the parameters \a theta
+        /** \param data Fully observed samples
+         *  \param cols Column in \a data of each variable of _fg
+         *  \param theta Logarithms of the entries of the factors
+         *  \param grad If not NULL, set to the gradient with respect to the parameters that are estimated
+         */
+        Real objective( const EvidenceTable &data, const std::vector<size_t> &cols, const std::vector<Real> &theta, std::vector<Real> *grad ) const;
+
+        /// Returns the column in \a data of each variable of _fg
+        /** \throw OBJECT_NOT_FOUND if some variable does not occur in \a data
+         */
+        std::vector<size_t> findColumns( const EvidenceTable &data ) const;
+
+    public:
+        /// Key for setting maximum iterations
+        static const std::string MAX_ITERS_KEY;
+        /// Default maximum iterations
+        static const size_t MAX_ITERS_DEFAULT;
+        /// Key for setting the convergence tolerance
+        static const std::string TOL_KEY;
+        /// Default convergence tolerance
+        static const Real TOL_DEFAULT;
+        /// Key for setting the L2 regularization constant
+        static const std::string L2_KEY;
+        /// Default L2 regularization constant
+        static const Real L2_DEFAULT;
+        /// Key for setting the number of correction pairs used by L-BFGS
+        static const std::string HISTORY_KEY;
+        /// Default number of correction pairs
+        static const size_t HISTORY_DEFAULT;
+        /// Key for setting the verbosity
+        static const std::string VERBOSE_KEY;
+
+        /// Construct from a factor graph \a fg, estimating all its factors
+        /** \param fg Factor graph whose factors are estimated (and set by run())
+         *  \param opts Options, see setProperties()
+         */
+        PseudoLikelihood( FactorGraph &fg, const PropertySet &opts );
+
+        /// Construct from a factor graph \a fg, estimating the factors with indices in \a factors
+        /** The other factors of \a fg are kept fixed.
+         */
+        PseudoLikelihood( FactorGraph &fg, const std::vector<size_t> &factors, const PropertySet &opts );
+
+        /// Change the options
+        /** The possible keys of \a opts are:
+         *    - \a max_iters maximum number of L-BFGS iterations
+         *    - \a tol the optimization stops if the relative decrease of the objective, or the maximum absolute value of its gradient, is less than \a tol
+         *    - \a l2 L2 regularization constant \f$\lambda\f$
+         *    - \a history number of correction pairs used by L-BFGS
+         *    - \a verbose verbosity
+         */
+        void setProperties( const PropertySet &opts );
+
+        /// Returns the average log pseudo-likelihood of the samples in \a data according to the current factors
+        /** \note All variables of the factor graph should have been observed in all samples.
+         *  \throw OBJECT_NOT_FOUND if some variable does not occur in \a data
+         *  \throw INVALID_EVIDENCE_FILE if some sample is not fully observed
+         */
+        Real logPseudoLikelihood( const EvidenceTable &data ) const;
+
+        /// Estimates the factors by maximizing the pseudo-likelihood of the samples in \a data, and sets them in the factor graph
+        /** \return The average log pseudo-likelihood of \a data according to the estimated factors
+         *  \throw OBJECT_NOT_FOUND if some variable does not occur in \a data
+         *  \throw INVALID_EVIDENCE_FILE if some sample is not fully observed
+         */
+        Real run( const EvidenceTable &data );
+
+        /// Returns number of iterations done by the last run()
+        size_t Iterations() const { return _iters; }
+};
+
+
+} // end of namespace dai
+
+
+#endif
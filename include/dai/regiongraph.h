@@ -217,11 +217,16 @@ class RegionGraph : public FactorGraph {
 
         /// Set the contents of all factors as specified by \a facs and make a backup of the old contents if \a backup == \c true
         virtual void setFactors( const std::map<size_t, Factor>& facs, bool backup = false ) {
-            FactorGraph::setFactors( facs, backup );
-            VarSet ns;
-            for( std::map<size_t, Factor>::const_iterator fac = facs.begin(); fac != facs.end(); fac++ )
-                ns |= fac->second.vars();
-            recomputeORs( ns );
+            // the outer regions are only recomputed once, instead of once for each factor
+            std::vector<Var> vs;
+            for( std::map<size_t, Factor>::const_iterator fac = facs.begin(); fac != facs.end(); fac++ ) {
+                FactorGraph::setFactor( fac->first, fac->second, backup );
+                vs.insert( vs.end(), fac->second.vars().begin(), fac->second.vars().end() );
+            }
+            if( facs.size() == nrFactors() )
+                recomputeORs();
+            else
+                recomputeORs( VarSet( vs.begin(), vs.end(), vs.size() ) );
         }
     //@}
 
@@ -280,6 +285,8 @@ class RegionGraph : public FactorGraph {
          *  where \f$\mathrm{an}(\beta)\f$ are the ancestors of inner region \f$\beta\f$ according to
          *  the partial ordering induced by the subset relation (i.e., a region is a child of another
          *  region if its variables are a subset of the variables of its parent region).
+         *  The inner regions are visited in order of decreasing size, so that the counting numbers
+         *  of all ancestors are known when an inner region is visited.
          */
         void calcCVMCountingNumbers();
 
@@ -52,6 +52,14 @@ class TreeEP : public JTree {
              */
             DAI_ENUM(TypeType,ORG,ALT);
 
+            /// Enumeration of possible update schedules
+            /** The following update schedules are defined:
+             *  - \c SEQFIX sequential updates of the off-tree factors, in a fixed order;
+             *  - \c COLORED off-tree factors whose subtrees have no outer regions in common are
+             *            updated concurrently (if OpenMP is enabled).
+             */
+            DAI_ENUM(UpdateType,SEQFIX,COLORED);
+
             /// Verbosity (amount of output sent to stderr)
             size_t verbose;
 
@@ -66,6 +74,12 @@ class TreeEP : public JTree {
 
             /// How to choose the tree
             TypeType type;
+
+            /// Update schedule
+            UpdateType updates;
+
+            /// Skip the update of an off-tree factor if the marginals on its subtree changed less than this tolerance since its last update (0 means: never skip)
+            Real skiptol;
         } props;
 
     private:
@@ -76,6 +90,9 @@ class TreeEP : public JTree {
          */
         class TreeEPSubTree {
             private:
+                /// Type used for index cache
+                typedef std::vector<size_t> ind_t;
+
                 /// Outer region pseudomarginals (corresponding with the \f$\tilde f_i(x_j,x_k)\f$ in [\ref MiQ04])
                 std::vector<Factor>  _Qa;
                 /// Inner region pseudomarginals (corresponding with the \f$\tilde f_i(x_s)\f$ in [\ref MiQ04])
@@ -94,15 +111,40 @@ class TreeEP : public JTree {
                 VarSet               _nsrem;
                 /// Used for calculating the free energy
                 Real                 _logZ;
+                /// Index cache: _parentInd[i][x] is the state of _Qb[i] that corresponds with state \a x of _Qa[_RTree[i].first]
+                std::vector<ind_t>   _parentInd;
+                /// Index cache: _childInd[i][x] is the state of _Qb[i] that corresponds with state \a x of _Qa[_RTree[i].second]
+                std::vector<ind_t>   _childInd;
+                /// Index cache: _rootInd[x] + _remInd[s] is the state of the off-tree factor that corresponds with state \a x of _Qa[0] and state \a s of _nsrem
+                ind_t                _rootInd;
+                /// Index cache: see _rootInd
+                ind_t                _remInd;
+                /// Index cache for clamping: state \a x of _Qa[_RTree[i].second] is consistent with state \a s of _nsrem iff _clampInd[i][x] == _clampTarget[i][s] (empty if _Qa[_RTree[i].second] does not contain variables in _nsrem)
+                std::vector<ind_t>   _clampInd;
+                /// Index cache for clamping: see _clampInd
+                std::vector<ind_t>   _clampTarget;
+                /// Workspace for HUGIN_with_I(): backup of _Qa
+                std::vector<Factor>  _Qa_old;
+                /// Workspace for HUGIN_with_I(): backup of _Qb
+                std::vector<Factor>  _Qb_old;
+                /// Workspace for HUGIN_with_I(): new separator marginal
+                Prob                 _newQb;
+                /// Supertree outer region marginals on this subtree computed by the last call of HUGIN_with_I() (empty if there was none)
+                std::vector<Prob>    _QaOut;
+                /// Supertree inner region marginals on this subtree computed by the last call of HUGIN_with_I() (empty if there was none)
+                std::vector<Prob>    _QbOut;
+
+                /// Passes a HUGIN message from \a from to \a to through separator \a sep, using the cached indices \a fromInd and \a toInd
+                void passMessage( const Prob &from, const ind_t &fromInd, Prob &to, const ind_t &toInd, Prob &sep );
 
             public:
             /// \name Constructors/destructors
             //@{
                 /// Default constructor
-                TreeEPSubTree() : _Qa(), _Qb(), _RTree(), _a(), _b(), _I(NULL), _ns(), _nsrem(), _logZ(0.0) {}
+                TreeEPSubTree() : _Qa(), _Qb(), _RTree(), _a(), _b(), _I(NULL), _ns(), _nsrem(), _logZ(0.0), _parentInd(), _childInd(), _rootInd(), _remInd(), _clampInd(), _clampTarget(), _Qa_old(), _Qb_old(), _newQb(), _QaOut(), _QbOut() {}
 
                 /// Copy constructor
-                TreeEPSubTree( const TreeEPSubTree &x ) : _Qa(x._Qa), _Qb(x._Qb), _RTree(x._RTree), _a(x._a), _b(x._b), _I(x._I), _ns(x._ns), _nsrem(x._nsrem), _logZ(x._logZ) {}
+                TreeEPSubTree( const TreeEPSubTree &x ) : _Qa(x._Qa), _Qb(x._Qb), _RTree(x._RTree), _a(x._a), _b(x._b), _I(x._I), _ns(x._ns), _nsrem(x._nsrem), _logZ(x._logZ), _parentInd(x._parentInd), _childInd(x._childInd), _rootInd(x._rootInd), _remInd(x._remInd), _clampInd(x._clampInd), _clampTarget(x._clampTarget), _Qa_old(x._Qa_old), _Qb_old(x._Qb_old), _newQb(x._newQb), _QaOut(x._QaOut), _QbOut(x._QbOut) {}
 
                 /// Assignment operator
                 TreeEPSubTree & operator=( const TreeEPSubTree& x ) {
@@ -116,6 +158,17 @@ class TreeEP : public JTree {
                         _ns         = x._ns;
                         _nsrem      = x._nsrem;
                         _logZ       = x._logZ;
+                        _parentInd  = x._parentInd;
+                        _childInd   = x._childInd;
+                        _rootInd    = x._rootInd;
+                        _remInd     = x._remInd;
+                        _clampInd   = x._clampInd;
+                        _clampTarget = x._clampTarget;
+                        _Qa_old     = x._Qa_old;
+                        _Qb_old     = x._Qb_old;
+                        _newQb      = x._newQb;
+                        _QaOut      = x._QaOut;
+                        _QbOut      = x._QbOut;
                     }
                     return *this;
                 }
@@ -136,6 +189,12 @@ class TreeEP : public JTree {
                 /// Returns energy (?) of this subtree
                 Real logZ( const std::vector<Factor> &Qa, const std::vector<Factor> &Qb ) const;
 
+                /// Returns \c true if the (super) junction tree marginals \a Qa and \a Qb on this subtree differ less than \a tol (in DISTLINF sense) from those computed by the last call of HUGIN_with_I()
+                bool unchanged( const std::vector<Factor> &Qa, const std::vector<Factor> &Qb, Real tol ) const;
+
+                /// Returns the (super) junction tree outer region indices of this subtree
+                const std::vector<size_t>& a() const { return _a; }
+
                 /// Returns constant reference to the pointer to the off-tree factor
                 const Factor *& I() { return _I; }
         };
@@ -143,12 +202,15 @@ class TreeEP : public JTree {
         /// Stores a TreeEPSubTree object for each off-tree factor
         std::map<size_t, TreeEPSubTree>  _Q;
 
+        /// Groups of off-tree factors whose subtrees have no outer regions in common (used for COLORED updates)
+        std::vector<std::vector<size_t> > _colors;
+
     public:
         /// Default constructor
-        TreeEP() : JTree(), _maxdiff(0.0), _iters(0), props(), _Q() {}
+        TreeEP() : JTree(), _maxdiff(0.0), _iters(0), props(), _Q(), _colors() {}
 
         /// Copy constructor
-        TreeEP( const TreeEP &x ) : JTree(x), _maxdiff(x._maxdiff), _iters(x._iters), props(x.props), _Q(x._Q) {
+        TreeEP( const TreeEP &x ) : JTree(x), _maxdiff(x._maxdiff), _iters(x._iters), props(x.props), _Q(x._Q), _colors(x._colors) {
             for( size_t I = 0; I < nrFactors(); I++ )
                 if( offtree( I ) )
                     _Q[I].I() = &factor(I);
@@ -162,6 +224,7 @@ class TreeEP : public JTree {
                 _iters   = x._iters;
                 props    = x.props;
                 _Q       = x._Q;
+                _colors  = x._colors;
                 for( size_t I = 0; I < nrFactors(); I++ )
                     if( offtree( I ) )
                         _Q[I].I() = &factor(I);
@@ -196,6 +259,8 @@ class TreeEP : public JTree {
     private:
         /// Helper function for constructors
         void construct( const FactorGraph& fg, const RootedTree& tree );
+        /// Updates the approximation of off-tree factor \a I (unless it can be skipped according to \a props.skiptol)
+        void updateOffTreeFactor( size_t I );
         /// Returns \c true if factor \a I is not part of the tree
         bool offtree( size_t I ) const { return (fac2OR(I) == -1U); }
 };
@@ -39,6 +39,10 @@
     #include <tr1/unordered_map> // only present in modern GCC distributions
 #endif
 
+#ifdef DAI_WITH_OPENMP
+    #include <omp.h>
+#endif
+
 
 /// An alias to the BOOST_FOREACH macro from the boost::bforeach library
 #define bforeach BOOST_FOREACH
@@ -61,6 +65,18 @@
 /// Macro to write message \a stmt to \c std::cerr if \a props.verbose >= \a n
 #define DAI_IFVERB(n, stmt) if(props.verbose>=n) { std::cerr << stmt; }
 
+/// Helper macro that converts its arguments into a string literal
+#define DAI_STRINGIFY(...) #__VA_ARGS__
+
+#ifdef DAI_WITH_OPENMP
+/// Emits the OpenMP directive "#pragma omp ..." (only if DAI_WITH_OPENMP is defined)
+/** Example: \code DAI_OMP(parallel for schedule(dynamic)) \endcode
+ */
+#define DAI_OMP(...) _Pragma(DAI_STRINGIFY(omp __VA_ARGS__))
+#else
+#define DAI_OMP(...)
+#endif
+
 
 #ifdef WINDOWS
     /// Returns inverse hyperbolic tangent of argument
@@ -127,6 +143,25 @@ template <typename T, typename U, typename H = boost::hash<T> >
 double toc();
 
 
+/// Returns the maximum number of threads that a parallel region will use (1 if libDAI is built without OpenMP)
+inline size_t nrThreads() {
+#ifdef DAI_WITH_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/// Returns the index of the calling thread within the current parallel region (0 if libDAI is built without OpenMP)
+inline size_t threadNum() {
+#ifdef DAI_WITH_OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+
 /// Returns absolute value of \a t
 template<class T>
 inline T abs( const T &t ) {
@@ -223,6 +258,56 @@ std::vector<T> concat( const std::vector<T>& u, const std::vector<T>& v ) {
  */
 std::vector<std::string> tokenizeString( const std::string& s, bool singleDelim, const std::string& delim="\t\n" );
 
+/// Parses the nonnegative integer in decimal notation consisting of the characters [\a begin, \a end)
+/** \return \c false if the characters do not form a nonnegative integer that fits into a \c size_t (in which case \a x is unchanged)
+ */
+bool parseNumber( const char *begin, const char *end, size_t &x );
+
+/// Parses the real number consisting of the characters [\a begin, \a end), with the same result as \c strtod()
+/** Numbers with few significant digits and a small exponent (the common case) are converted
+ *  directly, which is exact; other numbers are passed on to \c strtod().
+ *  \return \c false if the characters do not form a real number (in which case \a x is unchanged)
+ */
+bool parseNumber( const char *begin, const char *end, Real &x );
+
+
+/// Read-only view of the contents of a file
+/** On POSIX systems, the file is mapped into memory (using mmap()), so that
+ *  its pages are only read from disk when they are accessed and can be shared
+ *  between processes; on other platforms, the file is read into memory.
+ */
+class MappedFile {
+    private:
+        /// Pointer to the contents of the file
+        const char *_data;
+        /// Size of the file in bytes
+        size_t _size;
+        /// Contents of the file (if it has not been mapped)
+        std::vector<char> _buf;
+
+        /// Copy constructor (not implemented)
+        MappedFile( const MappedFile & );
+        /// Assignment operator (not implemented)
+        MappedFile& operator=( const MappedFile & );
+
+    public:
+        /// Opens the file \a filename
+        /** \throw CANNOT_READ_FILE if the file cannot be opened
+         */
+        explicit MappedFile( const char *filename );
+
+        /// Destructor (unmaps the file)
+        ~MappedFile();
+
+        /// Returns a pointer to the contents of the file
+        /** \note The contents are not terminated by a null character; if the file was mapped, the pointer is aligned to a page boundary.
+         */
+        const char* data() const { return _data; }
+
+        /// Returns the size of the file in bytes
+        size_t size() const { return _size; }
+};
+
 
 /// Enumerates different ways of normalizing a probability measure.
 /**
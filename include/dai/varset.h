@@ -149,6 +149,15 @@ class VarSet : public SmallSet<Var> {
 };
 
 
+/// Returns a hash value for \a vs, based on the labels of its variables (allows a VarSet to be used as key of a hash_map)
+inline size_t hash_value( const VarSet &vs ) {
+    size_t seed = 0;
+    for( VarSet::const_iterator v = vs.begin(); v != vs.end(); v++ )
+        boost::hash_combine( seed, v->label() );
+    return seed;
+}
+
+
 } // end of namespace dai
 
 
@@ -6,6 +6,8 @@
  */
 
 
+#include <algorithm>
+#include <cmath>
 #include <dai/bp.h>
 #include <dai/bbp.h>
 #include <dai/gibbs.h>
@@ -142,75 +144,114 @@ Real BBPCostFunction::evaluate( const InfAlg &ia, const vector<size_t> *stateP )
 
 
 void BBP::RegenerateInds() {
-    // initialise _indices
-    //     typedef std::vector<size_t>        _ind_t;
-    //     std::vector<std::vector<_ind_t> >  _indices;
-    _indices.resize( _fg->nrVars() );
-    for( size_t i = 0; i < _fg->nrVars(); i++ ) {
-        _indices[i].clear();
-        _indices[i].reserve( _fg->nbV(i).size() );
+    // number the edges and lay out the flat arrays
+    size_t nv = _fg->nrVars();
+    _edgeOffsets.resize( nv + 1 );
+    _edgeOffsets[0] = 0;
+    for( size_t i = 0; i < nv; i++ )
+        _edgeOffsets[i+1] = _edgeOffsets[i] + _fg->nbV(i).size();
+    size_t ne = _edgeOffsets[nv];
+    _varOffsets.resize( ne + 1 );
+    _factorOffsets.resize( ne + 1 );
+    _ROffsets.resize( ne + 1 );
+    _SFirst.resize( ne + 1 );
+    _varOffsets[0] = _factorOffsets[0] = _ROffsets[0] = _SFirst[0] = 0;
+    _SOffsets.clear();
+    size_t s = 0;
+    for( size_t i = 0; i < nv; i++ ) {
+        size_t i_states = _fg->var(i).states();
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            _ind_t index;
-            index.reserve( _fg->factor(I).nrStates() );
-            for( IndexFor k(_fg->var(i), _fg->factor(I).vars()); k.valid(); ++k )
-                index.push_back( k );
-            _indices[i].push_back( index );
+            size_t e = _edge( i, I.iter );
+            _varOffsets[e+1] = _varOffsets[e] + i_states;
+            _factorOffsets[e+1] = _factorOffsets[e] + _fg->factor(I).nrStates();
+            _ROffsets[e+1] = _ROffsets[e] + _fg->nbV(i).size() * i_states;
+            _SFirst[e+1] = _SFirst[e] + _fg->nbF(I).size();
+            bforeach( const Neighbor &j, _fg->nbF(I) ) {
+                _SOffsets.push_back( s );
+                if( i != j )
+                    s += i_states * _fg->var(j).states();
+            }
         }
     }
+    _SOffsets.push_back( s );
+
+    // initialise _indices, sharing the index tables of the BP object if it has them
+    const BP *bp = dynamic_cast<const BP *>( _ia );
+    _indices.assign( ne, NULL );
+    _ownIndices.clear();
+    for( size_t i = 0; i < nv; i++ )
+        bforeach( const Neighbor &I, _fg->nbV(i) ) {
+            size_t e = _edge( i, I.iter );
+            if( bp && bp->edgeIndex( i, I.iter ).size() == _fg->factor(I).nrStates() )
+                _indices[e] = &(bp->edgeIndex( i, I.iter ));
+            else {
+                if( _ownIndices.empty() )
+                    _ownIndices.resize( ne );
+                _ind_t &index = _ownIndices[e];
+                index.reserve( _fg->factor(I).nrStates() );
+                for( IndexFor k(_fg->var(i), _fg->factor(I).vars()); k.valid(); ++k )
+                    index.push_back( k );
+                _indices[e] = &index;
+            }
+        }
 }
 
 
-void BBP::RegenerateT() {
-    // _Tmsg[i][_I]
-    _Tmsg.resize( _fg->nrVars() );
-    for( size_t i = 0; i < _fg->nrVars(); i++ ) {
-        _Tmsg[i].resize( _fg->nbV(i).size() );
+void BBP::RegenerateT( const vector<size_t> &vars ) {
+    _Tmsg.resize( _varOffsets.back() );
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t v = 0; v < vars.size(); v++ ) {
+        size_t i = vars[v];
+        size_t i_states = _fg->var(i).states();
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            Prob prod( _fg->var(i).states(), 1.0 );
+            Real *prod = T( i, I.iter );
+            fill( prod, prod + i_states, 1.0 );
             bforeach( const Neighbor &J, _fg->nbV(i) )
-                if( J.node != I.node )
-                    prod *= _bp_dual.msgM( i, J.iter );
-            _Tmsg[i][I.iter] = prod;
+                if( J.node != I.node ) {
+                    const Prob &m_iJ = _bp_dual.msgM( i, J.iter );
+                    for( size_t xi = 0; xi < i_states; xi++ )
+                        prod[xi] *= m_iJ[xi];
+                }
         }
     }
 }
 
 
-void BBP::RegenerateU() {
-    // _Umsg[I][_i]
-    _Umsg.resize( _fg->nrFactors() );
-    for( size_t I = 0; I < _fg->nrFactors(); I++ ) {
-        _Umsg[I].resize( _fg->nbF(I).size() );
+void BBP::RegenerateU( const vector<size_t> &factors ) {
+    _Umsg.resize( _factorOffsets.back() );
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t f = 0; f < factors.size(); f++ ) {
+        size_t I = factors[f];
+        size_t I_states = _fg->factor(I).nrStates();
         bforeach( const Neighbor &i, _fg->nbF(I) ) {
-            Prob prod( _fg->factor(I).nrStates(), 1.0 );
+            Real *prod = U( i, i.dual );
+            fill( prod, prod + I_states, 1.0 );
             bforeach( const Neighbor &j, _fg->nbF(I) )
                 if( i.node != j.node ) {
-                    Prob n_jI( _bp_dual.msgN( j, j.dual ) );
+                    const Prob &n_jI = _bp_dual.msgN( j, j.dual );
                     const _ind_t &ind = _index( j, j.dual );
                     // multiply prod by n_jI
-                    for( size_t x_I = 0; x_I < prod.size(); x_I++ )
-                        prod.set( x_I, prod[x_I] * n_jI[ind[x_I]] );
+                    for( size_t x_I = 0; x_I < I_states; x_I++ )
+                        prod[x_I] *= n_jI[ind[x_I]];
                 }
-            _Umsg[I][i.iter] = prod;
         }
     }
 }
 
 
-void BBP::RegenerateS() {
-    // _Smsg[i][_I][_j]
-    _Smsg.resize( _fg->nrVars() );
-    for( size_t i = 0; i < _fg->nrVars(); i++ ) {
-        _Smsg[i].resize( _fg->nbV(i).size() );
-        bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            _Smsg[i][I.iter].resize( _fg->nbF(I).size() );
+void BBP::RegenerateS( const vector<size_t> &factors ) {
+    _Smsg.resize( _SOffsets.back() );
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t f = 0; f < factors.size(); f++ ) {
+        size_t I = factors[f];
+        bforeach( const Neighbor &i, _fg->nbF(I) ) {
             bforeach( const Neighbor &j, _fg->nbF(I) )
-                if( i != j ) {
+                if( i.node != j.node ) {
                     Factor prod( _fg->factor(I) );
                     bforeach( const Neighbor &k, _fg->nbF(I) ) {
-                        if( k != i && k.node != j.node ) {
+                        if( k.node != i.node && k.node != j.node ) {
                             const _ind_t &ind = _index( k, k.dual );
-                            Prob p( _bp_dual.msgN( k, k.dual ) );
+                            const Prob &p = _bp_dual.msgN( k, k.dual );
                             for( size_t x_I = 0; x_I < prod.nrStates(); x_I++ )
                                 prod.set( x_I, prod[x_I] * p[ind[x_I]] );
                         }
@@ -218,27 +259,30 @@ void BBP::RegenerateS() {
                     // "Marginalize" onto i|j (unnormalized)
                     Prob marg;
                     marg = prod.marginal( VarSet(_fg->var(i), _fg->var(j)), false ).p();
-                    _Smsg[i][I.iter][j.iter] = marg;
+                    copy( marg.begin(), marg.end(), S( i, i.dual, j.iter ) );
                 }
         }
     }
 }
 
 
-void BBP::RegenerateR() {
-    // _Rmsg[I][_i][_J]
-    _Rmsg.resize( _fg->nrFactors() );
-    for( size_t I = 0; I < _fg->nrFactors(); I++ ) {
-        _Rmsg[I].resize( _fg->nbF(I).size() );
-        bforeach( const Neighbor &i, _fg->nbF(I) ) {
-            _Rmsg[I][i.iter].resize( _fg->nbV(i).size() );
+void BBP::RegenerateR( const vector<size_t> &vars ) {
+    _Rmsg.resize( _ROffsets.back() );
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t v = 0; v < vars.size(); v++ ) {
+        size_t i = vars[v];
+        size_t i_states = _fg->var(i).states();
+        bforeach( const Neighbor &I, _fg->nbV(i) ) {
             bforeach( const Neighbor &J, _fg->nbV(i) ) {
                 if( I != J ) {
-                    Prob prod( _fg->var(i).states(), 1.0 );
+                    Real *prod = R( i, I.iter, J.iter );
+                    fill( prod, prod + i_states, 1.0 );
                     bforeach( const Neighbor &K, _fg->nbV(i) )
-                        if( K.node != I && K.node != J.node )
-                            prod *= _bp_dual.msgM( i, K.iter );
-                    _Rmsg[I][i.iter][J.iter] = prod;
+                        if( K.node != I.node && K.node != J.node ) {
+                            const Prob &m_iK = _bp_dual.msgM( i, K.iter );
+                            for( size_t xi = 0; xi < i_states; xi++ )
+                                prod[xi] *= m_iK[xi];
+                        }
                 }
             }
         }
@@ -288,48 +332,43 @@ void BBP::RegeneratePsiAdjoints() {
 
 
 void BBP::RegenerateParMessageAdjoints() {
-    size_t nv = _fg->nrVars();
-    _adj_n.resize( nv );
-    _adj_m.resize( nv );
-    _adj_n_unnorm.resize( nv );
-    _adj_m_unnorm.resize( nv );
-    _new_adj_n.resize( nv );
-    _new_adj_m.resize( nv );
+    size_t n = _varOffsets.back();
+    _adj_n.resize( n );
+    _adj_m.resize( n );
+    _adj_n_unnorm.resize( n );
+    _adj_m_unnorm.resize( n );
+    _new_adj_n.resize( n );
+    _new_adj_m.resize( n );
+    DAI_OMP(parallel for schedule(dynamic,16))
     for( size_t i = 0; i < _fg->nrVars(); i++ ) {
-        size_t n_i = _fg->nbV(i).size();
-        _adj_n[i].resize( n_i );
-        _adj_m[i].resize( n_i );
-        _adj_n_unnorm[i].resize( n_i );
-        _adj_m_unnorm[i].resize( n_i );
-        _new_adj_n[i].resize( n_i );
-        _new_adj_m[i].resize( n_i );
+        size_t i_states = _fg->var(i).states();
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
             { // calculate adj_n
                 Prob prod( _fg->factor(I).p() );
                 prod *= _adj_b_F_unnorm[I];
                 bforeach( const Neighbor &j, _fg->nbF(I) )
                     if( i != j ) {
-                        Prob n_jI( _bp_dual.msgN( j, j.dual ) );
+                        const Prob &n_jI = _bp_dual.msgN( j, j.dual );
                         const _ind_t &ind = _index( j, j.dual );
                         // multiply prod with n_jI
                         for( size_t x_I = 0; x_I < prod.size(); x_I++ )
                             prod.set( x_I, prod[x_I] * n_jI[ind[x_I]] );
                     }
-                Prob marg( _fg->var(i).states(), 0.0 );
+                Real *marg = new_adj_n( i, I.iter );
+                fill( marg, marg + i_states, 0.0 );
                 const _ind_t &ind = _index( i, I.iter );
                 for( size_t r = 0; r < prod.size(); r++ )
-                    marg.set( ind[r], marg[ind[r]] + prod[r] );
-                _new_adj_n[i][I.iter] = marg;
+                    marg[ind[r]] += prod[r];
                 upMsgN( i, I.iter );
             }
 
             { // calculate adj_m
                 Prob prod( _adj_b_V_unnorm[i] );
-                DAI_ASSERT( prod.size() == _fg->var(i).states() );
+                DAI_ASSERT( prod.size() == i_states );
                 bforeach( const Neighbor &J, _fg->nbV(i) )
                     if( J.node != I.node )
                         prod *= _bp_dual.msgM(i,J.iter);
-                _new_adj_m[i][I.iter] = prod;
+                copy( prod.begin(), prod.end(), new_adj_m( i, I.iter ) );
                 upMsgM( i, I.iter );
             }
         }
@@ -338,15 +377,12 @@ void BBP::RegenerateParMessageAdjoints() {
 
 
 void BBP::RegenerateSeqMessageAdjoints() {
-    size_t nv = _fg->nrVars();
-    _adj_m.resize( nv );
-    _adj_m_unnorm.resize( nv );
-    _new_adj_m.resize( nv );
+    size_t n = _varOffsets.back();
+    _adj_m.resize( n );
+    _adj_m_unnorm.resize( n );
+    _new_adj_m.assign( n, 0.0 );
+    DAI_OMP(parallel for schedule(dynamic,16))
     for( size_t i = 0; i < _fg->nrVars(); i++ ) {
-        size_t n_i = _fg->nbV(i).size();
-        _adj_m[i].resize( n_i );
-        _adj_m_unnorm[i].resize( n_i );
-        _new_adj_m[i].resize( n_i );
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
             // calculate adj_m
             Prob prod( _adj_b_V_unnorm[i] );
@@ -354,11 +390,11 @@ void BBP::RegenerateSeqMessageAdjoints() {
             bforeach( const Neighbor &J, _fg->nbV(i) )
                 if( J.node != I.node )
                     prod *= _bp_dual.msgM( i, J.iter );
-            _adj_m[i][I.iter] = prod;
+            copy( prod.begin(), prod.end(), adj_m( i, I.iter ) );
             calcUnnormMsgM( i, I.iter );
-            _new_adj_m[i][I.iter] = Prob( _fg->var(i).states(), 0.0 );
         }
     }
+    // sendSeqMsgN() changes the adjoints of other edges, hence this loop is sequential
     for( size_t i = 0; i < _fg->nrVars(); i++ ) {
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
             // calculate adj_n
@@ -366,7 +402,7 @@ void BBP::RegenerateSeqMessageAdjoints() {
             prod *= _adj_b_F_unnorm[I];
             bforeach( const Neighbor &j, _fg->nbF(I) )
                 if( i != j ) {
-                    Prob n_jI( _bp_dual.msgN( j, j.dual) );
+                    const Prob &n_jI = _bp_dual.msgN( j, j.dual );
                     const _ind_t& ind = _index( j, j.dual );
                     // multiply prod with n_jI
                     for( size_t x_I = 0; x_I < prod.size(); x_I++ )
@@ -383,11 +419,31 @@ void BBP::RegenerateSeqMessageAdjoints() {
 
 
 void BBP::Regenerate() {
-    RegenerateInds();
-    RegenerateT();
-    RegenerateU();
-    RegenerateS();
-    RegenerateR();
+    vector<size_t> changed = _bp_dual.refresh();
+    bool all = (_edgeOffsets.size() != _fg->nrVars() + 1);
+    if( all )
+        RegenerateInds();
+
+    // T and R depend on the messages into the variables of changed factors,
+    // U and S on the messages into the factors of those variables
+    vector<size_t> vars, factors;
+    vector<char> isVar( _fg->nrVars(), all ), isFactor( _fg->nrFactors(), all );
+    for( size_t c = 0; c < changed.size(); c++ )
+        bforeach( const Neighbor &i, _fg->nbF(changed[c]) )
+            isVar[i] = true;
+    for( size_t i = 0; i < _fg->nrVars(); i++ )
+        if( isVar[i] ) {
+            vars.push_back( i );
+            bforeach( const Neighbor &I, _fg->nbV(i) )
+                isFactor[I] = true;
+        }
+    for( size_t I = 0; I < _fg->nrFactors(); I++ )
+        if( isFactor[I] )
+            factors.push_back( I );
+    RegenerateT( vars );
+    RegenerateU( factors );
+    RegenerateS( factors );
+    RegenerateR( vars );
     RegenerateInputs();
     RegeneratePsiAdjoints();
     if( props.updates == Properties::UpdateType::PAR )
@@ -399,16 +455,21 @@ void BBP::Regenerate() {
 
 
 void BBP::calcNewN( size_t i, size_t _I ) {
-    _adj_psi_V[i] += T(i,_I) * _adj_n_unnorm[i][_I];
-    Prob &new_adj_n_iI = _new_adj_n[i][_I];
-    new_adj_n_iI = Prob( _fg->var(i).states(), 0.0 );
+    size_t i_states = _fg->var(i).states();
+    const Real *T_iI = T( i, _I );
+    const Real *adj_n_unnorm_iI = adj_n_unnorm( i, _I );
+    Prob &adj_psi_V_i = _adj_psi_V[i];
+    for( size_t xi = 0; xi < i_states; xi++ )
+        adj_psi_V_i.set( xi, adj_psi_V_i[xi] + T_iI[xi] * adj_n_unnorm_iI[xi] );
+    Real *new_adj_n_iI = new_adj_n( i, _I );
+    fill( new_adj_n_iI, new_adj_n_iI + i_states, 0.0 );
     size_t I = _fg->nbV(i)[_I];
     bforeach( const Neighbor &j, _fg->nbF(I) )
         if( j != i ) {
-            const Prob &p = _Smsg[i][_I][j.iter];
-            const Prob &_adj_m_unnorm_jI = _adj_m_unnorm[j][j.dual];
+            const Real *p = S( i, _I, j.iter );
+            const Real *_adj_m_unnorm_jI = adj_m_unnorm( j, j.dual );
             LOOP_ij(
-                new_adj_n_iI.set( xi, new_adj_n_iI[xi] + p[xij] * _adj_m_unnorm_jI[xj] );
+                new_adj_n_iI[xi] += p[xij] * _adj_m_unnorm_jI[xj];
             );
             /* THE FOLLOWING WOULD BE ABOUT TWICE AS SLOW:
             Var vi = _fg->var(i);
@@ -420,65 +481,86 @@ void BBP::calcNewN( size_t i, size_t _I ) {
 
 
 void BBP::calcNewM( size_t i, size_t _I ) {
-    const Neighbor &I = _fg->nbV(i)[_I];
-    Prob p( U(I, I.dual) );
-    const Prob &adj = _adj_m_unnorm[i][_I];
-    const _ind_t &ind = _index(i,_I);
-    for( size_t x_I = 0; x_I < p.size(); x_I++ )
-        p.set( x_I, p[x_I] * adj[ind[x_I]] );
-    _adj_psi_F[I] += p;
-    /* THE FOLLOWING WOULD BE SLIGHTLY SLOWER:
-    _adj_psi_F[I] += (Factor( _fg->factor(I).vars(), U(I, I.dual) ) * Factor( _fg->var(i), _adj_m_unnorm[i][_I] )).p();
-    */
-
-    _new_adj_m[i][_I] = Prob( _fg->var(i).states(), 0.0 );
+    size_t i_states = _fg->var(i).states();
+    Real *new_adj_m_iI = new_adj_m( i, _I );
+    fill( new_adj_m_iI, new_adj_m_iI + i_states, 0.0 );
     bforeach( const Neighbor &J, _fg->nbV(i) )
-        if( J != I )
-            _new_adj_m[i][_I] += _Rmsg[I][I.dual][J.iter] * _adj_n_unnorm[i][J.iter];
+        if( J.iter != _I ) {
+            const Real *R_iIJ = R( i, _I, J.iter );
+            const Real *adj_n_unnorm_iJ = adj_n_unnorm( i, J.iter );
+            for( size_t xi = 0; xi < i_states; xi++ )
+                new_adj_m_iI[xi] += R_iIJ[xi] * adj_n_unnorm_iJ[xi];
+        }
+}
+
+
+void BBP::calcNewPsiF( size_t I ) {
+    Prob &adj_psi_F_I = _adj_psi_F[I];
+    bforeach( const Neighbor &i, _fg->nbF(I) ) {
+        const Real *U_Ii = U( i, i.dual );
+        const Real *adj = adj_m_unnorm( i, i.dual );
+        const _ind_t &ind = _index( i, i.dual );
+        for( size_t x_I = 0; x_I < adj_psi_F_I.size(); x_I++ )
+            adj_psi_F_I.set( x_I, adj_psi_F_I[x_I] + U_Ii[x_I] * adj[ind[x_I]] );
+    }
 }
 
 
 void BBP::calcUnnormMsgN( size_t i, size_t _I ) {
-    _adj_n_unnorm[i][_I] = unnormAdjoint( _bp_dual.msgN(i,_I), _bp_dual.zN(i,_I), _adj_n[i][_I] );
+    unnormAdjoint( _bp_dual.msgN(i,_I), _bp_dual.zN(i,_I), adj_n(i,_I), adj_n_unnorm(i,_I) );
 }
 
 
 void BBP::calcUnnormMsgM( size_t i, size_t _I ) {
-    _adj_m_unnorm[i][_I] = unnormAdjoint( _bp_dual.msgM(i,_I), _bp_dual.zM(i,_I), _adj_m[i][_I] );
+    unnormAdjoint( _bp_dual.msgM(i,_I), _bp_dual.zM(i,_I), adj_m(i,_I), adj_m_unnorm(i,_I) );
 }
 
 
 void BBP::upMsgN( size_t i, size_t _I ) {
-    _adj_n[i][_I] = _new_adj_n[i][_I];
+    const Real *p = new_adj_n( i, _I );
+    copy( p, p + _fg->var(i).states(), adj_n( i, _I ) );
     calcUnnormMsgN( i, _I );
 }
 
 
 void BBP::upMsgM( size_t i, size_t _I ) {
-    _adj_m[i][_I] = _new_adj_m[i][_I];
+    const Real *p = new_adj_m( i, _I );
+    copy( p, p + _fg->var(i).states(), adj_m( i, _I ) );
     calcUnnormMsgM( i, _I );
 }
 
 
 void BBP::doParUpdate() {
-    for( size_t i = 0; i < _fg->nrVars(); i++ )
-        bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            calcNewM( i, I.iter );
-            calcNewN( i, I.iter );
-        }
-    for( size_t i = 0; i < _fg->nrVars(); i++ )
-        bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            upMsgM( i, I.iter );
-            upMsgN( i, I.iter );
-        }
+    // The factor adjoints are increased factor by factor, so that each sweep only
+    // writes to quantities that belong to the factor or variable at hand
+    DAI_OMP(parallel)
+    {
+        DAI_OMP(for schedule(dynamic,16) nowait)
+        for( size_t I = 0; I < _fg->nrFactors(); I++ )
+            calcNewPsiF( I );
+        DAI_OMP(for schedule(dynamic,16))
+        for( size_t i = 0; i < _fg->nrVars(); i++ )
+            bforeach( const Neighbor &I, _fg->nbV(i) ) {
+                calcNewM( i, I.iter );
+                calcNewN( i, I.iter );
+            }
+        DAI_OMP(for schedule(dynamic,16))
+        for( size_t i = 0; i < _fg->nrVars(); i++ )
+            bforeach( const Neighbor &I, _fg->nbV(i) ) {
+                upMsgM( i, I.iter );
+                upMsgN( i, I.iter );
+            }
+    }
 }
 
 
-void BBP::incrSeqMsgM( size_t i, size_t _I, const Prob &p ) {
+void BBP::incrSeqMsgM( size_t i, size_t _I, const Prob &f, const Real *r ) {
 /*    if( props.clean_updates )
         _new_adj_m[i][_I] += p;
     else {*/
-        _adj_m[i][_I] += p;
+        Real *adj_m_iI = adj_m( i, _I );
+        for( size_t xi = 0; xi < f.size(); xi++ )
+            adj_m_iI[xi] += f[xi] * r[xi];
         calcUnnormMsgM(i, _I);
 //    }
 }
@@ -510,8 +592,10 @@ void BBP::updateSeqMsgM( size_t i, size_t _I ) {
 }
 */
 
-void BBP::setSeqMsgM( size_t i, size_t _I, const Prob &p ) {
-    _adj_m[i][_I] = p;
+void BBP::scaleSeqMsgM( size_t i, size_t _I, Real c ) {
+    Real *adj_m_iI = adj_m( i, _I );
+    for( size_t xi = 0; xi < _fg->var(i).states(); xi++ )
+        adj_m_iI[xi] *= c;
     calcUnnormMsgM( i, _I );
 }
 
@@ -520,7 +604,10 @@ void BBP::sendSeqMsgN( size_t i, size_t _I, const Prob &f ) {
     Prob f_unnorm = unnormAdjoint( _bp_dual.msgN(i,_I), _bp_dual.zN(i,_I), f );
     const Neighbor &I = _fg->nbV(i)[_I];
     DAI_ASSERT( I.iter == _I );
-    _adj_psi_V[i] += f_unnorm * T( i, _I );
+    const Real *T_iI = T( i, _I );
+    Prob &adj_psi_V_i = _adj_psi_V[i];
+    for( size_t xi = 0; xi < f_unnorm.size(); xi++ )
+        adj_psi_V_i.set( xi, adj_psi_V_i[xi] + f_unnorm[xi] * T_iI[xi] );
 #if 0
     if(f_unnorm.sumAbs() > pv_thresh) {
         DAI_DMSG("in sendSeqMsgN");
@@ -541,11 +628,10 @@ void BBP::sendSeqMsgN( size_t i, size_t _I, const Prob &f ) {
                 DAI_DMSG("in sendSeqMsgN loop");
                 DAI_PV(J);
                 DAI_PV(f_unnorm);
-                DAI_PV(_Rmsg[J][J.dual][_I]);
-                DAI_PV(f_unnorm * _Rmsg[J][J.dual][_I]);
+                DAI_PV(Prob( R( i, J.iter, _I ), R( i, J.iter, _I ) + f_unnorm.size(), f_unnorm.size() ));
             }
 #endif
-            incrSeqMsgM( i, J.iter, f_unnorm * R(J, J.dual, _I) );
+            incrSeqMsgM( i, J.iter, f_unnorm, R( i, J.iter, _I ) );
         }
     }
 }
@@ -561,13 +647,12 @@ void BBP::sendSeqMsgM( size_t j, size_t _I ) {
 //     DAI_PV(_bp_dual.zM(j,_I));
 
     size_t _j = I.dual;
-    const Prob &_adj_m_unnorm_jI = _adj_m_unnorm[j][_I];
-    Prob um( U(I, _j) );
+    const Real *_adj_m_unnorm_jI = adj_m_unnorm( j, _I );
+    const Real *U_Ij = U( j, _I );
     const _ind_t &ind = _index(j, _I);
-    for( size_t x_I = 0; x_I < um.size(); x_I++ )
-        um.set( x_I, um[x_I] * _adj_m_unnorm_jI[ind[x_I]] );
-    um *= 1 - props.damping;
-    _adj_psi_F[I] += um;
+    Prob &adj_psi_F_I = _adj_psi_F[I];
+    for( size_t x_I = 0; x_I < adj_psi_F_I.size(); x_I++ )
+        adj_psi_F_I.set( x_I, adj_psi_F_I[x_I] + (U_Ij[x_I] * _adj_m_unnorm_jI[ind[x_I]]) * (1 - props.damping) );
 
     /* THE FOLLOWING WOULD BE SLIGHTLY SLOWER:
     _adj_psi_F[I] += (Factor( _fg->factor(I).vars(), U(I, _j) ) * Factor( _fg->var(j), _adj_m_unnorm[j][_I] )).p() * (1.0 - props.damping);
@@ -580,10 +665,10 @@ void BBP::sendSeqMsgM( size_t j, size_t _I ) {
 //     DAI_PV(_fg->nbF(I).size());
     bforeach( const Neighbor &i, _fg->nbF(I) ) {
         if( i.node != j ) {
-            const Prob &S = _Smsg[i][i.dual][_j];
+            const Real *S_iIj = S( i, i.dual, _j );
             Prob msg( _fg->var(i).states(), 0.0 );
             LOOP_ij(
-                msg.set( xi, msg[xi] + S[xij] * _adj_m_unnorm_jI[xj] );
+                msg.set( xi, msg[xi] + S_iIj[xij] * _adj_m_unnorm_jI[xj] );
             );
             msg *= 1.0 - props.damping;
             /* THE FOLLOWING WOULD BE ABOUT TWICE AS SLOW:
@@ -600,7 +685,7 @@ void BBP::sendSeqMsgM( size_t j, size_t _I ) {
                 DAI_PV(_I);
                 DAI_PV(_fg->nbF(I).size());
                 DAI_PV(_fg->factor(I).p());
-                DAI_PV(_Smsg[i][i.dual][_j]);
+                DAI_PV(Prob( S_iIj, S_iIj + _fg->var(i).states() * _fg->var(j).states(), _fg->var(i).states() * _fg->var(j).states() ));
 
                 DAI_PV(i);
                 DAI_PV(i.dual);
@@ -612,7 +697,7 @@ void BBP::sendSeqMsgM( size_t j, size_t _I ) {
             sendSeqMsgN( i, i.dual, msg );
         }
     }
-    setSeqMsgM( j, _I, _adj_m[j][_I] * props.damping );
+    scaleSeqMsgM( j, _I, props.damping );
 }
 
 
@@ -629,13 +714,30 @@ Prob BBP::unnormAdjoint( const Prob &w, Real Z_w, const Prob &adj_w ) {
 }
 
 
+void BBP::unnormAdjoint( const Prob &w, Real Z_w, const Real *adj_w, Real *adj_w_unnorm ) {
+    Real s = 0.0;
+    for( size_t i = 0; i < w.size(); i++ )
+        s += w[i] * adj_w[i];
+    for( size_t i = 0; i < w.size(); i++ )
+        adj_w_unnorm[i] = (adj_w[i] - s) / Z_w;
+}
+
+
+Real BBP::sumAbs( const Real *p, size_t n ) {
+    Real s = 0.0;
+    for( size_t i = 0; i < n; i++ )
+        s += std::abs( p[i] );
+    return s;
+}
+
+
 Real BBP::getUnMsgMag() {
     Real s = 0.0;
     size_t e = 0;
     for( size_t i = 0; i < _fg->nrVars(); i++ )
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            s += _adj_m_unnorm[i][I.iter].sumAbs();
-            s += _adj_n_unnorm[i][I.iter].sumAbs();
+            s += sumAbs( adj_m_unnorm( i, I.iter ), _fg->var(i).states() );
+            s += sumAbs( adj_n_unnorm( i, I.iter ), _fg->var(i).states() );
             e++;
         }
     return s / e;
@@ -648,10 +750,10 @@ void BBP::getMsgMags( Real &s, Real &new_s ) {
     size_t e = 0;
     for( size_t i = 0; i < _fg->nrVars(); i++ )
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            s += _adj_m[i][I.iter].sumAbs();
-            s += _adj_n[i][I.iter].sumAbs();
-            new_s += _new_adj_m[i][I.iter].sumAbs();
-            new_s += _new_adj_n[i][I.iter].sumAbs();
+            s += sumAbs( adj_m( i, I.iter ), _fg->var(i).states() );
+            s += sumAbs( adj_n( i, I.iter ), _fg->var(i).states() );
+            new_s += sumAbs( new_adj_m( i, I.iter ), _fg->var(i).states() );
+            new_s += sumAbs( new_adj_n( i, I.iter ), _fg->var(i).states() );
             e++;
         }
     s /= e;
@@ -680,7 +782,7 @@ void BBP::getArgmaxMsgM( size_t &out_i, size_t &out__I, Real &mag ) {
     bool found = false;
     for( size_t i = 0; i < _fg->nrVars(); i++ )
         bforeach( const Neighbor &I, _fg->nbV(i) ) {
-            Real thisMag = _adj_m[i][I.iter].sumAbs();
+            Real thisMag = sumAbs( adj_m( i, I.iter ), _fg->var(i).states() );
             if( !found || mag < thisMag ) {
                 found = true;
                 mag = thisMag;
@@ -704,7 +806,7 @@ Real BBP::getTotalMsgM() {
     Real mag = 0.0;
     for( size_t i = 0; i < _fg->nrVars(); i++ )
         bforeach( const Neighbor &I, _fg->nbV(i) )
-            mag += _adj_m[i][I.iter].sumAbs();
+            mag += sumAbs( adj_m( i, I.iter ), _fg->var(i).states() );
     return mag;
 }
 
@@ -713,7 +815,7 @@ Real BBP::getTotalNewMsgM() {
     Real mag = 0.0;
     for( size_t i = 0; i < _fg->nrVars(); i++ )
         bforeach( const Neighbor &I, _fg->nbV(i) )
-            mag += _new_adj_m[i][I.iter].sumAbs();
+            mag += sumAbs( new_adj_m( i, I.iter ), _fg->var(i).states() );
     return mag;
 }
 
@@ -722,7 +824,7 @@ Real BBP::getTotalMsgN() {
     Real mag = 0.0;
     for( size_t i = 0; i < _fg->nrVars(); i++ )
         bforeach( const Neighbor &I, _fg->nbV(i) )
-            mag += _adj_n[i][I.iter].sumAbs();
+            mag += sumAbs( adj_n( i, I.iter ), _fg->var(i).states() );
     return mag;
 }
 
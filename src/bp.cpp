@@ -442,6 +442,55 @@ void BP::init( const VarSet &ns ) {
 }
 
 
+void BP::pushState() {
+    _savedStates.push_back( SavedState() );
+    SavedState &st = _savedStates.back();
+    st.messages.reserve( nrEdges() );
+    st.newMessages.reserve( nrEdges() );
+    st.residuals.reserve( nrEdges() );
+    for( size_t i = 0; i < nrVars(); ++i )
+        for( size_t _I = 0; _I < _edges[i].size(); _I++ ) {
+            st.messages.push_back( message( i, _I ) );
+            st.newMessages.push_back( newMessage( i, _I ) );
+            st.residuals.push_back( residual( i, _I ) );
+        }
+    if( props.updates == Properties::UpdateType::SEQMAX )
+        st.lut.assign( _lut.begin(), _lut.end() );
+    st.maxdiff = _maxdiff;
+    st.iters = _iters;
+    st.nrSentMessages = _sentMessages.size();
+    st.oldBeliefsV = _oldBeliefsV;
+    st.oldBeliefsF = _oldBeliefsF;
+}
+
+
+void BP::popState() {
+    if( _savedStates.empty() )
+        DAI_THROW(OBJECT_NOT_FOUND);
+    SavedState &st = _savedStates.back();
+    size_t e = 0;
+    for( size_t i = 0; i < nrVars(); ++i )
+        for( size_t _I = 0; _I < _edges[i].size(); _I++, e++ ) {
+            message( i, _I ) = st.messages[e];
+            newMessage( i, _I ) = st.newMessages[e];
+            residual( i, _I ) = st.residuals[e];
+        }
+    if( props.updates == Properties::UpdateType::SEQMAX ) {
+        // inserting at the end preserves the order of entries with equal residuals
+        _lut.clear();
+        for( size_t l = 0; l < st.lut.size(); l++ )
+            _edge2lut[st.lut[l].second.first][st.lut[l].second.second] = _lut.insert( _lut.end(), st.lut[l] );
+    }
+    _maxdiff = st.maxdiff;
+    _iters = st.iters;
+    if( _sentMessages.size() > st.nrSentMessages )
+        _sentMessages.resize( st.nrSentMessages );
+    _oldBeliefsV.swap( st.oldBeliefsV );
+    _oldBeliefsF.swap( st.oldBeliefsF );
+    _savedStates.pop_back();
+}
+
+
 void BP::updateMessage( size_t i, size_t _I ) {
     if( recordSentMessages )
         _sentMessages.push_back(make_pair(i,_I));
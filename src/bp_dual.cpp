@@ -24,8 +24,40 @@ using namespace std;
 void BP_dual::init() {
     regenerateMessages();
     regenerateBeliefs();
-    calcMessages();
-    calcBeliefs();
+    _synced.b2.clear();
+    _synced.psi.clear();
+    refresh();
+}
+
+
+vector<size_t> BP_dual::refresh() {
+    // find the factors whose belief or value changed since the previous synchronization
+    size_t nf = fg().nrFactors();
+    bool all = (_synced.b2.size() != nf);
+    if( all ) {
+        _synced.b2.resize( nf );
+        _synced.psi.resize( nf );
+    }
+    vector<char> isChanged( nf, all );
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t I = 0; I < nf; I++ ) {
+        Factor b = _ia->beliefF(I);
+        if( all || !(b.p() == _synced.b2[I]) || !(fg().factor(I).p() == _synced.psi[I]) ) {
+            _synced.b2[I] = b.p();
+            _synced.psi[I] = fg().factor(I).p();
+            isChanged[I] = true;
+        }
+    }
+    vector<size_t> changed;
+    for( size_t I = 0; I < nf; I++ )
+        if( isChanged[I] )
+            changed.push_back( I );
+
+    // recalculate what depends on them
+    vector<bool> vars( fg().nrVars(), all );
+    calcMessages( changed, vars );
+    calcBeliefs( vars, changed );
+    return changed;
 }
 
 
@@ -61,21 +93,30 @@ void BP_dual::regenerateBeliefs() {
 }
 
 
-void BP_dual::calcMessages() {
+void BP_dual::calcMessages( const vector<size_t> &changed, vector<bool> &vars ) {
     // calculate 'n' messages from "factor marginal / factor"
-    for( size_t I = 0; I < fg().nrFactors(); I++ ) {
-        Factor f = _ia->beliefF(I) / fg().factor(I);
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t c = 0; c < changed.size(); c++ ) {
+        size_t I = changed[c];
+        Factor f = Factor( fg().factor(I).vars(), _synced.b2[I] ) / fg().factor(I);
         bforeach( const Neighbor &i, fg().nbF(I) )
             msgN(i, i.dual) = f.marginal( fg().var(i) ).p();
     }
     // calculate 'm' messages and normalizers from 'n' messages
-    for( size_t i = 0; i < fg().nrVars(); i++ )
-        bforeach( const Neighbor &I, fg().nbV(i) )
-            calcNewM( i, I.iter );
+    DAI_OMP(parallel for schedule(dynamic,16))
+    for( size_t c = 0; c < changed.size(); c++ )
+        bforeach( const Neighbor &i, fg().nbF(changed[c]) )
+            calcNewM( i, i.dual );
     // recalculate 'n' messages and normalizers from 'm' messages
+    for( size_t c = 0; c < changed.size(); c++ )
+        bforeach( const Neighbor &i, fg().nbF(changed[c]) )
+            vars[i] = true;
+    DAI_OMP(parallel for schedule(dynamic,16))
     for( size_t i = 0; i < fg().nrVars(); i++ )
-        bforeach( const Neighbor &I, fg().nbV(i) )
-            calcNewN(i, I.iter);
+        if( vars[i] ) {
+            bforeach( const Neighbor &I, fg().nbV(i) )
+                calcNewN(i, I.iter);
+        }
 }
 
 
@@ -114,11 +155,23 @@ void BP_dual::calcNewN( size_t i, size_t _I ) {
 }
 
 
-void BP_dual::calcBeliefs() {
+void BP_dual::calcBeliefs( const vector<bool> &vars, const vector<size_t> &changed ) {
+    vector<char> factors( fg().nrFactors(), false );
+    for( size_t c = 0; c < changed.size(); c++ )
+        factors[changed[c]] = true;
+    for( size_t i = 0; i < fg().nrVars(); i++ )
+        if( vars[i] ) {
+            bforeach( const Neighbor &I, fg().nbV(i) )
+                factors[I] = true;
+        }
+    DAI_OMP(parallel for schedule(dynamic,16))
     for( size_t i = 0; i < fg().nrVars(); i++ )
-        calcBeliefV(i);  // calculate b_i
+        if( vars[i] )
+            calcBeliefV(i);  // calculate b_i
+    DAI_OMP(parallel for schedule(dynamic,16))
     for( size_t I = 0; I < fg().nrFactors(); I++ )
-        calcBeliefF(I);  // calculate b_I
+        if( factors[I] )
+            calcBeliefF(I);  // calculate b_I
 }
 
 
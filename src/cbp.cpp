@@ -104,6 +104,9 @@ void CBP::construct() {
     _maxdiff = 0;
     _iters = 0;
 
+    _live_clones = 0;
+    _error.reset();
+
     if( props.clamp_outfile.length() > 0 ) {
         _clamp_ofstream = shared_ptr<ofstream>(new ofstream( props.clamp_outfile.c_str(), ios_base::out|ios_base::trunc ));
         *_clamp_ofstream << "# COUNT LEVEL VAR STATE" << endl;
@@ -137,7 +140,22 @@ Real CBP::run() {
     vector<Factor> beliefs_out;
     Real lz_out;
     size_t choose_count=0;
-    runRecurse( bp, bp->logZ(), vector<size_t>(0), _num_leaves, choose_count, _sum_level, lz_out, beliefs_out );
+    // subtrees of the recursion are explored as OpenMP tasks, which are executed by the thread team
+    DAI_OMP(parallel if(props.max_clones > 0))
+    DAI_OMP(single)
+    {
+        try {
+            runRecurse( bp, bp->logZ(), vector<size_t>(0), _num_leaves, choose_count, _sum_level, lz_out, beliefs_out );
+        } catch( Exception &e ) {
+            if( !_error )
+                _error.reset( new Exception( e ) );
+        }
+    }
+    _bbps.clear();
+    if( _error ) {
+        delete bp;
+        throw *_error;
+    }
     if( props.verbose >= 1 )
         cerr << "CBP average levels = " << (_sum_level / _num_leaves) << ", leaves = " << _num_leaves << endl;
     setBeliefs( beliefs_out, lz_out );
@@ -161,6 +179,69 @@ InfAlg* CBP::getInfAlg() {
 }
 
 
+InfAlg* CBP::newClone( const InfAlg *bp ) {
+    InfAlg *bp_c = bp->clone();
+    DAI_OMP(critical(dai_cbp))
+    _live_clones++;
+    return bp_c;
+}
+
+
+void CBP::deleteClone( InfAlg *bp_c ) {
+    if( bp_c ) {
+        DAI_OMP(critical(dai_cbp))
+        {
+            _bbps.erase( bp_c );
+            _live_clones--;
+        }
+        delete bp_c;
+    }
+}
+
+
+BBP& CBP::getBBP( const InfAlg *bp ) {
+    shared_ptr<BBP> bbp;
+    DAI_OMP(critical(dai_cbp))
+    {
+        map<const InfAlg*, shared_ptr<BBP> >::const_iterator it = _bbps.find( bp );
+        if( it != _bbps.end() )
+            bbp = it->second;
+    }
+    if( !bbp ) {
+        bbp.reset( new BBP( bp, props.bbp_props ) );
+        DAI_OMP(critical(dai_cbp))
+        _bbps[bp] = bbp;
+    }
+    return *bbp;
+}
+
+
+void CBP::runClamped( InfAlg *bp, size_t i, const vector<size_t> &xis, bool backup ) {
+    if( props.clamp == Properties::ClampType::CLAMP_VAR ) {
+        bp->fg().clampVar( i, xis, backup );
+        bp->init( var(i) );
+    } else {
+        bp->fg().clampFactor( i, xis, backup );
+        bp->init( factor(i).vars() );
+    }
+    bp->run();
+
+    DAI_OMP(critical(dai_cbp))
+    _iters += bp->Iterations();
+}
+
+
+bool CBP::spawnTask() {
+    if( props.updates == Properties::UpdateType::SEQRND || props.choose == Properties::ChooseMethodType::CHOOSE_RANDOM ||
+        ((props.choose == Properties::ChooseMethodType::CHOOSE_BP_CFN || props.choose == Properties::ChooseMethodType::CHOOSE_BBP) && props.bbp_cfn.needGibbsState()) )
+        return false;
+    bool spawn;
+    DAI_OMP(critical(dai_cbp))
+    spawn = !_error && (_live_clones < props.max_clones);
+    return spawn;
+}
+
+
 void CBP::runRecurse( InfAlg *bp, Real orig_logZ, vector<size_t> clamped_vars_list, size_t &num_leaves,
                       size_t &choose_count, Real &sum_level, Real &lz_out, vector<Factor>& beliefs_out) {
     // choose a variable/states to clamp:
@@ -176,16 +257,22 @@ void CBP::runRecurse( InfAlg *bp, Real orig_logZ, vector<size_t> clamped_vars_li
         found = chooseNextClampVar( bp, clamped_vars_list, i, xis, &maxVar );
 
     if( !found ) {
-        num_leaves++;
-        sum_level += clamped_vars_list.size();
+        DAI_OMP(critical(dai_cbp))
+        {
+            num_leaves++;
+            sum_level += clamped_vars_list.size();
+        }
         beliefs_out = bp->beliefs();
         lz_out = bp->logZ();
         return;
     }
 
-    choose_count++;
-    if( props.clamp_outfile.length() > 0 )
-        *_clamp_ofstream << choose_count << "\t" << clamped_vars_list.size() << "\t" << i << "\t" << xis[0] << endl;
+    DAI_OMP(critical(dai_cbp))
+    {
+        choose_count++;
+        if( props.clamp_outfile.length() > 0 )
+            *_clamp_ofstream << choose_count << "\t" << clamped_vars_list.size() << "\t" << i << "\t" << xis[0] << endl;
+    }
 
     if( clampingVar )
         bforeach( size_t xi, xis )
@@ -199,77 +286,137 @@ void CBP::runRecurse( InfAlg *bp, Real orig_logZ, vector<size_t> clamped_vars_li
     // compute complement of 'xis'
     vector<size_t> cmp_xis = complement( xis, clampingVar ? var(i).states() : factor(i).nrStates() );
 
-    /// \idea dai::CBP::runRecurse() could be implemented more efficiently with a nesting version of backupFactors/restoreFactors
-    // this improvement could also be done locally: backup the clamped factor in a local variable,
-    // and restore it just before we return.
-    Real lz;
-    vector<Factor> b;
-    InfAlg *bp_c = bp->clone();
-    if( clampingVar ) {
-        bp_c->fg().clampVar( i, xis );
-        bp_c->init( var(i) );
-    } else {
-        bp_c->fg().clampFactor( i, xis );
-        bp_c->init( factor(i).vars() );
-    }
-    bp_c->run();
-    _iters += bp_c->Iterations();
-
-    lz = bp_c->logZ();
-    b = bp_c->beliefs();
-
-    Real cmp_lz;
-    vector<Factor> cmp_b;
-    InfAlg *cmp_bp_c = bp->clone();
-    if( clampingVar ) {
-        cmp_bp_c->fg().clampVar( i, cmp_xis );
-        cmp_bp_c->init(var(i));
-    } else {
-        cmp_bp_c->fg().clampFactor( i, cmp_xis );
-        cmp_bp_c->init( factor(i).vars() );
-    }
-    cmp_bp_c->run();
-    _iters += cmp_bp_c->Iterations();
-
-    cmp_lz = cmp_bp_c->logZ();
-    cmp_b = cmp_bp_c->beliefs();
-
-    Real p = unSoftMax( lz, cmp_lz );
+    // The second branch is explored on bp itself, within a nested level of backups that restores
+    // the clamped factors and the messages afterwards. The first branch is explored in the same
+    // way, unless it runs as a separate task, or both branches have to be run before deciding
+    // whether to recurse (REC_BDIFF); then it is explored on a clone of bp.
+    //
+    // Exceptions cannot leave a task, so they are stored in _error. Each branch writes to its
+    // own variables, which are combined in a fixed order after the taskwait, so the result does
+    // not depend on the order in which tasks finish.
+    bool bdiff = (props.recursion == Properties::RecurseType::REC_BDIFF && props.rec_tol > 0);
+    bool task = spawnTask();
+
+    // results for bp that are needed after it has been clamped
+    Real bp_logZ = bp->logZ();
+    vector<Factor> bp_beliefs;
+    if( bdiff || props.verbose >= 2 )
+        bp_beliefs = bp->beliefs();
+
+    InfAlg *bp_c = NULL;
+    if( task || bdiff )
+        bp_c = newClone( bp );
+
+    Real lz, cmp_lz;
+    vector<Factor> b, cmp_b;
     Real bp__d = 0.0;
-
-    if( props.recursion == Properties::RecurseType::REC_BDIFF && props.rec_tol > 0 ) {
+    bool failed = false;
+    size_t *num_leaves_p = &num_leaves;
+    size_t *choose_count_p = &choose_count;
+    Real *sum_level_p = &sum_level;
+
+    if( bdiff ) {
+        runClamped( bp_c, i, xis, false );
+        lz = bp_c->logZ();
+        b = bp_c->beliefs();
+
+        bp->pushBackups();
+        runClamped( bp, i, cmp_xis, true );
+        cmp_lz = bp->logZ();
+        cmp_b = bp->beliefs();
+
+        Real p = unSoftMax( lz, cmp_lz );
         vector<Factor> combined_b( mixBeliefs( p, b, cmp_b ) );
         Real new_lz = logSumExp( lz,cmp_lz );
-        bp__d = dist( bp->beliefs(), combined_b, nrVars() );
+        bp__d = dist( bp_beliefs, combined_b, nrVars() );
         if( exp( new_lz - orig_logZ) * bp__d < props.rec_tol ) {
-            num_leaves++;
-            sum_level += clamped_vars_list.size();
+            DAI_OMP(critical(dai_cbp))
+            {
+                num_leaves++;
+                sum_level += clamped_vars_list.size();
+            }
             beliefs_out = combined_b;
             lz_out = new_lz;
+            bp->popBackups();
+            deleteClone( bp_c );
             return;
         }
-    }
 
-    // either we are not doing REC_BDIFF or the distance was large
-    // enough to recurse:
-    runRecurse( bp_c, orig_logZ, clamped_vars_list, num_leaves, choose_count, sum_level, lz, b );
-    runRecurse( cmp_bp_c, orig_logZ, clamped_vars_list, num_leaves, choose_count, sum_level, cmp_lz, cmp_b );
+        // the distance was large enough to recurse:
+        DAI_OMP(task shared(lz, b, failed) if(task))
+        {
+            try {
+                runRecurse( bp_c, orig_logZ, clamped_vars_list, *num_leaves_p, *choose_count_p, *sum_level_p, lz, b );
+            } catch( Exception &e ) {
+                failed = true;
+                DAI_OMP(critical(dai_cbp))
+                if( !_error )
+                    _error.reset( new Exception( e ) );
+            }
+        }
+    } else {
+        DAI_OMP(task shared(lz, b, failed) if(task))
+        {
+            try {
+                InfAlg *first = bp_c ? bp_c : bp;
+                if( !bp_c )
+                    bp->pushBackups();
+                runClamped( first, i, xis, !bp_c );
+                lz = first->logZ();
+                b = first->beliefs();
+                runRecurse( first, orig_logZ, clamped_vars_list, *num_leaves_p, *choose_count_p, *sum_level_p, lz, b );
+                if( !bp_c )
+                    bp->popBackups();
+            } catch( Exception &e ) {
+                failed = true;
+                DAI_OMP(critical(dai_cbp))
+                if( !_error )
+                    _error.reset( new Exception( e ) );
+            }
+        }
+        if( !failed ) {
+            bp->pushBackups();
+            try {
+                runClamped( bp, i, cmp_xis, true );
+            } catch( Exception &e ) {
+                DAI_OMP(taskwait)
+                deleteClone( bp_c );
+                throw;
+            }
+            cmp_lz = bp->logZ();
+            cmp_b = bp->beliefs();
+        }
+    }
+    if( !failed ) {
+        try {
+            runRecurse( bp, orig_logZ, clamped_vars_list, num_leaves, choose_count, sum_level, cmp_lz, cmp_b );
+        } catch( Exception &e ) {
+            DAI_OMP(taskwait)
+            deleteClone( bp_c );
+            throw;
+        }
+        bp->popBackups();
+    }
+    DAI_OMP(taskwait)
+    deleteClone( bp_c );
+    if( failed )
+        throw *_error;
 
-    p = unSoftMax( lz, cmp_lz );
+    Real p = unSoftMax( lz, cmp_lz );
 
     beliefs_out = mixBeliefs( p, b, cmp_b );
     lz_out = logSumExp( lz, cmp_lz );
 
     if( props.verbose >= 2 ) {
-        Real d = dist( bp->beliefs(), beliefs_out, nrVars() );
-        cerr << "Distance (clamping " << i << "): " << d;
-        if( props.recursion == Properties::RecurseType::REC_BDIFF )
-            cerr << "; bp_dual predicted " << bp__d;
-        cerr << "; max_adjoint = " << maxVar << "; logZ = " << lz_out << " (in " << bp->logZ() << ") (orig " << orig_logZ << "); p = " << p << "; level = " << clamped_vars_list.size() << endl;
+        Real d = dist( bp_beliefs, beliefs_out, nrVars() );
+        DAI_OMP(critical(dai_cbp))
+        {
+            cerr << "Distance (clamping " << i << "): " << d;
+            if( props.recursion == Properties::RecurseType::REC_BDIFF )
+                cerr << "; bp_dual predicted " << bp__d;
+            cerr << "; max_adjoint = " << maxVar << "; logZ = " << lz_out << " (in " << bp_logZ << ") (orig " << orig_logZ << "); p = " << p << "; level = " << clamped_vars_list.size() << endl;
+        }
     }
-
-    delete bp_c;
-    delete cmp_bp_c;
 }
 
 
@@ -323,16 +470,20 @@ bool CBP::chooseNextClampVar( InfAlg *bp, vector<size_t> &clamped_vars_list, siz
         }
     } else if( props.choose == Properties::ChooseMethodType::CHOOSE_MAXENT ) {
         if( props.clamp == Properties::ClampType::CLAMP_VAR ) {
+            // the entropies are calculated concurrently, the winner is chosen in a fixed order
+            vector<Real> ents( nrVars() );
+            DAI_OMP(parallel for schedule(dynamic,16))
+            for( size_t k = 0; k < nrVars(); k++ )
+                ents[k] = bp->beliefV(k).entropy();
             Real max_ent = -1.0;
             int win_k = -1, win_xk = -1;
-            for( size_t k = 0; k < nrVars(); k++ ) {
-                Real ent=bp->beliefV(k).entropy();
-                if( max_ent < ent ) {
-                    max_ent = ent;
+            for( size_t k = 0; k < nrVars(); k++ )
+                if( max_ent < ents[k] ) {
+                    max_ent = ents[k];
                     win_k = k;
-                    win_xk = bp->beliefV(k).p().argmax().first;
                 }
-            }
+            if( win_k >= 0 )
+                win_xk = bp->beliefV(win_k).p().argmax().first;
             DAI_ASSERT( win_k >= 0 );
             DAI_ASSERT( win_xk >= 0 );
             i = win_k;
@@ -343,16 +494,19 @@ bool CBP::chooseNextClampVar( InfAlg *bp, vector<size_t> &clamped_vars_list, siz
                 return false;
             }
         } else {
+            vector<Real> ents( nrFactors() );
+            DAI_OMP(parallel for schedule(dynamic,16))
+            for( size_t k = 0; k < nrFactors(); k++ )
+                ents[k] = bp->beliefF(k).entropy();
             Real max_ent = -1.0;
             int win_k = -1, win_xk = -1;
-            for( size_t k = 0; k < nrFactors(); k++ ) {
-                Real ent = bp->beliefF(k).entropy();
-                if( max_ent < ent ) {
-                    max_ent = ent;
+            for( size_t k = 0; k < nrFactors(); k++ )
+                if( max_ent < ents[k] ) {
+                    max_ent = ents[k];
                     win_k = k;
-                    win_xk = bp->beliefF(k).p().argmax().first;
                 }
-            }
+            if( win_k >= 0 )
+                win_xk = bp->beliefF(win_k).p().argmax().first;
             DAI_ASSERT( win_k >= 0 );
             DAI_ASSERT( win_xk >= 0 );
             i = win_k;
@@ -371,30 +525,58 @@ bool CBP::chooseNextClampVar( InfAlg *bp, vector<size_t> &clamped_vars_list, siz
             state = getGibbsState( bp->fg(), 2*bp->Iterations() );
         // try clamping each variable manually
         DAI_ASSERT( props.clamp == Properties::ClampType::CLAMP_VAR );
-        Real max_cost = 0.0;
-        int win_k = -1, win_xk = -1;
-        for( size_t k = 0; k < nrVars(); k++ ) {
-            for( size_t xk = 0; xk < var(k).states(); xk++ ) {
-                if( bp->beliefV(k)[xk] < tiny )
-                    continue;
-                InfAlg *bp1 = bp->clone();
-                bp1->clamp( k, xk );
-                bp1->init( var(k) );
-                bp1->run();
-                Real cost = 0;
-                if( doL1 )
-                    for( size_t j = 0; j < nrVars(); j++ )
-                        cost += dist( bp->beliefV(j), bp1->beliefV(j), DISTL1 );
-                else
-                    cost = props.bbp_cfn.evaluate( *bp1, &state );
-                if( cost > max_cost || win_k == -1 ) {
-                    max_cost = cost;
-                    win_k = k;
-                    win_xk = xk;
+        vector<Factor> beliefsV;
+        beliefsV.reserve( nrVars() );
+        for( size_t j = 0; j < nrVars(); j++ )
+            beliefsV.push_back( bp->beliefV(j) );
+        vector<pair<size_t, size_t> > cands;
+        for( size_t k = 0; k < nrVars(); k++ )
+            for( size_t xk = 0; xk < var(k).states(); xk++ )
+                if( beliefsV[k][xk] >= tiny )
+                    cands.push_back( make_pair( k, xk ) );
+
+        // The candidates are scored concurrently; bp is only read, each thread clamps its
+        // own clone of bp within a nested level of backups. Exceptions cannot leave a
+        // parallel region, so the first one is rethrown afterwards.
+        vector<Real> costs( cands.size(), 0.0 );
+        vector<Exception> errors;
+        DAI_OMP(parallel if(cands.size() > 1))
+        {
+            InfAlg *bp1 = NULL;
+            DAI_OMP(for schedule(dynamic))
+            for( size_t c = 0; c < cands.size(); c++ ) {
+                try {
+                    if( !bp1 )
+                        bp1 = bp->clone();
+                    size_t k = cands[c].first;
+                    bp1->pushBackups();
+                    bp1->clamp( k, cands[c].second, true );
+                    bp1->init( var(k) );
+                    bp1->run();
+                    if( doL1 )
+                        for( size_t j = 0; j < nrVars(); j++ )
+                            costs[c] += dist( beliefsV[j], bp1->beliefV(j), DISTL1 );
+                    else
+                        costs[c] = props.bbp_cfn.evaluate( *bp1, &state );
+                    bp1->popBackups();
+                } catch( Exception &e ) {
+                    DAI_OMP(critical)
+                    errors.push_back( e );
                 }
-                delete bp1;
             }
+            delete bp1;
         }
+        if( errors.size() )
+            throw errors.front();
+
+        Real max_cost = 0.0;
+        int win_k = -1, win_xk = -1;
+        for( size_t c = 0; c < cands.size(); c++ )
+            if( costs[c] > max_cost || win_k == -1 ) {
+                max_cost = costs[c];
+                win_k = cands[c].first;
+                win_xk = cands[c].second;
+            }
         DAI_ASSERT( win_k >= 0 );
         DAI_ASSERT( win_xk >= 0 );
         i = win_k;
@@ -404,7 +586,7 @@ bool CBP::chooseNextClampVar( InfAlg *bp, vector<size_t> &clamped_vars_list, siz
         if( !maxVarOut )
             maxVarOut = &mvo;
         bool clampingVar = (props.clamp == Properties::ClampType::CLAMP_VAR);
-        pair<size_t, size_t> cv = BBPFindClampVar( *bp, clampingVar, props.bbp_props, props.bbp_cfn, &mvo );
+        pair<size_t, size_t> cv = BBPFindClampVar( *bp, getBBP( bp ), clampingVar, props.bbp_cfn, &mvo );
 
         // if slope isn't big enough then don't clamp
         if( mvo < props.min_max_adj )
@@ -449,6 +631,11 @@ void CBP::printDebugInfo() {
 
 std::pair<size_t, size_t> BBPFindClampVar( const InfAlg &in_bp, bool clampingVar, const PropertySet &bbp_props, const BBPCostFunction &cfn, Real *maxVarOut ) {
     BBP bbp( &in_bp, bbp_props );
+    return BBPFindClampVar( in_bp, bbp, clampingVar, cfn, maxVarOut );
+}
+
+
+std::pair<size_t, size_t> BBPFindClampVar( const InfAlg &in_bp, BBP &bbp, bool clampingVar, const BBPCostFunction &cfn, Real *maxVarOut ) {
     bbp.initCostFnAdj( cfn, NULL );
     bbp.run();
 
@@ -534,6 +721,7 @@ void CBP::Properties::set(const PropertySet &opts)
         if( *i == "bbp_cfn" ) continue;
         if( *i == "rand_seed" ) continue;
         if( *i == "clamp_outfile" ) continue;
+        if( *i == "max_clones" ) continue;
         errormsg = errormsg + "CBP: Unknown property " + *i + "\n";
     }
     if( !errormsg.empty() )
@@ -590,6 +778,11 @@ void CBP::Properties::set(const PropertySet &opts)
     } else {
         clamp_outfile = "";
     }
+    if( opts.hasKey("max_clones") ) {
+        max_clones = opts.getStringAs<size_t>("max_clones");
+    } else {
+        max_clones = 64;
+    }
 }
 PropertySet CBP::Properties::get() const {
     PropertySet opts;
@@ -607,6 +800,7 @@ PropertySet CBP::Properties::get() const {
     opts.set("bbp_cfn", bbp_cfn);
     opts.set("rand_seed", rand_seed);
     opts.set("clamp_outfile", clamp_outfile);
+    opts.set("max_clones", max_clones);
     return opts;
 }
 string CBP::Properties::toString() const {
@@ -625,7 +819,8 @@ string CBP::Properties::toString() const {
     s << "bbp_props=" << bbp_props << ",";
     s << "bbp_cfn=" << bbp_cfn << ",";
     s << "rand_seed=" << rand_seed << ",";
-    s << "clamp_outfile=" << clamp_outfile;
+    s << "clamp_outfile=" << clamp_outfile << ",";
+    s << "max_clones=" << max_clones;
     s << "]";
     return s.str();
 }
@@ -21,17 +21,26 @@ using namespace std;
 
 ClusterGraph::ClusterGraph( const std::vector<VarSet> & cls ) : _G(), _vars(), _clusters() {
     // construct vars, clusters and edge list
+    // (hash maps are used to look up variables by label and to detect duplicate clusters)
+    hash_map<size_t, size_t> label2var;
+    hash_map<VarSet, size_t> cluster2index;
     vector<Edge> edges;
     bforeach( const VarSet &cl, cls ) {
-        if( find( clusters().begin(), clusters().end(), cl ) == clusters().end() ) {
+        if( cluster2index.find( cl ) == cluster2index.end() ) {
             // add cluster
             size_t n2 = nrClusters();
             _clusters.push_back( cl );
+            cluster2index[cl] = n2;
             for( VarSet::const_iterator n = cl.begin(); n != cl.end(); n++ ) {
-                size_t n1 = find( vars().begin(), vars().end(), *n ) - vars().begin();
-                if( n1 == nrVars() )
+                hash_map<size_t, size_t>::const_iterator it = label2var.find( n->label() );
+                size_t n1;
+                if( it == label2var.end() ) {
                     // add variable
+                    n1 = nrVars();
+                    label2var[n->label()] = n1;
                     _vars.push_back( *n );
+                } else
+                    n1 = it->second;
                 edges.push_back( Edge( n1, n2 ) );
             }
         } // disregard duplicate clusters
@@ -67,6 +76,40 @@ ClusterGraph::ClusterGraph( const FactorGraph& fg, bool onlyMaximal ) : _G( fg.n
 }
 
 
+ClusterGraph& ClusterGraph::eraseNonMaximal() {
+    // Determine which clusters are not maximal; a cluster is compared only with
+    // the clusters that have not been erased yet, and only with those that share a variable
+    vector<bool> erased( nrClusters(), false );
+    for( size_t I = 0; I < nrClusters(); I++ ) {
+        const VarSet &clI = _clusters[I];
+        bforeach( const Neighbor& i, _G.nb2(I) ) {
+            bforeach( const Neighbor& J, _G.nb1(i) )
+                if( (J != I) && !erased[J] && (clI << _clusters[J]) ) {
+                    erased[I] = true;
+                    break;
+                }
+            if( erased[I] )
+                break;
+        }
+    }
+
+    // Rebuild clusters and graph structure, keeping the variables
+    vector<VarSet> clusters;
+    vector<Edge> edges;
+    for( size_t I = 0; I < nrClusters(); I++ )
+        if( !erased[I] ) {
+            bforeach( const Neighbor& i, _G.nb2(I) )
+                edges.push_back( Edge( i, clusters.size() ) );
+            clusters.push_back( _clusters[I] );
+        }
+    if( clusters.size() != nrClusters() ) {
+        _clusters.swap( clusters );
+        _G.construct( nrVars(), nrClusters(), edges.begin(), edges.end() );
+    }
+    return *this;
+}
+
+
 size_t sequentialVariableElimination::operator()( const ClusterGraph &cl, const std::set<size_t> &/*remainingVars*/ ) {
     return cl.findVar( seq.at(i++) );
 }
@@ -17,58 +17,93 @@ namespace dai {
 using namespace std;
 
 
-Factor calcMarginal( const InfAlg &obj, const VarSet &vs, bool reInit ) {
-    Factor Pvs (vs);
-
-    InfAlg *clamped = obj.clone();
-    if( !reInit )
-        clamped->init();
-
-    map<Var,size_t> varindices;
-    for( VarSet::const_iterator n = vs.begin(); n != vs.end(); n++ )
-        varindices[*n] = obj.fg().findVar( *n );
+/// Clamps the variables with indices \a vars in \a clamped to the states \a vals, runs it and returns its log partition sum
+/** A nested level of backups is opened, which should be closed by the caller (using popBackups()) after
+ *  reading the results it needs from \a clamped.
+ *  \return -INFINITY if the clamped factor graph is not normalizable
+ */
+static Real runClamped( InfAlg &clamped, const vector<size_t> &vars, const vector<size_t> &vals, const VarSet &vs, bool reInit ) {
+    // save unclamped factors connected to vs, and the state of the algorithm
+    clamped.pushBackups();
+
+    // set clamping Factors to delta functions
+    for( size_t n = 0; n < vars.size(); n++ )
+        clamped.clamp( vars[n], vals[n], true );
+
+    if( reInit )
+        clamped.init();
+    else
+        clamped.init(vs);
+
+    try {
+        clamped.run();
+        return clamped.logZ();
+    } catch( Exception &e ) {
+        if( e.getCode() == Exception::NOT_NORMALIZABLE )
+            return -INFINITY;
+        else
+            throw;
+    }
+}
 
-    Real logZ0 = -INFINITY;
-    for( State s(vs); s.valid(); s++ ) {
-        // save unclamped factors connected to vs
-        clamped->backupFactors( vs );
 
-        // set clamping Factors to delta functions
-        for( VarSet::const_iterator n = vs.begin(); n != vs.end(); n++ )
-            clamped->clamp( varindices[*n], s(*n) );
+Factor calcMarginal( const InfAlg &obj, const VarSet &vs, bool reInit ) {
+    Factor Pvs (vs);
 
-        // run DAIAlg, calc logZ, store in Pvs
-        if( reInit )
-            clamped->init();
-        else
-            clamped->init(vs);
-
-        Real logZ;
-        try {
-            clamped->run();
-            logZ = clamped->logZ();
-        } catch( Exception &e ) {
-            if( e.getCode() == Exception::NOT_NORMALIZABLE )
-                logZ = -INFINITY;
-            else
-                throw;
+    vector<Var> vvs( vs.begin(), vs.end() );
+    vector<size_t> varindices;
+    varindices.reserve( vvs.size() );
+    for( size_t n = 0; n < vvs.size(); n++ )
+        varindices.push_back( obj.fg().findVar( vvs[n] ) );
+
+    // The clamped runs are independent, so they are done concurrently, each thread
+    // clamping its own clone of obj; the partition sums are stored per state, so the
+    // result does not depend on the order in which the runs finish. Exceptions cannot
+    // leave a parallel region, so the first one is rethrown afterwards.
+    size_t nrStates = Pvs.nrStates();
+    vector<Real> logZs( nrStates, -INFINITY );
+    vector<Exception> errors;
+    DAI_OMP(parallel if(nrStates > 1))
+    {
+        InfAlg *clamped = NULL;
+        vector<size_t> vals( vvs.size() );
+        DAI_OMP(for schedule(dynamic))
+        for( size_t li = 0; li < nrStates; li++ ) {
+            try {
+                if( !clamped ) {
+                    clamped = obj.clone();
+                    if( !reInit )
+                        clamped->init();
+                }
+                map<Var,size_t> s = calcState( vs, li );
+                for( size_t n = 0; n < vvs.size(); n++ )
+                    vals[n] = s[vvs[n]];
+                logZs[li] = runClamped( *clamped, varindices, vals, vs, reInit );
+                // restore clamped factors and the state of the algorithm
+                clamped->popBackups();
+            } catch( Exception &e ) {
+                DAI_OMP(critical)
+                errors.push_back( e );
+            }
         }
+        delete clamped;
+    }
+    if( errors.size() )
+        throw errors.front();
 
+    Real logZ0 = -INFINITY;
+    for( size_t li = 0; li < nrStates; li++ ) {
+        Real logZ = logZs[li];
         if( logZ0 == -INFINITY )
             if( logZ != -INFINITY )
                 logZ0 = logZ;
 
         if( logZ == -INFINITY )
-            Pvs.set( s, 0 );
+            Pvs.set( li, 0 );
         else
-            Pvs.set( s, exp(logZ - logZ0) ); // subtract logZ0 to avoid very large numbers
-
-        // restore clamped factors
-        clamped->restoreFactors( vs );
+            Pvs.set( li, exp(logZ - logZ0) ); // subtract logZ0 to avoid very large numbers
     }
 
-    delete clamped;
-
     return( Pvs.normalized() );
 }
 
@@ -78,101 +113,87 @@ vector<Factor> calcPairBeliefs( const InfAlg & obj, const VarSet& vs, bool reIni
     size_t N = vs.size();
     result.reserve( N * (N - 1) / 2 );
 
-    InfAlg *clamped = obj.clone();
-    if( !reInit )
-        clamped->init();
-
-    map<Var,size_t> varindices;
-    for( VarSet::const_iterator v = vs.begin(); v != vs.end(); v++ )
-        varindices[*v] = obj.fg().findVar( *v );
+    // convert vs to vector<VarSet>
+    vector<Var> vvs( vs.begin(), vs.end() );
+    vector<size_t> varindices;
+    varindices.reserve( N );
+    for( size_t j = 0; j < N; j++ )
+        varindices.push_back( obj.fg().findVar( vvs[j] ) );
 
+    // Each job clamps one variable (accurate == false) or a pair of variables (accurate == true)
+    // to one of its joint states; jobs[c] contains the indices in vvs and the states of these variables
+    vector<vector<size_t> > jobs;
     if( accurate ) {
-        Real logZ0 = 0.0;
-        VarSet::const_iterator nj = vs.begin();
-        for( long j = 0; j < (long)N - 1; j++, nj++ ) {
-            size_t k = 0;
-            for( VarSet::const_iterator nk = nj; (++nk) != vs.end(); k++ ) {
-                Factor pairbelief( VarSet(*nj, *nk) );
-
+        for( size_t j = 0; j < N; j++ )
+            for( size_t k = j + 1; k < N; k++ )
                 // clamp Vars j and k to their possible values
-                for( size_t j_val = 0; j_val < nj->states(); j_val++ )
-                    for( size_t k_val = 0; k_val < nk->states(); k_val++ ) {
-                        // save unclamped factors connected to vs
-                        clamped->backupFactors( vs );
-
-                        clamped->clamp( varindices[*nj], j_val );
-                        clamped->clamp( varindices[*nk], k_val );
-                        if( reInit )
-                            clamped->init();
-                        else
-                            clamped->init(vs);
-
-                        Real logZ;
-                        try {
-                            clamped->run();
-                            logZ = clamped->logZ();
-                        } catch( Exception &e ) {
-                            if( e.getCode() == Exception::NOT_NORMALIZABLE )
-                                logZ = -INFINITY;
-                            else
-                                throw;
-                        }
-
-                        if( logZ0 == -INFINITY )
-                            if( logZ != -INFINITY )
-                                logZ0 = logZ;
-
-                        Real Z_xj;
-                        if( logZ == -INFINITY )
-                            Z_xj = 0;
-                        else
-                            Z_xj = exp(logZ - logZ0); // subtract logZ0 to avoid very large numbers
-
-                        // we assume that j.label() < k.label()
-                        // i.e. we make an assumption here about the indexing
-                        pairbelief.set( j_val + (k_val * nj->states()), Z_xj );
-
-                        // restore clamped factors
-                        clamped->restoreFactors( vs );
+                for( size_t j_val = 0; j_val < vvs[j].states(); j_val++ )
+                    for( size_t k_val = 0; k_val < vvs[k].states(); k_val++ ) {
+                        vector<size_t> job( 4 );
+                        job[0] = j;
+                        job[1] = k;
+                        job[2] = j_val;
+                        job[3] = k_val;
+                        jobs.push_back( job );
                     }
-
-                result.push_back( pairbelief.normalized() );
-            }
-        }
     } else {
-        // convert vs to vector<VarSet>
-        vector<Var> vvs( vs.begin(), vs.end() );
-
-        vector<Factor> pairbeliefs;
-        pairbeliefs.reserve( N * N );
         for( size_t j = 0; j < N; j++ )
-            for( size_t k = 0; k < N; k++ )
-                if( j == k )
-                    pairbeliefs.push_back( Factor() );
-                else
-                    pairbeliefs.push_back( Factor( VarSet(vvs[j], vvs[k]) ) );
-
-        Real logZ0 = -INFINITY;
-        for( size_t j = 0; j < N; j++ ) {
             // clamp Var j to its possible values
             for( size_t j_val = 0; j_val < vvs[j].states(); j_val++ ) {
-                clamped->clamp( varindices[vvs[j]], j_val, true );
-                if( reInit )
-                    clamped->init();
-                else
-                    clamped->init(vs);
-
-                Real logZ;
-                try {
-                    clamped->run();
-                    logZ = clamped->logZ();
-                } catch( Exception &e ) {
-                    if( e.getCode() == Exception::NOT_NORMALIZABLE )
-                        logZ = -INFINITY;
-                    else
-                        throw;
+                vector<size_t> job( 2 );
+                job[0] = j;
+                job[1] = j_val;
+                jobs.push_back( job );
+            }
+    }
+
+    // The clamped runs are independent, so they are done concurrently, each thread
+    // clamping its own clone of obj; the results are stored per job and combined
+    // afterwards in a fixed order. Exceptions cannot leave a parallel region, so the
+    // first one is rethrown afterwards.
+    vector<Real> logZs( jobs.size(), -INFINITY );
+    vector<vector<Factor> > beliefs( accurate ? 0 : jobs.size() );
+    vector<Exception> errors;
+    DAI_OMP(parallel if(jobs.size() > 1))
+    {
+        InfAlg *clamped = NULL;
+        DAI_OMP(for schedule(dynamic))
+        for( size_t c = 0; c < jobs.size(); c++ ) {
+            try {
+                if( !clamped ) {
+                    clamped = obj.clone();
+                    if( !reInit )
+                        clamped->init();
                 }
+                size_t nrClamped = jobs[c].size() / 2;
+                vector<size_t> vars( nrClamped ), vals( jobs[c].begin() + nrClamped, jobs[c].end() );
+                for( size_t n = 0; n < nrClamped; n++ )
+                    vars[n] = varindices[jobs[c][n]];
+                logZs[c] = runClamped( *clamped, vars, vals, vs, reInit );
+                if( !accurate ) {
+                    beliefs[c].reserve( N );
+                    for( size_t k = 0; k < N; k++ )
+                        beliefs[c].push_back( k == jobs[c][0] ? Factor() : clamped->belief(vvs[k]) );
+                }
+                // restore clamped factors and the state of the algorithm
+                clamped->popBackups();
+            } catch( Exception &e ) {
+                DAI_OMP(critical)
+                errors.push_back( e );
+            }
+        }
+        delete clamped;
+    }
+    if( errors.size() )
+        throw errors.front();
 
+    if( accurate ) {
+        Real logZ0 = 0.0;
+        for( size_t c = 0; c < jobs.size(); ) {
+            size_t j = jobs[c][0], k = jobs[c][1];
+            Factor pairbelief( VarSet(vvs[j], vvs[k]) );
+            for( ; c < jobs.size() && jobs[c][0] == j && jobs[c][1] == k; c++ ) {
+                Real logZ = logZs[c];
                 if( logZ0 == -INFINITY )
                     if( logZ != -INFINITY )
                         logZ0 = logZ;
@@ -183,19 +204,45 @@ vector<Factor> calcPairBeliefs( const InfAlg & obj, const VarSet& vs, bool reIni
                 else
                     Z_xj = exp(logZ - logZ0); // subtract logZ0 to avoid very large numbers
 
-                for( size_t k = 0; k < N; k++ )
-                    if( k != j ) {
-                        Factor b_k = clamped->belief(vvs[k]);
-                        for( size_t k_val = 0; k_val < vvs[k].states(); k_val++ )
-                            if( vvs[j].label() < vvs[k].label() )
-                                pairbeliefs[j * N + k].set( j_val + (k_val * vvs[j].states()), Z_xj * b_k[k_val] );
-                            else
-                                pairbeliefs[j * N + k].set( k_val + (j_val * vvs[k].states()), Z_xj * b_k[k_val] );
-                    }
-
-                // restore clamped factors
-                clamped->restoreFactors( vs );
+                // we assume that j.label() < k.label()
+                // i.e. we make an assumption here about the indexing
+                pairbelief.set( jobs[c][2] + (jobs[c][3] * vvs[j].states()), Z_xj );
             }
+            result.push_back( pairbelief.normalized() );
+        }
+    } else {
+        vector<Factor> pairbeliefs;
+        pairbeliefs.reserve( N * N );
+        for( size_t j = 0; j < N; j++ )
+            for( size_t k = 0; k < N; k++ )
+                if( j == k )
+                    pairbeliefs.push_back( Factor() );
+                else
+                    pairbeliefs.push_back( Factor( VarSet(vvs[j], vvs[k]) ) );
+
+        Real logZ0 = -INFINITY;
+        for( size_t c = 0; c < jobs.size(); c++ ) {
+            size_t j = jobs[c][0], j_val = jobs[c][1];
+            Real logZ = logZs[c];
+            if( logZ0 == -INFINITY )
+                if( logZ != -INFINITY )
+                    logZ0 = logZ;
+
+            Real Z_xj;
+            if( logZ == -INFINITY )
+                Z_xj = 0;
+            else
+                Z_xj = exp(logZ - logZ0); // subtract logZ0 to avoid very large numbers
+
+            for( size_t k = 0; k < N; k++ )
+                if( k != j ) {
+                    const Factor &b_k = beliefs[c][k];
+                    for( size_t k_val = 0; k_val < vvs[k].states(); k_val++ )
+                        if( vvs[j].label() < vvs[k].label() )
+                            pairbeliefs[j * N + k].set( j_val + (k_val * vvs[j].states()), Z_xj * b_k[k_val] );
+                        else
+                            pairbeliefs[j * N + k].set( k_val + (j_val * vvs[k].states()), Z_xj * b_k[k_val] );
+                }
         }
 
         // Calculate result by taking the geometric average
@@ -203,7 +250,6 @@ vector<Factor> calcPairBeliefs( const InfAlg & obj, const VarSet& vs, bool reIni
             for( size_t k = j+1; k < N; k++ )
                 result.push_back( ((pairbeliefs[j * N + k] * pairbeliefs[k * N + j]) ^ 0.5).normalized() );
     }
-    delete clamped;
     return result;
 }
 
@@ -6,6 +6,7 @@
  */
 
 
+#include <queue>
 #include <dai/alldai.h>
 
 
@@ -29,6 +30,19 @@ void DecMAP::setProperties( const PropertySet &opts ) {
         props.reinit = opts.getStringAs<bool>("reinit");
     else
         props.reinit = true;
+    if( opts.hasKey("warmstart") )
+        props.warmstart = opts.getStringAs<bool>("warmstart");
+    else
+        props.warmstart = false;
+    if( opts.hasKey("batch") )
+        props.batch = opts.getStringAs<size_t>("batch");
+    else
+        props.batch = 1;
+    if( opts.hasKey("tol") )
+        props.tol = opts.getStringAs<Real>("tol");
+    else
+        props.tol = 0.0;
+    DAI_ASSERT( props.batch >= 1 );
 }
 
 
@@ -36,6 +50,9 @@ PropertySet DecMAP::getProperties() const {
     PropertySet opts;
     opts.set( "verbose", props.verbose );
     opts.set( "reinit", props.reinit );
+    opts.set( "warmstart", props.warmstart );
+    opts.set( "batch", props.batch );
+    opts.set( "tol", props.tol );
     opts.set( "ianame", props.ianame );
     opts.set( "iaopts", props.iaopts );
     return opts;
@@ -47,6 +64,9 @@ string DecMAP::printProperties() const {
     s << "[";
     s << "verbose=" << props.verbose << ",";
     s << "reinit=" << props.reinit << ",";
+    s << "warmstart=" << props.warmstart << ",";
+    s << "batch=" << props.batch << ",";
+    s << "tol=" << props.tol << ",";
     s << "ianame=" << props.ianame << ",";
     s << "iaopts=" << props.iaopts << "]";
     return s.str();
@@ -94,10 +114,28 @@ Real DecMAP::run() {
     if( props.verbose >= 2 )
         cerr << endl;
 
-    // the variables which have not been clamped yet
-    SmallSet<size_t> freeVars;
+    // the variables which have not been clamped yet, and for each factor
+    // the number of its variables which have not been clamped yet
+    vector<bool> isFree( nrVars(), true );
+    vector<size_t> freeVars( nrVars() );
     for( size_t i = 0; i < nrVars(); i++ )
-        freeVars |= i;
+        freeVars[i] = i;
+    vector<size_t> nrFreeNbs( nrFactors() );
+    vector<size_t> freeFactors;
+    freeFactors.reserve( nrFactors() );
+    for( size_t I = 0; I < nrFactors(); I++ ) {
+        nrFreeNbs[I] = nbF(I).size();
+        if( nrFreeNbs[I] )
+            freeFactors.push_back( I );
+    }
+
+    // entropies of the beliefs, and the beliefs they were calculated from (if props.tol > 0)
+    vector<Real> entV( nrVars() ), entF( nrFactors() );
+    vector<Factor> belV, belF;
+    if( props.tol > 0.0 ) {
+        belV.resize( nrVars() );
+        belF.resize( nrFactors() );
+    }
 
     // prepare the inference algorithm object
     InfAlg *clamped = newInfAlg( props.ianame, fg(), props.iaopts );
@@ -109,46 +147,95 @@ Real DecMAP::run() {
             _maxdiff = md;
         _iters += clamped->Iterations();
 
+        // update the entropies of the beliefs that have changed
+        bforeach( size_t i, freeVars ) {
+            Factor b = clamped->beliefV( i );
+            if( props.tol > 0.0 ) {
+                if( belV[i].vars().size() && dist( b.p(), belV[i].p(), DISTLINF ) <= props.tol )
+                    continue;
+                belV[i] = b;
+            }
+            entV[i] = b.entropy();
+        }
+        bforeach( size_t I, freeFactors ) {
+            Factor b = clamped->beliefF( I );
+            if( props.tol > 0.0 ) {
+                if( belF[I].vars().size() && dist( b.p(), belF[I].p(), DISTLINF ) <= props.tol )
+                    continue;
+                belF[I] = b;
+            }
+            entF[I] = b.entropy();
+        }
+
         // store the variables that need initialization
         VarSet varsToInit;
-        SmallSet<size_t> varsToClamp;
+        vector<size_t> varsToClamp;
 
         // schedule clamping for the free variables with zero entropy
-        for( SmallSet<size_t>::const_iterator it = freeVars.begin(); it != freeVars.end(); ) {
-            if( clamped->beliefV( *it ).entropy() == 0.0 ) {
+        bforeach( size_t i, freeVars ) {
+            if( entV[i] == 0.0 ) {
                 // this variable should be clamped
-                varsToInit |= var( *it );
-                varsToClamp |= *it;
-                _state[*it] = clamped->beliefV( *it ).p().argmax().first;
-                freeVars.erase( *it );
-            } else
-                it++;
+                varsToInit |= var( i );
+                varsToClamp.push_back( i );
+                _state[i] = clamped->beliefV( i ).p().argmax().first;
+                isFree[i] = false;
+                bforeach( const Neighbor &I, nbV(i) )
+                    nrFreeNbs[I]--;
+            }
         }
 
-        // find the free factor with lowest entropy
-        size_t bestI = 0;
-        Real bestEnt = INFINITY;
-        for( size_t I = 0; I < nrFactors(); I++ ) {
-            // check if the factor is still free
-            if( freeVars.intersects( bipGraph().nb2Set(I) ) ) {
-                Real EntI = clamped->beliefF(I).entropy();
-                if( EntI < bestEnt ) {
-                    bestI = I;
-                    bestEnt = EntI;
+        // schedule clamping for the free factors with lowest entropy; if more than one
+        // factor is clamped, factors that share a variable with a clamped factor are skipped
+        typedef pair<Real, size_t> QueueEntry;
+        vector<QueueEntry> cands;
+        cands.reserve( freeFactors.size() );
+        bforeach( size_t I, freeFactors )
+            if( nrFreeNbs[I] )
+                cands.push_back( make_pair( entF[I], I ) );
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry> > queue( cands.begin(), cands.end() );
+        vector<bool> touched;
+        if( props.batch > 1 )
+            touched.assign( nrVars(), false );
+        for( size_t nrClamped = 0; nrClamped < props.batch && !queue.empty(); queue.pop() ) {
+            size_t I = queue.top().second;
+            if( props.batch > 1 ) {
+                bool overlaps = false;
+                bforeach( const Neighbor &i, nbF(I) )
+                    if( touched[i] ) {
+                        overlaps = true;
+                        break;
+                    }
+                if( overlaps )
+                    continue;
+                bforeach( const Neighbor &i, nbF(I) )
+                    touched[i] = true;
+            }
+
+            map<Var, size_t> Istatemap = calcState( factor(I).vars(), clamped->beliefF(I).p().argmax().first );
+            bforeach( const Neighbor &i, nbF(I) ) {
+                if( isFree[i] ) {
+                    varsToInit |= var(i);
+                    varsToClamp.push_back( i );
+                    _state[i] = Istatemap[var(i)];
+                    isFree[i] = false;
+                    bforeach( const Neighbor &J, nbV(i) )
+                        nrFreeNbs[J]--;
                 }
             }
+            nrClamped++;
         }
 
-        // schedule clamping for the factor with lowest entropy
-        vector<size_t> Istate(1,0);
-        Istate[0] = clamped->beliefF(bestI).p().argmax().first;
-        map<Var, size_t> Istatemap = calcState( factor(bestI).vars(), Istate[0] );
-        bforeach( size_t i, bipGraph().nb2Set(bestI) & freeVars ) {
-            varsToInit |= var(i);
-            varsToClamp |= i;
-            _state[i] = Istatemap[var(i)];
-            freeVars.erase(i);
-        }
+        // remove the clamped variables and factors from the free ones
+        size_t n = 0;
+        bforeach( size_t i, freeVars )
+            if( isFree[i] )
+                freeVars[n++] = i;
+        freeVars.resize( n );
+        n = 0;
+        bforeach( size_t I, freeFactors )
+            if( nrFreeNbs[I] )
+                freeFactors[n++] = I;
+        freeFactors.resize( n );
 
         // clamp all variables scheduled for clamping
         bforeach( size_t i, varsToClamp )
@@ -157,6 +244,8 @@ Real DecMAP::run() {
         // initialize clamped for the next run
         if( props.reinit )
             clamped->init();
+        else if( props.warmstart )
+            clamped->init( VarSet() );
         else
             clamped->init( varsToInit );
     }
@@ -6,6 +6,7 @@
  */
 
 
+#include <algorithm>
 #include <dai/util.h>
 #include <dai/emalg.h>
 
@@ -164,19 +165,37 @@ SharedParameters::SharedParameters( std::istream &is, const FactorGraph &fg )
 
 
 void SharedParameters::collectSufficientStatistics( InfAlg &alg ) {
-    for( std::map< FactorIndex, Permute >::iterator i = _perms.begin(); i != _perms.end(); ++i ) {
-        Permute &perm = i->second;
-        VarSet &vs = _varsets[i->first];
+    std::vector<Prob> stats;
+    calcSufficientStatistics( alg, stats );
+    addSufficientStatistics( stats, 0 );
+}
+
+
+void SharedParameters::calcSufficientStatistics( const InfAlg &alg, std::vector<Prob> &stats ) const {
+    for( std::map< FactorIndex, Permute >::const_iterator i = _perms.begin(); i != _perms.end(); ++i ) {
+        const Permute &perm = i->second;
+        const VarSet &vs = _varsets.find(i->first)->second;
 
         Factor b = alg.belief(vs);
         Prob p( b.nrStates(), 0.0 );
         for( size_t entry = 0; entry < b.nrStates(); ++entry )
             p.set( entry, b[perm.convertLinearIndex(entry)] ); // apply inverse permutation
-        _estimation->addSufficientStatistics( p );
+        stats.push_back( p );
     }
 }
 
 
+size_t SharedParameters::addSufficientStatistics( const std::vector<Prob> &stats, size_t pos, Real weight ) {
+    for( size_t i = 0; i < _perms.size(); ++i, ++pos ) {
+        if( weight == 1.0 )
+            _estimation->addSufficientStatistics( stats[pos] );
+        else
+            _estimation->addSufficientStatistics( stats[pos] * weight );
+    }
+    return pos;
+}
+
+
 void SharedParameters::setParameters( FactorGraph &fg ) {
     Prob p = _estimation->estimate();
     for( std::map<FactorIndex, Permute>::iterator i = _perms.begin(); i != _perms.end(); ++i ) {
@@ -207,6 +226,19 @@ void MaximizationStep::addExpectations( InfAlg &alg ) {
 }
 
 
+void MaximizationStep::calcExpectations( const InfAlg &alg, std::vector<Prob> &stats ) const {
+    for( size_t i = 0; i < _params.size(); ++i )
+        _params[i].calcSufficientStatistics( alg, stats );
+}
+
+
+void MaximizationStep::addExpectations( const std::vector<Prob> &stats, Real weight ) {
+    size_t pos = 0;
+    for( size_t i = 0; i < _params.size(); ++i )
+        pos = _params[i].addSufficientStatistics( stats, pos, weight );
+}
+
+
 void MaximizationStep::maximize( FactorGraph &fg ) {
     for( size_t i = 0; i < _params.size(); ++i )
         _params[i].setParameters( fg );
@@ -217,10 +249,12 @@ const std::string EMAlg::MAX_ITERS_KEY("max_iters");
 const std::string EMAlg::LOG_Z_TOL_KEY("log_z_tol");
 const size_t EMAlg::MAX_ITERS_DEFAULT = 30;
 const Real EMAlg::LOG_Z_TOL_DEFAULT = 0.01;
+const std::string EMAlg::STEP_ALPHA_KEY("step_alpha");
+const Real EMAlg::STEP_ALPHA_DEFAULT = 0.7;
 
 
 EMAlg::EMAlg( const Evidence &evidence, InfAlg &estep, std::istream &msteps_file )
-  : _evidence(evidence), _estep(estep), _msteps(), _iters(0), _lastLogZ(), _max_iters(MAX_ITERS_DEFAULT), _log_z_tol(LOG_Z_TOL_DEFAULT)
+  : _evidence(evidence), _estep(estep), _msteps(), _iters(0), _lastLogZ(), _max_iters(MAX_ITERS_DEFAULT), _log_z_tol(LOG_Z_TOL_DEFAULT), _workers(), _step_alpha(STEP_ALPHA_DEFAULT), _onlineSteps(0), _onlineSamples(0), _onlinePassSamples(0), _onlineStats()
 {
     msteps_file.exceptions( std::istream::eofbit | std::istream::failbit | std::istream::badbit );
     size_t num_msteps = -1;
@@ -236,6 +270,12 @@ void EMAlg::setTermConditions( const PropertySet &p ) {
         _max_iters = p.getStringAs<size_t>(MAX_ITERS_KEY);
     if( p.hasKey(LOG_Z_TOL_KEY) )
         _log_z_tol = p.getStringAs<Real>(LOG_Z_TOL_KEY);
+    if( p.hasKey(STEP_ALPHA_KEY) ) {
+        Real alpha = p.getStringAs<Real>(STEP_ALPHA_KEY);
+        if( !(alpha > 0.5 && alpha <= 1.0) )
+            DAI_THROWE(MALFORMED_PROPERTY,"step_alpha should be in (0.5,1]");
+        _step_alpha = alpha;
+    }
 }
 
 
@@ -253,6 +293,9 @@ bool EMAlg::hasSatisfiedTermConditions() const {
         if( previous == 0 )
             return false;
         Real diff = current - previous;
+        if( _onlineSteps > 0 )
+            // online EM does not guarantee an increase of the log-likelihood
+            return (fabs(diff) / fabs(previous)) <= _log_z_tol;
         if( diff < 0 ) {
             std::cerr << "Error: in EM log-likehood decreased from " << previous << " to " << current << std::endl;
             return true;
@@ -262,28 +305,86 @@ bool EMAlg::hasSatisfiedTermConditions() const {
 }
 
 
-Real EMAlg::iterate( MaximizationStep &mstep ) {
+Real EMAlg::eStep( const Evidence &evidence, MaximizationStep &mstep, std::vector<Prob> *sum ) {
     Real logZ = 0;
     Real likelihood = 0;
 
     _estep.run();
     logZ = _estep.logZ();
 
-    // Expectation calculation
-    for( Evidence::const_iterator e = _evidence.begin(); e != _evidence.end(); ++e ) {
-        InfAlg* clamped = _estep.clone();
-        // Apply evidence
-        for( Evidence::Observation::const_iterator i = e->begin(); i != e->end(); ++i )
-            clamped->clamp( clamped->fg().findVar(i->first), i->second );
-        clamped->init();
-        clamped->run();
+    // Identical samples only need a single inference run
+    std::vector<size_t> patterns, counts;
+    evidence.findPatterns( patterns, counts );
+    if( sum )
+        sum->clear();
+
+    // Expectation calculation; the distinct samples are processed in blocks, the inference
+    // runs within a block are done concurrently, each thread conditioning its own copy of
+    // _estep within a nested backup level, and the results are added in sample order.
+    // The copies of previous iterations only need the new factors of _estep.
+    const size_t blockSize = 1024;
+    if( _workers.size() < nrThreads() )
+        _workers.resize( nrThreads() );
+    std::vector<char> reloaded( _workers.size(), 0 );
+    std::vector<Real> sampleLogZ;
+    std::vector<std::vector<Prob> > expectations;
+    std::vector<Exception> errors;
+    for( size_t first = 0; first < patterns.size() && errors.empty(); first += blockSize ) {
+        size_t n = std::min( blockSize, patterns.size() - first );
+        sampleLogZ.assign( n, 0.0 );
+        expectations.assign( n, std::vector<Prob>() );
+        DAI_OMP(parallel for schedule(dynamic))
+        for( size_t s = 0; s < n; s++ ) {
+            try {
+                size_t t = threadNum();
+                if( !_workers[t] )
+                    _workers[t].reset( _estep.clone() );
+                else if( !reloaded[t] )
+                    _workers[t]->reloadFactors( _estep.fg() );
+                reloaded[t] = 1;
+                InfAlg *alg = _workers[t].get();
+                const Evidence::Observation &obs = *(evidence.begin() + patterns[first + s]);
+                alg->pushBackups();
+                // Apply evidence
+                for( Evidence::Observation::const_iterator i = obs.begin(); i != obs.end(); ++i )
+                    alg->clamp( alg->fg().findVar(i->first), i->second, true );
+                alg->init();
+                alg->run();
+                sampleLogZ[s] = alg->logZ();
+                mstep.calcExpectations( *alg, expectations[s] );
+                alg->popBackups();
+            } catch( Exception &e ) {
+                // the copy may have been left with clamped factors
+                _workers[threadNum()].reset();
+                DAI_OMP(critical)
+                errors.push_back( e );
+            }
+        }
+        if( errors.empty() )
+            for( size_t s = 0; s < n; s++ ) {
+                Real count = counts[first + s];
+                likelihood += count * (sampleLogZ[s] - logZ);
+                if( !sum )
+                    mstep.addExpectations( expectations[s], count );
+                else if( sum->empty() ) {
+                    sum->swap( expectations[s] );
+                    if( count != 1 )
+                        for( size_t i = 0; i < sum->size(); i++ )
+                            (*sum)[i] *= count;
+                } else
+                    for( size_t i = 0; i < sum->size(); i++ )
+                        (*sum)[i] += expectations[s][i] * count;
+            }
+    }
+    if( errors.size() )
+        throw errors.front();
 
-        likelihood += clamped->logZ() - logZ;
+    return likelihood;
+}
 
-        mstep.addExpectations( *clamped );
 
-        delete clamped;
-    }
+Real EMAlg::iterate( MaximizationStep &mstep ) {
+    Real likelihood = eStep( _evidence, mstep, NULL );
 
     // Maximization of parameters
     mstep.maximize( _estep.fg() );
@@ -293,7 +394,7 @@ Real EMAlg::iterate( MaximizationStep &mstep ) {
 
 
 Real EMAlg::iterate() {
-    Real likelihood;
+    Real likelihood = 0.0;
     for( size_t i = 0; i < _msteps.size(); ++i )
         likelihood = iterate( _msteps[i] );
     _lastLogZ.push_back( likelihood );
@@ -308,4 +409,71 @@ void EMAlg::run() {
 }
 
 
+Real EMAlg::iterateOnline( const Evidence &batch ) {
+    if( batch.nrSamples() == 0 )
+        return 0.0;
+
+    _onlineSamples += batch.nrSamples();
+    // Weight of the average statistics in the maximization step: the number of samples
+    // seen so far, but at most the number of samples in one pass over the data
+    Real weight = _onlineSamples;
+    if( _onlinePassSamples && _onlinePassSamples < _onlineSamples )
+        weight = _onlinePassSamples;
+    // Step size; it equals one for the first mini-batch, which initializes the averages
+    Real eta = std::pow( (Real)(_onlineSteps + 1), -_step_alpha );
+
+    _onlineStats.resize( _msteps.size() );
+    Real likelihood = 0.0;
+    std::vector<Prob> sum;
+    for( size_t m = 0; m < _msteps.size(); ++m ) {
+        likelihood = eStep( batch, _msteps[m], &sum );
+
+        // Update running average of the expected sufficient statistics per sample
+        std::vector<Prob> &avg = _onlineStats[m];
+        Real scale = eta / batch.nrSamples();
+        if( avg.size() != sum.size() ) {
+            DAI_ASSERT( eta == 1.0 );
+            avg.swap( sum );
+            for( size_t i = 0; i < avg.size(); i++ )
+                avg[i] *= scale;
+        } else
+            for( size_t i = 0; i < avg.size(); i++ )
+                avg[i] = avg[i] * (1.0 - eta) + sum[i] * scale;
+
+        // Maximization of parameters
+        _msteps[m].addExpectations( avg, weight );
+        _msteps[m].maximize( _estep.fg() );
+    }
+    ++_onlineSteps;
+
+    return likelihood;
+}
+
+
+Real EMAlg::iterateOnline( EvidenceReader &reader, size_t batchSize ) {
+    DAI_ASSERT( batchSize > 0 );
+
+    Real likelihood = 0.0;
+    size_t nrSamples = 0;
+    Evidence batch;
+    reader.rewind();
+    while( reader.read( batch, batchSize ) ) {
+        likelihood += iterateOnline( batch );
+        nrSamples += batch.nrSamples();
+    }
+    if( nrSamples > _onlinePassSamples )
+        _onlinePassSamples = nrSamples;
+
+    _lastLogZ.push_back( likelihood );
+    ++_iters;
+    return likelihood;
+}
+
+
+void EMAlg::runOnline( EvidenceReader &reader, size_t batchSize ) {
+    while( !hasSatisfiedTermConditions() )
+        iterateOnline( reader, batchSize );
+}
+
+
 } // end of namespace dai
@@ -7,8 +7,11 @@
 
 
 #include <sstream>
+#include <fstream>
 #include <string>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
 #include <dai/util.h>
 #include <dai/evidence.h>
@@ -18,22 +21,22 @@
 namespace dai {
 
 
-void Evidence::addEvidenceTabFile( std::istream &is, FactorGraph &fg ) {
+/// Maps the labels of the variables of \a fg to the variables
+static std::map<std::string, Var> labelMap( const FactorGraph &fg ) {
     std::map<std::string, Var> varMap;
     for( std::vector<Var>::const_iterator v = fg.vars().begin(); v != fg.vars().end(); ++v ) {
         std::stringstream s;
         s << v->label();
         varMap[s.str()] = *v;
     }
-
-    addEvidenceTabFile( is, varMap );
+    return varMap;
 }
 
 
-void Evidence::addEvidenceTabFile( std::istream &is, std::map<std::string, Var> &varMap ) {
+/// Reads the header of a .tab file (and the empty line following it) and returns the variables corresponding to the columns
+static std::vector<Var> readTabHeader( std::istream &is, const std::map<std::string, Var> &varMap ) {
     std::string line;
     getline( is, line );
-    size_t line_number = 2;
 
     // Parse header
     std::vector<std::string> header_fields;
@@ -44,7 +47,7 @@ void Evidence::addEvidenceTabFile( std::istream &is, std::map<std::string, Var>
 
     std::vector<Var> vars;
     for( ; p_field != header_fields.end(); ++p_field ) {
-        std::map<std::string, Var>::iterator elem = varMap.find( *p_field );
+        std::map<std::string, Var>::const_iterator elem = varMap.find( *p_field );
         if( elem == varMap.end() )
             DAI_THROWE(INVALID_EVIDENCE_FILE,"Variable " + *p_field + " not known");
         vars.push_back( elem->second );
@@ -54,28 +57,393 @@ void Evidence::addEvidenceTabFile( std::istream &is, std::map<std::string, Var>
     if( is.fail() || line.size() > 0 )
         DAI_THROWE(INVALID_EVIDENCE_FILE,"Expecting empty line");
 
-    // Read samples
-    while( getline(is, line) ) {
-        line_number++;
-
-        std::vector<std::string> fields;
-        fields = tokenizeString( line, true, "\t" );
-        if( fields.size() != vars.size() )
-            DAI_THROWE(INVALID_EVIDENCE_FILE,"Invalid number of fields in line " + boost::lexical_cast<std::string>(line_number));
-
-        Observation sample;
-        for( size_t i = 0; i < vars.size(); ++i ) {
-            if( fields[i].size() > 0 ) { // skip if missing observation
-                if( fields[i].find_first_not_of("0123456789") != std::string::npos )
-                    DAI_THROWE(INVALID_EVIDENCE_FILE,"Invalid state " + fields[i] + " in line " + boost::lexical_cast<std::string>(line_number));
-                size_t state = fromString<size_t>( fields[i].c_str() );
-                if( state >= vars[i].states() )
-                    DAI_THROWE(INVALID_EVIDENCE_FILE,"State " + fields[i] + " too large in line " + boost::lexical_cast<std::string>(line_number));
-                sample[vars[i]] = state;
+    return vars;
+}
+
+
+/// Indicates a missing observation in the states parsed by parseTabLine()
+static const size_t MISSING_STATE = (size_t)-1;
+
+
+/// Returns pointer to the first occurrence of \a c in [\a begin, \a end), or \a end if it does not occur
+static inline const char* findChar( const char *begin, const char *end, char c ) {
+    const void *p = memchr( begin, c, end - begin );
+    return p ? static_cast<const char *>(p) : end;
+}
+
+
+/// Parses line \a line_number, consisting of the characters [\a begin, \a end), of a .tab file with columns corresponding to \a vars
+/** The states are written to \a states[0], ..., \a states[vars.size()-1], where MISSING_STATE means that the state has not been observed.
+ */
+static void parseTabLine( const char *begin, const char *end, const std::vector<Var> &vars, size_t *states, size_t line_number ) {
+    if( (size_t)std::count( begin, end, '\t' ) + 1 != vars.size() )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Invalid number of fields in line " + boost::lexical_cast<std::string>(line_number));
+
+    const char *field = begin;
+    for( size_t i = 0; i < vars.size(); ++i ) {
+        const char *field_end = findChar( field, end, '\t' );
+        if( field == field_end ) // missing observation
+            states[i] = MISSING_STATE;
+        else {
+            size_t state = 0;
+            bool tooLarge = false;
+            for( const char *c = field; c != field_end; ++c ) {
+                if( *c < '0' || *c > '9' )
+                    DAI_THROWE(INVALID_EVIDENCE_FILE,"Invalid state " + std::string(field, field_end) + " in line " + boost::lexical_cast<std::string>(line_number));
+                if( !tooLarge ) {
+                    state = 10 * state + (*c - '0');
+                    tooLarge = (state >= vars[i].states());
+                }
+            }
+            if( tooLarge )
+                DAI_THROWE(INVALID_EVIDENCE_FILE,"State " + std::string(field, field_end) + " too large in line " + boost::lexical_cast<std::string>(line_number));
+            states[i] = state;
+        }
+        field = field_end + 1;
+    }
+}
+
+
+/// Returns the observation corresponding to the states parsed by parseTabLine()
+static Evidence::Observation tabObservation( const std::vector<Var> &vars, const size_t *states ) {
+    Evidence::Observation sample;
+    for( size_t i = 0; i < vars.size(); ++i )
+        if( states[i] != MISSING_STATE )
+            sample[vars[i]] = states[i];
+    return sample;
+}
+
+
+/// Reads the header of the .tab file contents [\a begin, \a end) and sets \a lines to the first characters of the sample lines
+/** \return The variables corresponding to the columns
+ */
+static std::vector<Var> splitTabText( const char *begin, const char *end, const std::map<std::string, Var> &varMap, std::vector<const char *> &lines ) {
+    // The header consists of the first two lines
+    const char *p = begin;
+    for( size_t i = 0; i < 2 && p != end; ++i ) {
+        p = findChar( p, end, '\n' );
+        if( p != end )
+            ++p;
+    }
+    std::istringstream header( std::string( begin, p ) );
+    std::vector<Var> vars = readTabHeader( header, varMap );
+
+    lines.clear();
+    while( p != end ) {
+        lines.push_back( p );
+        p = findChar( p, end, '\n' );
+        if( p != end )
+            ++p;
+    }
+    return vars;
+}
+
+
+/// Returns the end of sample line \a l found by splitTabText() on the .tab file contents ending at \a end
+static inline const char* tabLineEnd( const std::vector<const char *> &lines, size_t l, const char *end ) {
+    if( l + 1 < lines.size() )
+        return lines[l + 1] - 1;
+    else
+        return (end[-1] == '\n') ? end - 1 : end;
+}
+
+
+void Evidence::addEvidenceTabFile( std::istream &is, FactorGraph &fg ) {
+    std::map<std::string, Var> varMap = labelMap( fg );
+    addEvidenceTabFile( is, varMap );
+}
+
+
+void Evidence::addEvidenceTabFile( std::istream &is, std::map<std::string, Var> &varMap ) {
+    std::string text;
+    {
+        std::ostringstream contents;
+        contents << is.rdbuf();
+        text = contents.str();
+    }
+    const char *begin = text.data();
+    const char *end = begin + text.size();
+    std::vector<const char *> lines;
+    std::vector<Var> vars = splitTabText( begin, end, varMap, lines );
+
+    // Parse the sample lines concurrently; if there are invalid lines, the first one is reported
+    size_t first = _samples.size();
+    _samples.resize( first + lines.size() );
+    std::vector<Exception> errors;
+    size_t errorLine = lines.size();
+    DAI_OMP(parallel)
+    {
+        std::vector<size_t> states( vars.size() );
+        DAI_OMP(for schedule(dynamic, 256))
+        for( size_t l = 0; l < lines.size(); l++ ) {
+            try {
+                parseTabLine( lines[l], tabLineEnd( lines, l, end ), vars, &(states[0]), l + 3 );
+                _samples[first + l] = tabObservation( vars, &(states[0]) );
+            } catch( Exception &e ) {
+                DAI_OMP(critical)
+                if( l < errorLine ) {
+                    errorLine = l;
+                    errors.assign( 1, e );
+                }
+            }
+        }
+    }
+    if( errors.size() ) {
+        _samples.resize( first );
+        throw errors.front();
+    }
+}
+
+
+void Evidence::findPatterns( std::vector<size_t> &patterns, std::vector<size_t> &counts ) const {
+    patterns.clear();
+    counts.clear();
+    std::map<Observation, size_t> index;
+    for( size_t s = 0; s < _samples.size(); ++s ) {
+        std::pair<std::map<Observation, size_t>::iterator, bool> it = index.insert( std::make_pair( _samples[s], patterns.size() ) );
+        if( it.second ) {
+            patterns.push_back( s );
+            counts.push_back( 1 );
+        } else
+            counts[it.first->second]++;
+    }
+}
+
+
+EvidenceTabReader::EvidenceTabReader( std::istream &is, const FactorGraph &fg ) : _is(is), _vars(), _first(), _line_number(2) {
+    _vars = readTabHeader( _is, labelMap( fg ) );
+    _first = _is.tellg();
+}
+
+
+size_t EvidenceTabReader::read( Evidence &batch, size_t n ) {
+    batch.clear();
+    std::string line;
+    std::vector<size_t> states( _vars.size() );
+    while( batch.nrSamples() < n && getline(_is, line) ) {
+        _line_number++;
+        parseTabLine( line.data(), line.data() + line.size(), _vars, &(states[0]), _line_number );
+        batch.addSample( tabObservation( _vars, &(states[0]) ) );
+    }
+    return batch.nrSamples();
+}
+
+
+void EvidenceTabReader::rewind() {
+    _is.clear();
+    _is.seekg( _first );
+    if( _is.fail() )
+        DAI_THROWE(CANNOT_READ_FILE,"Cannot rewind the evidence stream");
+    _line_number = 2;
+}
+
+
+/// Returns the number of bits per state used by EvidenceTable for a variable with \a states states
+static size_t tableBits( size_t states ) {
+    size_t bits = 1;
+    while( bits < 64 && (((boost::uint64_t)1) << bits) < states )
+        bits *= 2;
+    return bits;
+}
+
+
+/// Stores state \a state of sample \a sample in the column with \a bits bits per state, whose states and mask start at \a values and \a mask
+static inline void tablePut( boost::uint64_t *values, boost::uint64_t *mask, size_t bits, size_t sample, size_t state ) {
+    size_t pos = sample * bits;
+    values[pos / 64] |= ((boost::uint64_t)state) << (pos % 64);
+    mask[sample / 64] |= ((boost::uint64_t)1) << (sample % 64);
+}
+
+
+/// Identifies binary evidence files
+static const char EVIDENCE_MAGIC[8] = {'l','i','b','D','A','I','e','v'};
+/// Version of the binary evidence file format
+static const boost::uint64_t EVIDENCE_VERSION = 1;
+/// Used to check that a binary evidence file has the native byte order
+static const boost::uint64_t EVIDENCE_BYTE_ORDER = 0x0102030405060708ULL;
+/// Number of words in the header of a binary evidence file
+static const size_t EVIDENCE_HEADER_WORDS = 6;
+/// Number of words describing a variable in a binary evidence file
+static const size_t EVIDENCE_VAR_WORDS = 5;
+
+
+void EvidenceTable::allocate( const std::vector<Var> &vars, size_t nrSamples ) {
+    _vars = vars;
+    _nrSamples = nrSamples;
+    _bits.resize( vars.size() );
+    _valueOffsets.resize( vars.size() );
+    _maskOffsets.resize( vars.size() );
+    _nrWords = 0;
+    for( size_t c = 0; c < vars.size(); c++ ) {
+        _bits[c] = tableBits( vars[c].states() );
+        _valueOffsets[c] = _nrWords;
+        _nrWords += (nrSamples * _bits[c] + 63) / 64;
+        _maskOffsets[c] = _nrWords;
+        _nrWords += (nrSamples + 63) / 64;
+    }
+    _storage.assign( _nrWords, 0 );
+    _file.reset();
+    _fileOffset = 0;
+}
+
+
+EvidenceTable::EvidenceTable( const Evidence &evidence ) : _vars(), _nrSamples(0), _bits(), _valueOffsets(), _maskOffsets(), _nrWords(0), _storage(), _file(), _fileOffset(0) {
+    VarSet observed;
+    for( Evidence::const_iterator e = evidence.begin(); e != evidence.end(); ++e )
+        for( Evidence::Observation::const_iterator i = e->begin(); i != e->end(); ++i )
+            observed.insert( i->first );
+    allocate( std::vector<Var>( observed.begin(), observed.end() ), evidence.nrSamples() );
+
+    for( size_t s = 0; s < _nrSamples; s++ ) {
+        const Evidence::Observation &obs = *(evidence.begin() + s);
+        for( Evidence::Observation::const_iterator i = obs.begin(); i != obs.end(); ++i ) {
+            size_t c = std::lower_bound( _vars.begin(), _vars.end(), i->first ) - _vars.begin();
+            tablePut( &(_storage[_valueOffsets[c]]), &(_storage[_maskOffsets[c]]), _bits[c], s, i->second );
+        }
+    }
+}
+
+
+Evidence::Observation EvidenceTable::observation( size_t sample ) const {
+    Evidence::Observation obs;
+    for( size_t c = 0; c < _vars.size(); c++ )
+        if( observed( sample, c ) )
+            obs[_vars[c]] = state( sample, c );
+    return obs;
+}
+
+
+void EvidenceTable::getSamples( Evidence &evidence, size_t first, size_t n ) const {
+    DAI_ASSERT( first + n <= _nrSamples );
+    for( size_t s = first; s < first + n; s++ )
+        evidence.addSample( observation( s ) );
+}
+
+
+void EvidenceTable::ReadTabFile( const char *filename, const FactorGraph &fg ) {
+    MappedFile file( filename );
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+    std::vector<const char *> lines;
+    std::vector<Var> vars = splitTabText( begin, end, labelMap( fg ), lines );
+    allocate( vars, lines.size() );
+
+    // Parse the sample lines concurrently, in chunks of 64 samples (which do not share words);
+    // if there are invalid lines, the first one is reported
+    std::vector<Exception> errors;
+    size_t errorLine = lines.size();
+    size_t nrChunks = (lines.size() + 63) / 64;
+    DAI_OMP(parallel)
+    {
+        std::vector<size_t> states( vars.size() );
+        DAI_OMP(for schedule(dynamic, 16))
+        for( size_t chunk = 0; chunk < nrChunks; chunk++ ) {
+            size_t l = 64 * chunk;
+            try {
+                for( ; l < std::min( lines.size(), 64 * (chunk + 1) ); l++ ) {
+                    parseTabLine( lines[l], tabLineEnd( lines, l, end ), vars, &(states[0]), l + 3 );
+                    for( size_t c = 0; c < vars.size(); c++ )
+                        if( states[c] != MISSING_STATE )
+                            tablePut( &(_storage[_valueOffsets[c]]), &(_storage[_maskOffsets[c]]), _bits[c], l, states[c] );
+                }
+            } catch( Exception &e ) {
+                DAI_OMP(critical)
+                if( l < errorLine ) {
+                    errorLine = l;
+                    errors.assign( 1, e );
+                }
             }
         }
-        _samples.push_back( sample );
-    } // finished sample line
+    }
+    if( errors.size() ) {
+        *this = EvidenceTable();
+        throw errors.front();
+    }
+}
+
+
+void EvidenceTable::ReadFromFile( const char *filename ) {
+    boost::shared_ptr<MappedFile> file( new MappedFile( filename ) );
+    size_t size = file->size();
+    const boost::uint64_t *header = reinterpret_cast<const boost::uint64_t *>( file->data() );
+    if( size < EVIDENCE_HEADER_WORDS * 8 || memcmp( file->data(), EVIDENCE_MAGIC, 8 ) != 0 )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Not a binary evidence file");
+    if( header[1] != EVIDENCE_VERSION )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Unsupported version " + boost::lexical_cast<std::string>(header[1]));
+    if( header[2] != EVIDENCE_BYTE_ORDER )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Incompatible byte order");
+    size_t nrVars = header[3];
+    size_t nrSamples = header[4];
+    size_t nrWords = header[5];
+    size_t maxWords = size / 8 - EVIDENCE_HEADER_WORDS;
+    if( nrVars > maxWords / EVIDENCE_VAR_WORDS || nrWords > maxWords - nrVars * EVIDENCE_VAR_WORDS )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"File too short");
+    if( nrVars > 0 && nrSamples / 64 > nrWords )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Invalid number of samples");
+
+    std::vector<Var> vars( nrVars );
+    std::vector<size_t> bits( nrVars ), valueOffsets( nrVars ), maskOffsets( nrVars );
+    const boost::uint64_t *varWords = header + EVIDENCE_HEADER_WORDS;
+    for( size_t c = 0; c < nrVars; c++, varWords += EVIDENCE_VAR_WORDS ) {
+        vars[c] = Var( varWords[0], varWords[1] );
+        bits[c] = varWords[2];
+        valueOffsets[c] = varWords[3];
+        maskOffsets[c] = varWords[4];
+        if( vars[c].states() == 0 || bits[c] != tableBits( vars[c].states() )
+            || valueOffsets[c] > nrWords || (nrSamples * bits[c] + 63) / 64 > nrWords - valueOffsets[c]
+            || maskOffsets[c] > nrWords || (nrSamples + 63) / 64 > nrWords - maskOffsets[c] )
+            DAI_THROWE(INVALID_EVIDENCE_FILE,"Invalid description of variable " + boost::lexical_cast<std::string>(vars[c].label()));
+    }
+
+    _vars.swap( vars );
+    _nrSamples = nrSamples;
+    _bits.swap( bits );
+    _valueOffsets.swap( valueOffsets );
+    _maskOffsets.swap( maskOffsets );
+    _nrWords = nrWords;
+    std::vector<boost::uint64_t>().swap( _storage );
+    _file = file;
+    _fileOffset = (EVIDENCE_HEADER_WORDS + nrVars * EVIDENCE_VAR_WORDS) * 8;
+}
+
+
+void EvidenceTable::WriteToFile( const char *filename ) const {
+    std::ofstream os( filename, std::ios::binary );
+    if( !os.is_open() )
+        DAI_THROWE(CANNOT_WRITE_FILE,"Cannot write to file " + std::string(filename));
+
+    std::vector<boost::uint64_t> header;
+    header.reserve( EVIDENCE_HEADER_WORDS + _vars.size() * EVIDENCE_VAR_WORDS );
+    boost::uint64_t magic;
+    memcpy( &magic, EVIDENCE_MAGIC, 8 );
+    header.push_back( magic );
+    header.push_back( EVIDENCE_VERSION );
+    header.push_back( EVIDENCE_BYTE_ORDER );
+    header.push_back( _vars.size() );
+    header.push_back( _nrSamples );
+    header.push_back( _nrWords );
+    for( size_t c = 0; c < _vars.size(); c++ ) {
+        header.push_back( _vars[c].label() );
+        header.push_back( _vars[c].states() );
+        header.push_back( _bits[c] );
+        header.push_back( _valueOffsets[c] );
+        header.push_back( _maskOffsets[c] );
+    }
+    os.write( reinterpret_cast<const char *>( &(header[0]) ), header.size() * sizeof(boost::uint64_t) );
+    if( _nrWords )
+        os.write( reinterpret_cast<const char *>( words() ), _nrWords * sizeof(boost::uint64_t) );
+    os.close();
+    if( os.fail() )
+        DAI_THROWE(CANNOT_WRITE_FILE,"Cannot write to file " + std::string(filename));
+}
+
+
+size_t EvidenceTableReader::read( Evidence &batch, size_t n ) {
+    batch.clear();
+    n = std::min( n, _table.nrSamples() - _pos );
+    _table.getSamples( batch, _pos, n );
+    _pos += n;
+    return n;
 }
 
 
@@ -15,10 +15,12 @@
 #include <string>
 #include <algorithm>
 #include <functional>
+#include <cstring>
 #include <dai/factorgraph.h>
 #include <dai/util.h>
 #include <dai/exceptions.h>
 #include <boost/lexical_cast.hpp>
+#include <boost/cstdint.hpp>
 
 
 namespace dai {
@@ -27,7 +29,7 @@ namespace dai {
 using namespace std;
 
 
-FactorGraph::FactorGraph( const std::vector<Factor> &P ) : _G(), _backup() {
+FactorGraph::FactorGraph( const std::vector<Factor> &P ) : _G(), _backup(), _backupLevels(), _varIndex(), _factorIndex() {
     // add factors, obtain variables
     set<Var> varset;
     _factors.reserve( P.size() );
@@ -50,18 +52,20 @@ FactorGraph::FactorGraph( const std::vector<Factor> &P ) : _G(), _backup() {
 
 void FactorGraph::constructGraph( size_t nrEdges ) {
     // create a mapping for indices
-    hash_map<size_t, size_t> hashmap;
-
+    _varIndex.clear();
     for( size_t i = 0; i < vars().size(); i++ )
-        hashmap[var(i).label()] = i;
+        _varIndex[var(i).label()] = i;
 
     // create edge list
     vector<Edge> edges;
     edges.reserve( nrEdges );
+    _factorIndex.clear();
     for( size_t i2 = 0; i2 < nrFactors(); i2++ ) {
         const VarSet& ns = factor(i2).vars();
         for( VarSet::const_iterator q = ns.begin(); q != ns.end(); q++ )
-            edges.push_back( Edge(hashmap[q->label()], i2) );
+            edges.push_back( Edge(_varIndex[q->label()], i2) );
+        // keeps the first factor with this hash value
+        _factorIndex.insert( make_pair( hash_value( ns ), i2 ) );
     }
 
     // create bipartite graph
@@ -200,6 +204,181 @@ std::istream& operator>> ( std::istream& is, FactorGraph &fg ) {
 }
 
 
+/// Returns whether \a c is a white space character
+static inline bool fgSpace( char c ) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+/// Returns a pointer to the start of the first token in [\a p, \a end), skipping white space and comments, or \a end if there is none
+static inline const char* fgTokenBegin( const char *p, const char *end ) {
+    while( p != end ) {
+        if( *p == '#' ) {
+            const void *eol = memchr( p, '\n', end - p );
+            p = eol ? static_cast<const char *>(eol) : end;
+        } else if( fgSpace( *p ) )
+            ++p;
+        else
+            break;
+    }
+    return p;
+}
+
+
+/// Returns a pointer to the end of the token that starts at \a p
+static inline const char* fgTokenEnd( const char *p, const char *end ) {
+    while( p != end && !fgSpace( *p ) )
+        ++p;
+    return p;
+}
+
+
+/// Skips the next \a n tokens in [\a p, \a end), advancing \a p
+/** \throw INVALID_FACTORGRAPH_FILE if there are less than \a n tokens left; \a what describes the tokens
+ */
+static void fgSkip( const char *&p, const char *end, size_t n, const char *what ) {
+    for( size_t k = 0; k < n; k++ ) {
+        p = fgTokenBegin( p, end );
+        if( p == end )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read " + std::string(what));
+        p = fgTokenEnd( p, end );
+    }
+}
+
+
+/// Reads the next token in [\a p, \a end) as a nonnegative integer, advancing \a p
+/** \throw INVALID_FACTORGRAPH_FILE if this is not possible; \a what describes the token
+ */
+static size_t fgReadSize( const char *&p, const char *end, const char *what ) {
+    const char *begin = fgTokenBegin( p, end );
+    p = fgTokenEnd( begin, end );
+    size_t x;
+    if( !parseNumber( begin, p, x ) )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read " + std::string(what));
+    return x;
+}
+
+
+/// Reads the next token in [\a p, \a end) as a real number, advancing \a p
+/** \throw INVALID_FACTORGRAPH_FILE if this is not possible; \a what describes the token
+ */
+static Real fgReadReal( const char *&p, const char *end, const char *what ) {
+    const char *begin = fgTokenBegin( p, end );
+    p = fgTokenEnd( begin, end );
+    Real x;
+    if( !parseNumber( begin, p, x ) )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read " + std::string(what));
+    return x;
+}
+
+
+/// Parses the factor block that starts at \a p into \a f
+static void fgReadFactor( const char *p, const char *end, Factor &f ) {
+    size_t nr_members = fgReadSize( p, end, "number of variables of factor" );
+    vector<size_t> labels( nr_members );
+    for( size_t mi = 0; mi < nr_members; mi++ )
+        labels[mi] = fgReadSize( p, end, "variable label" );
+    vector<Var> Ivars;
+    Ivars.reserve( nr_members );
+    for( size_t mi = 0; mi < nr_members; mi++ )
+        Ivars.push_back( Var( labels[mi], fgReadSize( p, end, "variable dimension" ) ) );
+
+    // check whether the dimensions of variables that occur more than once are consistent
+    bool ordered = true;
+    for( size_t mi = 1; mi < nr_members; mi++ )
+        if( labels[mi] <= labels[mi-1] )
+            ordered = false;
+    if( !ordered )
+        for( size_t mi = 0; mi < nr_members; mi++ )
+            for( size_t mj = 0; mj < mi; mj++ )
+                if( labels[mi] == labels[mj] && Ivars[mi].states() != Ivars[mj].states() )
+                    DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Variable with label " + boost::lexical_cast<string>(labels[mi]) + " has inconsistent dimensions.");
+
+    f.vars() = VarSet( Ivars.begin(), Ivars.end(), Ivars.size() );
+    f.p().resize( BigInt_size_t( f.vars().nrStates() ) );
+    f.fill( (Real)0 );
+
+    // calculate permutation object (not needed if the variables are ordered as in the internal representation)
+    Permute permindex;
+    if( !ordered )
+        permindex = Permute( Ivars );
+
+    // read values and store them, but permute indices first according to internal representation
+    size_t nr_nonzeros = fgReadSize( p, end, "number of nonzero factor entries" );
+    for( size_t k = 0; k < nr_nonzeros; k++ ) {
+        size_t li = fgReadSize( p, end, "factor entry index" );
+        if( li >= f.nrStates() )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Factor entry index " + boost::lexical_cast<string>(li) + " out of range");
+        f.set( ordered ? li : permindex.convertLinearIndex( li ), fgReadReal( p, end, "factor entry value" ) );
+    }
+}
+
+
+void FactorGraph::parseFg( const char *begin, const char *end ) {
+    // Scan the structure of the file to find the start of each factor block,
+    // without parsing the variables and values
+    const char *p = begin;
+    size_t nr_Factors = fgReadSize( p, end, "number of factors" );
+    while( p != end && *p != '\n' && fgSpace( *p ) )
+        ++p;
+    if( p != end && *p != '\n' )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Expecting empty line");
+    vector<const char *> blocks;
+    blocks.reserve( std::min( nr_Factors, (size_t)(end - begin) ) );
+    for( size_t I = 0; I < nr_Factors; I++ ) {
+        blocks.push_back( fgTokenBegin( p, end ) );
+        size_t nr_members = fgReadSize( p, end, "number of variables of factor" );
+        fgSkip( p, end, 2 * nr_members, "variables of factor" );
+        size_t nr_nonzeros = fgReadSize( p, end, "number of nonzero factor entries" );
+        fgSkip( p, end, 2 * nr_nonzeros, "factor entries" );
+    }
+
+    // Parse the factor blocks concurrently; if there are invalid blocks, the first one is reported
+    vector<Factor> facs( nr_Factors );
+    vector<Exception> errors;
+    size_t errorFactor = nr_Factors;
+    DAI_OMP(parallel for schedule(dynamic,64))
+    for( size_t I = 0; I < nr_Factors; I++ ) {
+        try {
+            fgReadFactor( blocks[I], end, facs[I] );
+        } catch( Exception &e ) {
+            DAI_OMP(critical)
+            if( I < errorFactor ) {
+                errorFactor = I;
+                errors.assign( 1, e );
+            }
+        }
+    }
+    if( errors.size() )
+        throw errors.front();
+
+    // collect the variables and check whether their dimensions are consistent
+    hash_map<size_t, size_t> vardims;
+    vector<Var> vars;
+    size_t nrEdges = 0;
+    for( size_t I = 0; I < nr_Factors; I++ ) {
+        const VarSet &ns = facs[I].vars();
+        for( VarSet::const_iterator n = ns.begin(); n != ns.end(); n++ ) {
+            hash_map<size_t, size_t>::const_iterator vdi = vardims.find( n->label() );
+            if( vdi == vardims.end() ) {
+                vardims[n->label()] = n->states();
+                vars.push_back( *n );
+            } else if( vdi->second != n->states() )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Variable with label " + boost::lexical_cast<string>(n->label()) + " has inconsistent dimensions.");
+        }
+        nrEdges += ns.size();
+    }
+    sort( vars.begin(), vars.end() );
+
+    // replace the factor graph, without copying the factors
+    _factors.swap( facs );
+    _vars.swap( vars );
+    _backup.clear();
+    _backupLevels.clear();
+    constructGraph( nrEdges );
+}
+
+
 VarSet FactorGraph::Delta( size_t i ) const {
     // calculate Markov Blanket
     VarSet Del;
@@ -228,24 +407,168 @@ void FactorGraph::makeCavity( size_t i, bool backup ) {
 }
 
 
+/// Identifies binary factor graph files
+static const char FGB_MAGIC[8] = {'l','i','b','D','A','I','f','g'};
+/// Version of the binary factor graph file format
+static const boost::uint64_t FGB_VERSION = 1;
+/// Used to check that a binary factor graph file has the native byte order
+static const boost::uint64_t FGB_BYTE_ORDER = 0x0102030405060708ULL;
+/// Number of words in the header of a binary factor graph file
+static const size_t FGB_HEADER_WORDS = 7;
+/// The factor tables in a binary factor graph file start at a multiple of this number of words (64 bytes)
+static const size_t FGB_TABLE_ALIGNMENT = 8;
+
+
+/// Returns whether \a filename has the extension of binary factor graph files (.fgb)
+static bool fgbFilename( const char *filename ) {
+    size_t len = strlen( filename );
+    return len >= 4 && strcmp( filename + len - 4, ".fgb" ) == 0;
+}
+
+
+/// Returns the offset (in words) of the factor tables in a binary factor graph file
+static size_t fgbTableOffset( size_t nrVars, size_t nrFactors, size_t nrMembers ) {
+    size_t words = FGB_HEADER_WORDS + 2 * nrVars + nrFactors + nrMembers;
+    return (words + FGB_TABLE_ALIGNMENT - 1) / FGB_TABLE_ALIGNMENT * FGB_TABLE_ALIGNMENT;
+}
+
+
+void FactorGraph::loadFgb( const char *data, size_t size ) {
+    const boost::uint64_t *header = reinterpret_cast<const boost::uint64_t *>( data );
+    if( size < FGB_HEADER_WORDS * 8 || memcmp( data, FGB_MAGIC, 8 ) != 0 )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Not a binary factor graph file");
+    if( header[1] != FGB_VERSION )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Unsupported version " + boost::lexical_cast<string>(header[1]));
+    if( header[2] != FGB_BYTE_ORDER )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Incompatible byte order");
+    size_t nrVars = header[3];
+    size_t nrFactors = header[4];
+    size_t nrMembers = header[5];
+    size_t nrEntries = header[6];
+    size_t maxWords = size / 8 - FGB_HEADER_WORDS;
+    if( nrVars > maxWords / 2 || nrFactors > maxWords - 2 * nrVars || nrMembers > maxWords - 2 * nrVars - nrFactors )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"File too short");
+    size_t tableOffset = fgbTableOffset( nrVars, nrFactors, nrMembers );
+    if( tableOffset > size / 8 || nrEntries > size / 8 - tableOffset )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"File too short");
+
+    // read the variable table
+    const boost::uint64_t *varWords = header + FGB_HEADER_WORDS;
+    vector<Var> vars;
+    vars.reserve( nrVars );
+    hash_map<size_t, size_t> labels;
+    for( size_t i = 0; i < nrVars; i++, varWords += 2 ) {
+        if( varWords[1] == 0 || !labels.insert( make_pair( varWords[0], i ) ).second )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Invalid description of variable " + boost::lexical_cast<string>(varWords[0]));
+        vars.push_back( Var( varWords[0], varWords[1] ) );
+    }
+
+    // check the factor descriptors and find the start of the members and table of each factor
+    const boost::uint64_t *sizes = varWords;
+    const boost::uint64_t *members = sizes + nrFactors;
+    vector<size_t> firstMember( nrFactors ), firstEntry( nrFactors );
+    size_t m = 0, e = 0;
+    for( size_t I = 0; I < nrFactors; I++ ) {
+        firstMember[I] = m;
+        firstEntry[I] = e;
+        if( sizes[I] > nrMembers - m )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Invalid description of factor " + boost::lexical_cast<string>(I));
+        size_t states = 1;
+        for( size_t k = m; k < m + sizes[I]; k++ ) {
+            // the variables should be ordered by label, and the table should fit
+            if( members[k] >= nrVars || (k > m && vars[members[k]].label() <= vars[members[k-1]].label())
+                || vars[members[k]].states() > (nrEntries - e) / states )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Invalid description of factor " + boost::lexical_cast<string>(I));
+            states *= vars[members[k]].states();
+        }
+        if( states > nrEntries - e )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Invalid description of factor " + boost::lexical_cast<string>(I));
+        m += sizes[I];
+        e += states;
+    }
+    if( m != nrMembers || e != nrEntries )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Inconsistent number of variables or entries of factors");
+
+    // construct the factors concurrently, copying their tables
+    const Real *tables = reinterpret_cast<const Real *>( data ) + tableOffset;
+    vector<Factor> facs( nrFactors );
+    DAI_OMP(parallel for schedule(dynamic,64))
+    for( size_t I = 0; I < nrFactors; I++ ) {
+        vector<Var> Ivars;
+        Ivars.reserve( sizes[I] );
+        for( size_t k = firstMember[I]; k < firstMember[I] + sizes[I]; k++ )
+            Ivars.push_back( vars[members[k]] );
+        facs[I].vars() = VarSet( Ivars.begin(), Ivars.end(), Ivars.size() );
+        size_t nrStates = (I + 1 < nrFactors ? firstEntry[I+1] : nrEntries) - firstEntry[I];
+        facs[I].p().p().assign( tables + firstEntry[I], tables + firstEntry[I] + nrStates );
+    }
+
+    // replace the factor graph, without copying the factors
+    _factors.swap( facs );
+    _vars.swap( vars );
+    _backup.clear();
+    _backupLevels.clear();
+    constructGraph( nrMembers );
+}
+
+
+void FactorGraph::writeFgb( std::ostream &os ) const {
+    size_t nrMembers = 0, nrEntries = 0;
+    for( size_t I = 0; I < nrFactors(); I++ ) {
+        nrMembers += factor(I).vars().size();
+        nrEntries += factor(I).nrStates();
+    }
+
+    vector<boost::uint64_t> header;
+    header.reserve( fgbTableOffset( nrVars(), nrFactors(), nrMembers ) );
+    boost::uint64_t magic;
+    memcpy( &magic, FGB_MAGIC, 8 );
+    header.push_back( magic );
+    header.push_back( FGB_VERSION );
+    header.push_back( FGB_BYTE_ORDER );
+    header.push_back( nrVars() );
+    header.push_back( nrFactors() );
+    header.push_back( nrMembers );
+    header.push_back( nrEntries );
+    for( size_t i = 0; i < nrVars(); i++ ) {
+        header.push_back( var(i).label() );
+        header.push_back( var(i).states() );
+    }
+    for( size_t I = 0; I < nrFactors(); I++ )
+        header.push_back( factor(I).vars().size() );
+    for( size_t I = 0; I < nrFactors(); I++ )
+        for( VarSet::const_iterator n = factor(I).vars().begin(); n != factor(I).vars().end(); n++ )
+            header.push_back( findVar( *n ) );
+    header.resize( fgbTableOffset( nrVars(), nrFactors(), nrMembers ), 0 );
+    os.write( reinterpret_cast<const char *>( &(header[0]) ), header.size() * sizeof(boost::uint64_t) );
+    for( size_t I = 0; I < nrFactors(); I++ )
+        os.write( reinterpret_cast<const char *>( &(factor(I).p().p()[0]) ), factor(I).nrStates() * sizeof(Real) );
+}
+
+
 void FactorGraph::ReadFromFile( const char *filename ) {
-    ifstream infile;
-    infile.open( filename );
-    if( infile.is_open() ) {
-        infile >> *this;
-        infile.close();
-    } else
-        DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+    MappedFile file( filename );
+    if( fgbFilename( filename ) )
+        loadFgb( file.data(), file.size() );
+    else
+        parseFg( file.data(), file.data() + file.size() );
 }
 
 
 void FactorGraph::WriteToFile( const char *filename, size_t precision ) const {
+    bool binary = fgbFilename( filename );
     ofstream outfile;
-    outfile.open( filename );
+    outfile.open( filename, binary ? ios::out | ios::binary : ios::out );
     if( outfile.is_open() ) {
-        outfile.precision( precision );
-        outfile << *this;
+        if( binary )
+            writeFgb( outfile );
+        else {
+            outfile.precision( precision );
+            outfile << *this;
+        }
         outfile.close();
+        if( outfile.fail() )
+            DAI_THROWE(CANNOT_WRITE_FILE,"Cannot write to file " + std::string(filename));
     } else
         DAI_THROWE(CANNOT_WRITE_FILE,"Cannot write to file " + std::string(filename));
 }
@@ -397,23 +720,38 @@ void FactorGraph::clampFactor( size_t I, const vector<size_t> &is, bool backup )
 
 
 void FactorGraph::backupFactor( size_t I ) {
-    map<size_t,Factor>::iterator it = _backup.find( I );
-    if( it != _backup.end() )
-        DAI_THROW(MULTIPLE_UNDO);
-    _backup[I] = factor(I);
+    map<size_t,Factor> &backup = currentBackups();
+    map<size_t,Factor>::iterator it = backup.find( I );
+    if( it != backup.end() ) {
+        // at a nested level, only the oldest content of a factor has to be restored
+        if( _backupLevels.empty() )
+            DAI_THROW(MULTIPLE_UNDO);
+    } else
+        backup[I] = factor(I);
 }
 
 
 void FactorGraph::restoreFactor( size_t I ) {
-    map<size_t,Factor>::iterator it = _backup.find( I );
-    if( it != _backup.end() ) {
+    map<size_t,Factor> &backup = currentBackups();
+    map<size_t,Factor>::iterator it = backup.find( I );
+    if( it != backup.end() ) {
         setFactor(I, it->second);
-        _backup.erase(it);
+        backup.erase(it);
     } else
         DAI_THROW(OBJECT_NOT_FOUND);
 }
 
 
+void FactorGraph::popBackups() {
+    if( _backupLevels.empty() )
+        DAI_THROW(OBJECT_NOT_FOUND);
+    map<size_t,Factor> facs;
+    facs.swap( _backupLevels.back() );
+    _backupLevels.pop_back();
+    setFactors( facs );
+}
+
+
 void FactorGraph::backupFactors( const VarSet &ns ) {
     for( size_t I = 0; I < nrFactors(); I++ )
         if( factor(I).vars().intersects( ns ) )
@@ -422,11 +760,12 @@ void FactorGraph::backupFactors( const VarSet &ns ) {
 
 
 void FactorGraph::restoreFactors( const VarSet &ns ) {
+    map<size_t,Factor> &backup = currentBackups();
     map<size_t,Factor> facs;
-    for( map<size_t,Factor>::iterator uI = _backup.begin(); uI != _backup.end(); ) {
+    for( map<size_t,Factor>::iterator uI = backup.begin(); uI != backup.end(); ) {
         if( factor(uI->first).vars().intersects( ns ) ) {
             facs.insert( *uI );
-            _backup.erase(uI++);
+            backup.erase(uI++);
         } else
             uI++;
     }
@@ -435,8 +774,9 @@ void FactorGraph::restoreFactors( const VarSet &ns ) {
 
 
 void FactorGraph::restoreFactors() {
-    setFactors( _backup );
-    _backup.clear();
+    map<size_t,Factor> &backup = currentBackups();
+    setFactors( backup );
+    backup.clear();
 }
 
 
@@ -7,6 +7,7 @@
 
 
 #include <map>
+#include <algorithm>
 #include <dai/hak.h>
 #include <dai/util.h>
 #include <dai/exceptions.h>
@@ -62,6 +63,14 @@ void HAK::setProperties( const PropertySet &opts ) {
         props.loopdepth = opts.getStringAs<size_t>("loopdepth");
     else
         DAI_ASSERT( props.clusters != Properties::ClustersType::LOOP );
+    if( opts.hasKey("maxloops") )
+        props.maxloops = opts.getStringAs<size_t>("maxloops");
+    else
+        props.maxloops = 0;
+    if( opts.hasKey("maxlooptime") )
+        props.maxlooptime = opts.getStringAs<Real>("maxlooptime");
+    else
+        props.maxlooptime = INFINITY;
     if( opts.hasKey("damping") )
         props.damping = opts.getStringAs<Real>("damping");
     else
@@ -70,6 +79,10 @@ void HAK::setProperties( const PropertySet &opts ) {
         props.init = opts.getStringAs<Properties::InitType>("init");
     else
         props.init = Properties::InitType::UNIFORM;
+    if( opts.hasKey("updates") )
+        props.updates = opts.getStringAs<Properties::UpdateType>("updates");
+    else
+        props.updates = Properties::UpdateType::SEQFIX;
 }
 
 
@@ -83,7 +96,10 @@ PropertySet HAK::getProperties() const {
     opts.set( "clusters", props.clusters );
     opts.set( "init", props.init );
     opts.set( "loopdepth", props.loopdepth );
+    opts.set( "maxloops", props.maxloops );
+    opts.set( "maxlooptime", props.maxlooptime );
     opts.set( "damping", props.damping );
+    opts.set( "updates", props.updates );
     return opts;
 }
 
@@ -99,7 +115,10 @@ string HAK::printProperties() const {
     s << "clusters=" << props.clusters << ",";
     s << "init=" << props.init << ",";
     s << "loopdepth=" << props.loopdepth << ",";
-    s << "damping=" << props.damping << "]";
+    s << "maxloops=" << props.maxloops << ",";
+    s << "maxlooptime=" << props.maxlooptime << ",";
+    s << "damping=" << props.damping << ",";
+    s << "updates=" << props.updates << "]";
     return s.str();
 }
 
@@ -138,28 +157,240 @@ void HAK::construct() {
             _muba[alpha].push_back( Factor( IR(beta) ) );
         }
     }
+
+    // Create index cache
+    if( props.verbose >= 3 )
+        cerr << "Constructing index cache" << endl;
+    _indices.clear();
+    _indices.reserve( nrORs() );
+    for( size_t alpha = 0; alpha < nrORs(); alpha++ ) {
+        _indices.push_back( vector<ind_t>() );
+        _indices[alpha].reserve( nbOR(alpha).size() );
+        bforeach( const Neighbor &beta, nbOR(alpha) ) {
+            ind_t ind;
+            ind.reserve( _Qa[alpha].nrStates() );
+            for( IndexFor k( IR(beta), OR(alpha).vars() ); k.valid(); ++k )
+                ind.push_back( k );
+            _indices[alpha].push_back( ind );
+        }
+    }
+
+    // Greedily color the inner regions such that inner regions with the same color have no outer regions in common
+    if( props.verbose >= 3 )
+        cerr << "Coloring inner regions" << endl;
+    _IRcolors.clear();
+    vector<size_t> color( nrIRs(), -1 );
+    vector<size_t> forbidden;
+    for( size_t beta = 0; beta < nrIRs(); beta++ ) {
+        forbidden.clear();
+        bforeach( const Neighbor &alpha, nbIR(beta) )
+            bforeach( const Neighbor &gamma, nbOR(alpha) )
+                if( color[gamma] != -1UL )
+                    forbidden.push_back( color[gamma] );
+        sort( forbidden.begin(), forbidden.end() );
+        size_t c = 0;
+        for( vector<size_t>::const_iterator f = forbidden.begin(); f != forbidden.end() && *f <= c; f++ )
+            if( *f == c )
+                c++;
+        color[beta] = c;
+        if( c == _IRcolors.size() )
+            _IRcolors.push_back( vector<size_t>() );
+        _IRcolors[c].push_back( beta );
+    }
+
+    // For each variable and factor, find the region whose belief is marginalized by belief(),
+    // i.e., the first inner region containing it, or else the first outer region containing it
+    if( props.verbose >= 3 )
+        cerr << "Finding belief regions" << endl;
+    vector<vector<size_t> > var2regions( nrVars() );
+    for( size_t beta = 0; beta < nrIRs(); beta++ )
+        bforeach( const Var &v, IR(beta) )
+            var2regions[findVar(v)].push_back( beta );
+    for( size_t alpha = 0; alpha < nrORs(); alpha++ )
+        bforeach( const Var &v, OR(alpha).vars() )
+            var2regions[findVar(v)].push_back( nrIRs() + alpha );
+    _beliefRegionV.assign( nrVars(), -1 );
+    for( size_t i = 0; i < nrVars(); i++ )
+        if( var2regions[i].size() )
+            _beliefRegionV[i] = var2regions[i].front();
+    _beliefRegionF.assign( nrFactors(), -1 );
+    for( size_t I = 0; I < nrFactors(); I++ ) {
+        const VarSet &ns = factor(I).vars();
+        if( ns.size() == 0 ) {
+            if( nrIRs() + nrORs() )
+                _beliefRegionF[I] = 0;
+        } else {
+            const vector<size_t> &cand = var2regions[findVar( *ns.begin() )];
+            for( size_t k = 0; k < cand.size(); k++ ) {
+                size_t r = cand[k];
+                if( (r < nrIRs() ? (const VarSet &)IR(r) : OR(r - nrIRs()).vars()) >> ns ) {
+                    _beliefRegionF[I] = r;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Allocate workspace
+    _oldBeliefsV.clear();
+    _oldBeliefsV.reserve( nrVars() );
+    for( size_t i = 0; i < nrVars(); i++ )
+        _oldBeliefsV.push_back( Factor( var(i) ) );
+    _oldBeliefsF.clear();
+    _oldBeliefsF.reserve( nrFactors() );
+    for( size_t I = 0; I < nrFactors(); I++ )
+        _oldBeliefsF.push_back( Factor( factor(I).vars() ) );
 }
 
 
-HAK::HAK( const RegionGraph &rg, const PropertySet &opts ) : DAIAlgRG(rg), _Qa(), _Qb(), _muab(), _muba(), _maxdiff(0.0), _iters(0U), props() {
+HAK::HAK( const RegionGraph &rg, const PropertySet &opts ) : DAIAlgRG(rg), _Qa(), _Qb(), _muab(), _muba(), _indices(), _IRcolors(), _beliefRegionV(), _beliefRegionF(), _oldBeliefsV(), _oldBeliefsF(), _maxdiff(0.0), _iters(0U), props() {
     setProperties( opts );
 
     construct();
 }
 
 
-void HAK::findLoopClusters( const FactorGraph & fg, std::set<VarSet> &allcl, VarSet newcl, const Var & root, size_t length, VarSet vars ) {
-    for( VarSet::const_iterator in = vars.begin(); in != vars.end(); in++ ) {
-        VarSet ind = fg.delta( fg.findVar( *in ) );
-        if( (newcl.size()) >= 2 && ind.contains( root ) )
-            allcl.insert( newcl | *in );
-        else if( length > 1 )
-            findLoopClusters( fg, allcl, newcl | *in, root, length - 1, ind / newcl );
+vector<VarSet> HAK::findLoopClusters( const FactorGraph & fg ) const {
+    size_t N = fg.nrVars();
+    vector<VarSet> result;
+    if( props.loopdepth < 3 )
+        return result;
+
+    // Construct the Markov graph in compressed sparse row format:
+    // the neighbors of variable i are nbList[nbStart[i]], ..., nbList[nbStart[i+1]-1] (in ascending order)
+    vector<size_t> nbStart( N + 1, 0 );
+    vector<size_t> nbList;
+    vector<size_t> nbs;
+    for( size_t i = 0; i < N; i++ ) {
+        nbs.clear();
+        bforeach( const Neighbor &I, fg.nbV(i) )
+            bforeach( const Neighbor &j, fg.nbF(I) )
+                if( j != i )
+                    nbs.push_back( j );
+        sort( nbs.begin(), nbs.end() );
+        nbs.erase( unique( nbs.begin(), nbs.end() ), nbs.end() );
+        nbList.insert( nbList.end(), nbs.begin(), nbs.end() );
+        nbStart[i+1] = nbList.size();
     }
+
+    double tic = toc();
+    bool aborted = false;
+    size_t nrFound = 0;
+    vector<vector<size_t> > clusters;
+    DAI_OMP(parallel)
+    {
+        // Thread-local workspace
+        vector<char> onPath( N, 0 );
+        vector<char> nbRoot( N, 0 );
+        vector<size_t> path, pos, cl;
+        vector<vector<size_t> > rootClusters, myClusters;
+
+        DAI_OMP(for schedule(dynamic))
+        for( size_t root = 0; root < N; root++ ) {
+            bool stop;
+            DAI_OMP(atomic read)
+            stop = aborted;
+            if( stop )
+                continue;
+
+            for( size_t k = nbStart[root]; k < nbStart[root+1]; k++ )
+                nbRoot[nbList[k]] = 1;
+
+            // Depth-first search for paths root, v_1, ..., v_n with root < v_k;
+            // pos.back() is the position in nbList of the next neighbor of path.back() to try
+            rootClusters.clear();
+            path.assign( 1, root );
+            pos.assign( 1, upper_bound( nbList.begin() + nbStart[root], nbList.begin() + nbStart[root+1], root ) - nbList.begin() );
+            onPath[root] = 1;
+            for( size_t steps = 0; !path.empty(); steps++ ) {
+                size_t u = path.back();
+                if( pos.back() == nbStart[u+1] ) {
+                    // all neighbors of u have been tried
+                    onPath[u] = 0;
+                    path.pop_back();
+                    pos.pop_back();
+                    continue;
+                }
+                size_t v = nbList[pos.back()++];
+                if( v <= root || onPath[v] )
+                    continue;
+
+                // root, v_1, ..., v_n, v, root is a loop; it is recorded only if v_1 < v,
+                // such that it is not found again when traversing it in the other direction
+                if( path.size() >= 2 && nbRoot[v] && path[1] < v ) {
+                    cl = path;
+                    cl.push_back( v );
+                    sort( cl.begin(), cl.end() );
+                    // check whether some variable has exactly two neighbors in the cluster
+                    bool accept = false;
+                    for( size_t a = 0; a < cl.size() && !accept; a++ ) {
+                        size_t nrNbs = 0;
+                        for( size_t b = 0; b < cl.size(); b++ )
+                            if( binary_search( nbList.begin() + nbStart[cl[a]], nbList.begin() + nbStart[cl[a]+1], cl[b] ) )
+                                nrNbs++;
+                        if( nrNbs == 2 )
+                            accept = true;
+                    }
+                    if( accept )
+                        rootClusters.push_back( cl );
+                }
+
+                // extend the path with v
+                if( path.size() + 1 < props.loopdepth ) {
+                    path.push_back( v );
+                    pos.push_back( upper_bound( nbList.begin() + nbStart[v], nbList.begin() + nbStart[v+1], root ) - nbList.begin() );
+                    onPath[v] = 1;
+                }
+
+                // check time budget
+                if( (steps % 4096) == 0 && (toc() - tic) > props.maxlooptime ) {
+                    DAI_OMP(atomic write)
+                    aborted = true;
+                    for( size_t k = 0; k < path.size(); k++ )
+                        onPath[path[k]] = 0;
+                    path.clear();
+                }
+            }
+
+            for( size_t k = nbStart[root]; k < nbStart[root+1]; k++ )
+                nbRoot[nbList[k]] = 0;
+
+            // Different loops through the same variables result in the same cluster,
+            // but these loops all have the same root, so it suffices to remove duplicates here
+            sort( rootClusters.begin(), rootClusters.end() );
+            rootClusters.erase( unique( rootClusters.begin(), rootClusters.end() ), rootClusters.end() );
+            myClusters.insert( myClusters.end(), rootClusters.begin(), rootClusters.end() );
+
+            // check memory budget
+            size_t found;
+            DAI_OMP(atomic capture)
+            found = nrFound += rootClusters.size();
+            if( props.maxloops && found >= props.maxloops ) {
+                DAI_OMP(atomic write)
+                aborted = true;
+            }
+        }
+
+        DAI_OMP(critical)
+        clusters.insert( clusters.end(), myClusters.begin(), myClusters.end() );
+    }
+
+    if( aborted && props.verbose >= 1 )
+        cerr << name() << "::findLoopClusters:  WARNING: search for loop clusters aborted after " << toc() - tic << " seconds and " << clusters.size() << " loop clusters" << endl;
+
+    result.reserve( clusters.size() );
+    for( vector<vector<size_t> >::const_iterator c = clusters.begin(); c != clusters.end(); c++ ) {
+        VarSet vs;
+        for( vector<size_t>::const_iterator i = c->begin(); i != c->end(); i++ )
+            vs |= fg.var(*i);
+        result.push_back( vs );
+    }
+    sort( result.begin(), result.end() );
+    return result;
 }
 
 
-HAK::HAK(const FactorGraph & fg, const PropertySet &opts) : DAIAlgRG(), _Qa(), _Qb(), _muab(), _muba(), _maxdiff(0.0), _iters(0U), props() {
+HAK::HAK(const FactorGraph & fg, const PropertySet &opts) : DAIAlgRG(), _Qa(), _Qb(), _muab(), _muba(), _indices(), _IRcolors(), _beliefRegionV(), _beliefRegionF(), _oldBeliefsV(), _oldBeliefsF(), _maxdiff(0.0), _iters(0U), props() {
     setProperties( opts );
 
     if( props.verbose >= 3 )
@@ -176,18 +407,12 @@ HAK::HAK(const FactorGraph & fg, const PropertySet &opts) : DAIAlgRG(), _Qa(), _
         constructCVM( fg, cl );
     } else if( props.clusters == Properties::ClustersType::LOOP ) {
         cl = fg.maximalFactorDomains();
-        set<VarSet> scl;
         if( props.verbose >= 2 )
             cerr << "Searching loops...";
-        for( size_t i0 = 0; i0 < fg.nrVars(); i0++ ) {
-            VarSet i0d = fg.delta(i0);
-            if( props.loopdepth > 1 )
-                findLoopClusters( fg, scl, fg.var(i0), fg.var(i0), props.loopdepth - 1, fg.delta(i0) );
-        }
+        vector<VarSet> scl = findLoopClusters( fg );
         if( props.verbose >= 2 )
-            cerr << "done" << endl;
-        for( set<VarSet>::const_iterator c = scl.begin(); c != scl.end(); c++ )
-            cl.push_back(*c);
+            cerr << "done (" << scl.size() << " loop clusters)" << endl;
+        cl.insert( cl.end(), scl.begin(), scl.end() );
         if( props.verbose >= 3 ) {
             cerr << name() << " uses the following clusters: " << endl;
             for( vector<VarSet>::const_iterator cli = cl.begin(); cli != cl.end(); cli++ )
@@ -324,6 +549,94 @@ void HAK::init() {
 }
 
 
+bool HAK::updateInnerRegion( size_t beta ) {
+    bforeach( const Neighbor &alpha, nbIR(beta) ) {
+        size_t _beta = alpha.dual;
+        // Marginalize the outer region belief onto beta, using the cached indices
+        // ind is the precalculated IndexFor(beta,alpha) i.e. to x_alpha == k corresponds x_beta == ind[k]
+        const ind_t &ind = _indices[alpha][_beta];
+        const Prob &Qa = _Qa[alpha].p();
+        Prob marg( muab(alpha,_beta).nrStates(), 0.0 );
+        for( size_t k = 0; k < Qa.size(); k++ )
+            marg.set( ind[k], marg[ind[k]] + Qa[k] );
+        marg.normalize();
+        muab( alpha, _beta ).p() = marg / muba(alpha,_beta).p();
+        /* TODO: INVESTIGATE THIS PROBLEM
+         *
+         * In some cases, the muab's can have very large entries because the muba's have very
+         * small entries. This may cause NANs later on (e.g., multiplying large quantities may
+         * result in +inf; normalization then tries to calculate inf / inf which is NAN).
+         * A fix of this problem would consist in normalizing the messages muab.
+         * However, it is not obvious whether this is a real solution, because it has a
+         * negative performance impact and the NAN's seem to be a symptom of a fundamental
+         * numerical unstability.
+         */
+         muab(alpha,_beta).normalize();
+    }
+
+    Factor Qb_new;
+    bforeach( const Neighbor &alpha, nbIR(beta) ) {
+        size_t _beta = alpha.dual;
+        Qb_new *= muab(alpha,_beta) ^ (1 / (nbIR(beta).size() + IR(beta).c()));
+    }
+
+    Qb_new.normalize();
+    if( Qb_new.hasNaNs() ) {
+        // TODO: WHAT TO DO IN THIS CASE?
+        cerr << name() << "::doGBP:  Qb_new has NaNs!" << endl;
+        return false;
+    }
+    /* TODO: WHAT IS THE PURPOSE OF THE FOLLOWING CODE?
+     *
+     *   _Qb[beta] = Qb_new.makeZero(1e-100);
+     */
+
+    if( props.doubleloop || props.damping == 0.0 )
+        _Qb[beta] = Qb_new; // no damping for double loop
+    else
+        _Qb[beta] = (Qb_new^(1.0 - props.damping)) * (_Qb[beta]^props.damping);
+
+    bforeach( const Neighbor &alpha, nbIR(beta) ) {
+        size_t _beta = alpha.dual;
+        muba(alpha,_beta) = _Qb[beta] / muab(alpha,_beta);
+
+        /* TODO: INVESTIGATE WHETHER THIS HACK (INVENTED BY KEES) TO PREVENT NANS MAKES SENSE
+         *
+         *   muba(beta,*alpha).makePositive(1e-100);
+         *
+         */
+
+        // Multiply the outer region factor with all incoming messages, using the cached indices
+        Factor Qa_new = OR(alpha);
+        Prob &prod = Qa_new.p();
+        bforeach( const Neighbor &gamma, nbOR(alpha) ) {
+            const ind_t &ind = _indices[alpha][gamma.iter];
+            const Prob &m = muba(alpha,gamma.iter).p();
+            for( size_t k = 0; k < prod.size(); k++ )
+                prod.set( k, prod[k] * m[ind[k]] );
+        }
+        Qa_new ^= (1.0 / OR(alpha).c());
+        Qa_new.normalize();
+        if( Qa_new.hasNaNs() ) {
+            cerr << name() << "::doGBP:  Qa_new has NaNs!" << endl;
+            return false;
+        }
+        /* TODO: WHAT IS THE PURPOSE OF THE FOLLOWING CODE?
+         *
+         *   _Qb[beta] = Qb_new.makeZero(1e-100);
+         */
+
+        if( props.doubleloop || props.damping == 0.0 )
+            _Qa[alpha] = Qa_new; // no damping for double loop
+        else
+            // FIXME: GEOMETRIC DAMPING IS SLOW!
+            _Qa[alpha] = (Qa_new^(1.0 - props.damping)) * (_Qa[alpha]^props.damping);
+    }
+
+    return true;
+}
+
+
 Real HAK::doGBP() {
     if( props.verbose >= 1 )
         cerr << "Starting " << identify() << "...";
@@ -337,102 +650,35 @@ Real HAK::doGBP() {
         DAI_ASSERT( nbIR(beta).size() + IR(beta).c() != 0.0 );
 
     // Keep old beliefs to check convergence
-    vector<Factor> oldBeliefsV;
-    oldBeliefsV.reserve( nrVars() );
-    for( size_t i = 0; i < nrVars(); i++ )
-        oldBeliefsV.push_back( beliefV(i) );
-    vector<Factor> oldBeliefsF;
-    oldBeliefsF.reserve( nrFactors() );
-    for( size_t I = 0; I < nrFactors(); I++ )
-        oldBeliefsF.push_back( beliefF(I) );
+    updateOldBeliefs( _oldBeliefsV, _oldBeliefsF );
 
     // do several passes over the network until maximum number of iterations has
     // been reached or until the maximum belief difference is smaller than tolerance
     Real maxDiff = INFINITY;
     for( _iters = 0; _iters < props.maxiter && maxDiff > props.tol; _iters++ ) {
-        for( size_t beta = 0; beta < nrIRs(); beta++ ) {
-            bforeach( const Neighbor &alpha, nbIR(beta) ) {
-                size_t _beta = alpha.dual;
-                muab( alpha, _beta ) = _Qa[alpha].marginal(IR(beta)) / muba(alpha,_beta);
-                /* TODO: INVESTIGATE THIS PROBLEM
-                 *
-                 * In some cases, the muab's can have very large entries because the muba's have very
-                 * small entries. This may cause NANs later on (e.g., multiplying large quantities may
-                 * result in +inf; normalization then tries to calculate inf / inf which is NAN).
-                 * A fix of this problem would consist in normalizing the messages muab.
-                 * However, it is not obvious whether this is a real solution, because it has a
-                 * negative performance impact and the NAN's seem to be a symptom of a fundamental
-                 * numerical unstability.
-                 */
-                 muab(alpha,_beta).normalize();
-            }
-
-            Factor Qb_new;
-            bforeach( const Neighbor &alpha, nbIR(beta) ) {
-                size_t _beta = alpha.dual;
-                Qb_new *= muab(alpha,_beta) ^ (1 / (nbIR(beta).size() + IR(beta).c()));
-            }
-
-            Qb_new.normalize();
-            if( Qb_new.hasNaNs() ) {
-                // TODO: WHAT TO DO IN THIS CASE?
-                cerr << name() << "::doGBP:  Qb_new has NaNs!" << endl;
-                return 1.0;
-            }
-            /* TODO: WHAT IS THE PURPOSE OF THE FOLLOWING CODE?
-             *
-             *   _Qb[beta] = Qb_new.makeZero(1e-100);
-             */
-
-            if( props.doubleloop || props.damping == 0.0 )
-                _Qb[beta] = Qb_new; // no damping for double loop
-            else
-                _Qb[beta] = (Qb_new^(1.0 - props.damping)) * (_Qb[beta]^props.damping);
-
-            bforeach( const Neighbor &alpha, nbIR(beta) ) {
-                size_t _beta = alpha.dual;
-                muba(alpha,_beta) = _Qb[beta] / muab(alpha,_beta);
-
-                /* TODO: INVESTIGATE WHETHER THIS HACK (INVENTED BY KEES) TO PREVENT NANS MAKES SENSE
-                 *
-                 *   muba(beta,*alpha).makePositive(1e-100);
-                 *
-                 */
-
-                Factor Qa_new = OR(alpha);
-                bforeach( const Neighbor &gamma, nbOR(alpha) )
-                    Qa_new *= muba(alpha,gamma.iter);
-                Qa_new ^= (1.0 / OR(alpha).c());
-                Qa_new.normalize();
-                if( Qa_new.hasNaNs() ) {
-                    cerr << name() << "::doGBP:  Qa_new has NaNs!" << endl;
+        if( props.updates == Properties::UpdateType::SEQFIX ) {
+            for( size_t beta = 0; beta < nrIRs(); beta++ )
+                if( !updateInnerRegion( beta ) )
+                    return 1.0;
+        } else if( props.updates == Properties::UpdateType::COLORED ) {
+            // Inner regions with the same color do not share outer regions, so they can be updated concurrently
+            for( size_t c = 0; c < _IRcolors.size(); c++ ) {
+                const vector<size_t> &group = _IRcolors[c];
+                bool ok = true;
+                DAI_OMP(parallel for schedule(dynamic))
+                for( size_t k = 0; k < group.size(); k++ )
+                    if( !updateInnerRegion( group[k] ) ) {
+                        DAI_OMP(critical)
+                        ok = false;
+                    }
+                if( !ok )
                     return 1.0;
-                }
-                /* TODO: WHAT IS THE PURPOSE OF THE FOLLOWING CODE?
-                 *
-                 *   _Qb[beta] = Qb_new.makeZero(1e-100);
-                 */
-
-                if( props.doubleloop || props.damping == 0.0 )
-                    _Qa[alpha] = Qa_new; // no damping for double loop
-                else
-                    // FIXME: GEOMETRIC DAMPING IS SLOW!
-                _Qa[alpha] = (Qa_new^(1.0 - props.damping)) * (_Qa[alpha]^props.damping);
             }
-        }
+        } else
+            DAI_THROW(UNKNOWN_ENUM_VALUE);
 
         // Calculate new single variable beliefs and compare with old ones
-        maxDiff = -INFINITY;
-        for( size_t i = 0; i < nrVars(); ++i ) {
-            Factor b = beliefV(i);
-            maxDiff = std::max( maxDiff, dist( b, oldBeliefsV[i], DISTLINF ) );
-            oldBeliefsV[i] = b;
-        }
-        for( size_t I = 0; I < nrFactors(); ++I ) {
-            Factor b = beliefF(I);
-            maxDiff = std::max( maxDiff, dist( b, oldBeliefsF[I], DISTLINF ) );
-            oldBeliefsF[I] = b;
-        }
+        maxDiff = updateOldBeliefs( _oldBeliefsV, _oldBeliefsF );
 
         if( props.verbose >= 3 )
             cerr << name() << "::doGBP:  maxdiff " << maxDiff << " after " << _iters+1 << " passes" << endl;
@@ -476,15 +722,21 @@ Real HAK::doDoubleLoop() {
             IR(beta).c() = 0.0;
     }
 
+    // Exponents of the inner region beliefs in the outer region potentials
+    // (only inner regions with negative counting numbers contribute)
+    vector<Real> exponents( nrIRs(), 0.0 );
+    vector<size_t> negIRs;
+    for( size_t beta = 0; beta < nrIRs(); beta++ )
+        if( IR(beta).c() != org_IR_cs[beta] ) {
+            exponents[beta] = (IR(beta).c() - org_IR_cs[beta]) / nbIR(beta).size();
+            negIRs.push_back( beta );
+        }
+    vector<Prob> Qb_pow( nrIRs() );
+
     // Keep old beliefs to check convergence
-    vector<Factor> oldBeliefsV;
-    oldBeliefsV.reserve( nrVars() );
-    for( size_t i = 0; i < nrVars(); i++ )
-        oldBeliefsV.push_back( beliefV(i) );
-    vector<Factor> oldBeliefsF;
-    oldBeliefsF.reserve( nrFactors() );
-    for( size_t I = 0; I < nrFactors(); I++ )
-        oldBeliefsF.push_back( beliefF(I) );
+    vector<Factor> oldBeliefsV( _oldBeliefsV );
+    vector<Factor> oldBeliefsF( _oldBeliefsF );
+    updateOldBeliefs( oldBeliefsV, oldBeliefsF );
 
     size_t outer_maxiter   = props.maxiter;
     Real   outer_tol       = props.tol;
@@ -499,29 +751,31 @@ Real HAK::doDoubleLoop() {
     size_t total_iter = 0;
     Real maxDiff = INFINITY;
     for( outer_iter = 0; outer_iter < outer_maxiter && maxDiff > outer_tol && (toc() - tic) < props.maxtime; outer_iter++ ) {
-        // Calculate new outer regions
+        // Calculate new outer regions, using the cached indices
+        DAI_OMP(parallel for schedule(dynamic))
+        for( size_t k = 0; k < negIRs.size(); k++ ) {
+            size_t beta = negIRs[k];
+            Qb_pow[beta] = _Qb[beta].p() ^ exponents[beta];
+        }
+        DAI_OMP(parallel for schedule(dynamic))
         for( size_t alpha = 0; alpha < nrORs(); alpha++ ) {
             OR(alpha) = org_ORs[alpha];
+            Prob &prod = OR(alpha).p();
             bforeach( const Neighbor &beta, nbOR(alpha) )
-                OR(alpha) *= _Qb[beta] ^ ((IR(beta).c() - org_IR_cs[beta]) / nbIR(beta).size());
+                if( exponents[beta] != 0.0 ) {
+                    const ind_t &ind = _indices[alpha][beta.iter];
+                    const Prob &Qb = Qb_pow[beta];
+                    for( size_t x = 0; x < prod.size(); x++ )
+                        prod.set( x, prod[x] * Qb[ind[x]] );
+                }
         }
 
-        // Inner loop
+        // Inner loop (warm-started from the current messages and beliefs)
         if( isnan( doGBP() ) )
             return 1.0;
 
         // Calculate new single variable beliefs and compare with old ones
-        maxDiff = -INFINITY;
-        for( size_t i = 0; i < nrVars(); ++i ) {
-            Factor b = beliefV(i);
-            maxDiff = std::max( maxDiff, dist( b, oldBeliefsV[i], DISTLINF ) );
-            oldBeliefsV[i] = b;
-        }
-        for( size_t I = 0; I < nrFactors(); ++I ) {
-            Factor b = beliefF(I);
-            maxDiff = std::max( maxDiff, dist( b, oldBeliefsF[I], DISTLINF ) );
-            oldBeliefsF[I] = b;
-        }
+        maxDiff = updateOldBeliefs( oldBeliefsV, oldBeliefsF );
 
         total_iter += Iterations();
 
@@ -588,6 +842,50 @@ Factor HAK::belief( const VarSet &ns ) const {
 }
 
 
+Factor HAK::regionBelief( size_t r, const VarSet &ns ) const {
+    if( r >= nrIRs() + nrORs() )
+        DAI_THROW(BELIEF_NOT_AVAILABLE);
+    if( r < nrIRs() )
+        return _Qb[r].marginal( ns );
+    else
+        return _Qa[r - nrIRs()].marginal( ns );
+}
+
+
+Factor HAK::beliefV( size_t i ) const {
+    return regionBelief( _beliefRegionV[i], var(i) );
+}
+
+
+Factor HAK::beliefF( size_t I ) const {
+    return regionBelief( _beliefRegionF[I], factor(I).vars() );
+}
+
+
+Real HAK::updateOldBeliefs( vector<Factor> &oldBeliefsV, vector<Factor> &oldBeliefsF ) const {
+    Real maxDiff = -INFINITY;
+    DAI_OMP(parallel)
+    {
+        Real myMaxDiff = -INFINITY;
+        DAI_OMP(for schedule(dynamic, 64) nowait)
+        for( size_t i = 0; i < nrVars(); i++ ) {
+            Factor b = beliefV(i);
+            myMaxDiff = std::max( myMaxDiff, dist( b, oldBeliefsV[i], DISTLINF ) );
+            oldBeliefsV[i].p() = b.p();
+        }
+        DAI_OMP(for schedule(dynamic, 64) nowait)
+        for( size_t I = 0; I < nrFactors(); I++ ) {
+            Factor b = beliefF(I);
+            myMaxDiff = std::max( myMaxDiff, dist( b, oldBeliefsF[I], DISTLINF ) );
+            oldBeliefsF[I].p() = b.p();
+        }
+        DAI_OMP(critical)
+        maxDiff = std::max( maxDiff, myMaxDiff );
+    }
+    return maxDiff;
+}
+
+
 vector<Factor> HAK::beliefs() const {
     vector<Factor> result;
     for( size_t beta = 0; beta < nrIRs(); beta++ )
@@ -10,6 +10,7 @@
 #include <dai/alldai.h>
 #include <iostream>
 #include <fstream>
+#include <cstring>
 
 
 namespace dai {
@@ -18,211 +19,289 @@ namespace dai {
 using namespace std;
 
 
+/// Returns whether \a c is a white space character
+static inline bool uaiSpace( char c ) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+/// Returns a pointer to the end of the line that starts at \a p (i.e., to the next newline character, or \a end)
+static inline const char* uaiLineEnd( const char *p, const char *end ) {
+    const void *eol = memchr( p, '\n', end - p );
+    return eol ? static_cast<const char *>(eol) : end;
+}
+
+
+/// Returns the line [\a begin, \a end), without a trailing carriage return (for DOS text files)
+static string uaiLine( const char *begin, const char *end ) {
+    if( begin != end && *(end - 1) == '\r' )
+        end--;
+    return string( begin, end );
+}
+
+
+/// Returns the next token in [\a p, \a end), advancing \a p to its end
+static inline pair<const char *, const char *> uaiToken( const char *&p, const char *end ) {
+    while( p != end && uaiSpace( *p ) )
+        ++p;
+    const char *begin = p;
+    while( p != end && !uaiSpace( *p ) )
+        ++p;
+    return make_pair( begin, p );
+}
+
+
+/// Reads the next token in [\a p, \a end) as a nonnegative integer, advancing \a p; returns \c false if this is not possible
+static inline bool uaiReadSize( const char *&p, const char *end, size_t &x ) {
+    pair<const char *, const char *> token = uaiToken( p, end );
+    return parseNumber( token.first, token.second, x );
+}
+
+
+/// Reads the next token in [\a p, \a end) as a real number, advancing \a p; returns \c false if this is not possible
+static inline bool uaiReadReal( const char *&p, const char *end, Real &x ) {
+    pair<const char *, const char *> token = uaiToken( p, end );
+    return parseNumber( token.first, token.second, x );
+}
+
+
+/// Reads the \a nrValues values of a factor table that starts at \a p, which list the entries of \a f with the last of the variables \a fileVars changing fastest
+/** The values are written directly to the right entries of \a f, by keeping track of the index in the
+ *  libDAI ordering (where the variable with the smallest label changes fastest) using its strides.
+ *  \return \c false if the values cannot be read
+ */
+static bool uaiReadTable( const char *p, const char *end, const vector<Var> &fileVars, size_t nrValues, Factor &f ) {
+    size_t n = fileVars.size();
+    vector<size_t> strides( n, 1 ), counter( n, 0 );
+    for( size_t k = 0; k < n; k++ )
+        for( size_t j = 0; j < n; j++ )
+            if( fileVars[j].label() < fileVars[k].label() )
+                strides[k] *= fileVars[j].states();
+
+    size_t index = 0;
+    for( size_t li = 0; li < nrValues; li++ ) {
+        Real val;
+        if( !uaiReadReal( p, end, val ) )
+            return false;
+        f.set( index, val );
+        // go to the next joint state, in which the last variable changes fastest
+        for( size_t k = n; k-- > 0; ) {
+            index += strides[k];
+            if( ++counter[k] < fileVars[k].states() )
+                break;
+            index -= counter[k] * strides[k];
+            counter[k] = 0;
+        }
+    }
+    return true;
+}
+
+
 void ReadUaiAieFactorGraphFile( const char *filename, size_t verbose, std::vector<Var>& vars, std::vector<Factor>& factors, std::vector<Permute>& permutations ) {
     vars.clear();
     factors.clear();
     permutations.clear();
 
-    // open file
-    ifstream is;
-    is.open( filename );
-    if( is.is_open() ) {
-        size_t nrFacs, nrVars;
-        string line;
-        
-        // read header line
-        getline(is,line);
-        if( is.fail() || line.size() == 0 )
-            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"UAI factor graph file should start with nonempty header line");
-        if( line[line.size() - 1] == '\r' )
-            line.resize( line.size() - 1 ); // for DOS text files
-        if( line != "BAYES" && line != "MARKOV" )
-            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"UAI factor graph file should start with \"BAYES\" or \"MARKOV\"");
-        if( verbose >= 2 )
-            cout << "Reading " << line << " network..." << endl;
+    // map file into memory
+    MappedFile file( filename );
+    const char *p = file.data();
+    const char *end = p + file.size();
+    size_t nrFacs, nrVars;
 
-        // read number of variables
-        is >> nrVars;
-        if( is.fail() )
-            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of variables");
-        if( verbose >= 2 )
-            cout << "Reading " << nrVars << " variables..." << endl;
-
-        // for each variable, read its number of states
-        vars.reserve( nrVars );
-        for( size_t i = 0; i < nrVars; i++ ) {
-            size_t dim;
-            is >> dim;
-            if( is.fail() )
-                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of states of " + toString(i) + "'th variable");
-            vars.push_back( Var( i, dim ) );
-        }
+    // read header line
+    const char *eol = uaiLineEnd( p, end );
+    string line = uaiLine( p, eol );
+    if( line.size() == 0 )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"UAI factor graph file should start with nonempty header line");
+    if( line != "BAYES" && line != "MARKOV" )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"UAI factor graph file should start with \"BAYES\" or \"MARKOV\"");
+    if( verbose >= 2 )
+        cout << "Reading " << line << " network..." << endl;
+    p = eol;
 
-        // read number of factors
-        is >> nrFacs;
-        if( is.fail() )
-            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of factors");
-        if( verbose >= 2 )
-            cout << "Reading " << nrFacs << " factors..." << endl;
-
-        // for each factor, read the variables on which it depends
-        vector<vector<Var> > factorVars;
-        factors.reserve( nrFacs );
-        factorVars.reserve( nrFacs );
-        for( size_t I = 0; I < nrFacs; I++ ) {
-            if( verbose >= 3 )
-                cout << "Reading factor " << I << "..." << endl;
-
-            // read number of variables for factor I
-            size_t I_nrVars;
-            is >> I_nrVars;
-            if( is.fail() )
-                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of variables for " + toString(I) + "'th factor");
-            if( verbose >= 3 )
-                cout << "  which depends on " << I_nrVars << " variables" << endl;
-
-            // read the variable labels
-            vector<long> I_labels;
-            vector<size_t> I_dims;
-            I_labels.reserve( I_nrVars );
-            I_dims.reserve( I_nrVars );
-            factorVars[I].reserve( I_nrVars );
-            for( size_t _i = 0; _i < I_nrVars; _i++ ) {
-                long label;
-                is >> label;
-                if( is.fail() )
-                    DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read variable labels for " + toString(I) + "'th factor");
-                I_labels.push_back( label );
-                I_dims.push_back( vars[label].states() );
-                factorVars[I].push_back( vars[label] );
-            }
-            if( verbose >= 3 )
-                cout << "  labels: " << I_labels << ", dimensions " << I_dims << endl;
+    // read number of variables
+    if( !uaiReadSize( p, end, nrVars ) )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of variables");
+    if( verbose >= 2 )
+        cout << "Reading " << nrVars << " variables..." << endl;
+
+    // for each variable, read its number of states
+    vars.reserve( std::min( nrVars, file.size() ) );
+    for( size_t i = 0; i < nrVars; i++ ) {
+        size_t dim;
+        if( !uaiReadSize( p, end, dim ) )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of states of " + toString(i) + "'th variable");
+        vars.push_back( Var( i, dim ) );
+    }
+
+    // read number of factors
+    if( !uaiReadSize( p, end, nrFacs ) )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of factors");
+    if( verbose >= 2 )
+        cout << "Reading " << nrFacs << " factors..." << endl;
+
+    // for each factor, read the variables on which it depends
+    vector<vector<Var> > factorVars;
+    factorVars.reserve( std::min( nrFacs, file.size() ) );
+    for( size_t I = 0; I < nrFacs; I++ ) {
+        if( verbose >= 3 )
+            cout << "Reading factor " << I << "..." << endl;
+
+        // read number of variables for factor I
+        size_t I_nrVars;
+        if( !uaiReadSize( p, end, I_nrVars ) )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of variables for " + toString(I) + "'th factor");
+        if( verbose >= 3 )
+            cout << "  which depends on " << I_nrVars << " variables" << endl;
 
-            // add the factor and the labels
-            factors.push_back( Factor( VarSet( factorVars[I].begin(), factorVars[I].end(), factorVars[I].size() ), (Real)0 ) );
+        // read the variable labels
+        factorVars.push_back( vector<Var>() );
+        factorVars[I].reserve( std::min( I_nrVars, nrVars ) );
+        for( size_t _i = 0; _i < I_nrVars; _i++ ) {
+            size_t label;
+            if( !uaiReadSize( p, end, label ) )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read variable labels for " + toString(I) + "'th factor");
+            if( label >= nrVars )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Invalid variable label " + toString(label) + " for " + toString(I) + "'th factor");
+            factorVars[I].push_back( vars[label] );
         }
+        if( verbose >= 3 )
+            cout << "  variables: " << factorVars[I] << endl;
+    }
 
-        // for each factor, read its values
-        permutations.reserve( nrFacs );
-        for( size_t I = 0; I < nrFacs; I++ ) {
-            if( verbose >= 3 )
-                cout << "Reading factor " << I << "..." << endl;
+    // find the start of the table of each factor
+    vector<const char *> tables( nrFacs );
+    vector<size_t> nrNonZeros( nrFacs );
+    for( size_t I = 0; I < nrFacs; I++ ) {
+        if( !uaiReadSize( p, end, nrNonZeros[I] ) )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of nonzero factor values for " + toString(I) + "'th factor");
+        tables[I] = p;
+        for( size_t li = 0; li < nrNonZeros[I]; li++ )
+            if( uaiToken( p, end ).first == end )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read factor values of " + toString(I) + "'th factor");
+    }
 
+    // read the factor tables concurrently; if there are invalid factors, the first one is reported
+    factors.resize( nrFacs );
+    permutations.resize( nrFacs );
+    vector<Exception> errors;
+    size_t errorFactor = nrFacs;
+    DAI_OMP(parallel for schedule(dynamic,64))
+    for( size_t I = 0; I < nrFacs; I++ ) {
+        try {
+            Factor &f = factors[I];
+            f.vars() = VarSet( factorVars[I].begin(), factorVars[I].end(), factorVars[I].size() );
+            if( f.vars().size() != factorVars[I].size() )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Variables of " + toString(I) + "'th factor should be different");
+            if( nrNonZeros[I] != f.nrStates() )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Number of factor values of " + toString(I) + "'th factor should be " + toString(f.nrStates()));
+            f.p().resize( f.nrStates() );
+            if( !uaiReadTable( tables[I], end, factorVars[I], nrNonZeros[I], f ) )
+                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read factor values of " + toString(I) + "'th factor");
             // calculate permutation object, reversing the indexing in factorVars[I] first
-            Permute permindex( factorVars[I], true );
-            permutations.push_back( permindex );
-
-            // read factor values
-            size_t nrNonZeros;
-            is >> nrNonZeros;
-            if( is.fail() )
-                DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read number of nonzero factor values for " + toString(I) + "'th factor");
-            if( verbose >= 3 ) 
-                cout << "  number of nonzero values: " << nrNonZeros << endl;
-            DAI_ASSERT( nrNonZeros == factors[I].nrStates() );
-            for( size_t li = 0; li < nrNonZeros; li++ ) {
-                Real val;
-                is >> val;
-                if( is.fail() )
-                    DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cannot read factor values of " + toString(I) + "'th factor");
-                // assign value after calculating its linear index corresponding to the permutation
-                if( verbose >= 4 )
-                    cout << "  " << li << "'th value " << val << " corresponds with index " << permindex.convertLinearIndex(li) << endl;
-                factors[I].set( permindex.convertLinearIndex( li ), val );
+            permutations[I] = Permute( factorVars[I], true );
+        } catch( Exception &e ) {
+            DAI_OMP(critical)
+            if( I < errorFactor ) {
+                errorFactor = I;
+                errors.assign( 1, e );
             }
         }
-        if( verbose >= 3 )
-            cout << "variables:" << vars << endl;
-        if( verbose >= 3 )
-            cout << "factors:" << factors << endl;
+    }
+    if( errors.size() ) {
+        factors.clear();
+        permutations.clear();
+        throw errors.front();
+    }
 
-        // close file
-        is.close();
-    } else
-        DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+    if( verbose >= 4 )
+        for( size_t I = 0; I < nrFacs; I++ )
+            for( size_t li = 0; li < nrNonZeros[I]; li++ )
+                cout << "  " << li << "'th value " << factors[I][permutations[I].convertLinearIndex(li)] << " of factor " << I << " corresponds with index " << permutations[I].convertLinearIndex(li) << endl;
+    if( verbose >= 3 )
+        cout << "variables:" << vars << endl;
+    if( verbose >= 3 )
+        cout << "factors:" << factors << endl;
 }
 
 
-std::vector<std::map<size_t, size_t> > ReadUaiAieEvidenceFile( const char* filename, size_t verbose ) {
-    vector<map<size_t, size_t> > evid;
-
-    // open file
-    ifstream is;
-    string line;
-    is.open( filename );
-    if( is.is_open() ) {
-        // read number of lines
-        getline( is, line );
-        if( is.fail() || line.size() == 0 )
-            DAI_THROWE(INVALID_EVIDENCE_FILE,"Cannot read header line of evidence file");
-        if( line[line.size() - 1] == '\r' )
-            line.resize( line.size() - 1 ); // for DOS text files
-        size_t nrLines = fromString<size_t>( line );
-        if( verbose >= 2 )
-            cout << "Reading " << nrLines << " evidence file lines..." << endl;
-
-        if( nrLines ) {
-            // detect version (pre-2010 or 2010)
-            streampos pos = is.tellg();
-            getline( is, line );
-            if( is.fail() || line.size() == 0 )
-                DAI_THROWE(INVALID_EVIDENCE_FILE,"Cannot read second line of evidence file");
-            if( line[line.size() - 1] == '\r' )
-                line.resize( line.size() - 1 ); // for DOS text files
-            vector<string> cols;
-            cols = tokenizeString( line, false, " \t" );
-            bool oldVersion = true;
-            if( cols.size() % 2 )
-                oldVersion = false;
-            if( verbose >= 2 ) {
-                if( oldVersion )
-                    cout << "Detected old (2006, 2008) evidence file format" << endl;
-                else
-                    cout << "Detected new (2010) evidence file format" << endl;
-            }
-            size_t nrEvid;
-            if( oldVersion ) {
-                nrEvid = 1;
-                is.seekg( 0 );
-            } else {
-                nrEvid = nrLines;
-                is.seekg( pos );
-            }
-                
-            // read all evidence cases
-            if( verbose >= 2 )
-                cout << "Reading " << nrEvid << " evidence cases..." << endl;
-            evid.resize( nrEvid );
-            for( size_t i = 0; i < nrEvid; i++ ) {
-                // read number of variables
-                size_t nrObs;
-                is >> nrObs;
-                if( is.fail() )
-                    DAI_THROWE(INVALID_EVIDENCE_FILE,"Evidence case " + toString(i) + ": Cannot read number of observations");
-                if( verbose >= 2 )
-                    cout << "Evidence case " << i << ": reading " << nrObs << " observations..." << endl;
-
-                // for each observation, read the variable label and the observed value
-                for( size_t j = 0; j < nrObs; j++ ) {
-                    size_t label, val;
-                    is >> label;
-                    if( is.fail() )
-                        DAI_THROWE(INVALID_EVIDENCE_FILE,"Evidence case " + toString(i) + ": Cannot read label for " + toString(j) + "'th observed variable");
-                    is >> val;
-                    if( is.fail() )
-                        DAI_THROWE(INVALID_EVIDENCE_FILE,"Evidence case " + toString(i) + ": Cannot read value of " + toString(j) + "'th observed variable");
-                    if( verbose >= 3 )
-                        cout << "  variable: " << label << ", value: " << val << endl;
-                    evid[i][label] = val;
-                }
-            }
+UaiAieEvidenceReader::UaiAieEvidenceReader( const char *filename, size_t verbose ) : _file( filename ), _pos( _file.data() ), _nrCases( 0 ), _case( 0 ), _verbose( verbose ) {
+    const char *begin = _file.data();
+    const char *end = begin + _file.size();
+
+    // read number of lines
+    const char *eol = uaiLineEnd( begin, end );
+    string line = uaiLine( begin, eol );
+    size_t nrLines;
+    if( line.size() == 0 || !parseNumber( line.data(), line.data() + line.size(), nrLines ) )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Cannot read header line of evidence file");
+    if( verbose >= 2 )
+        cout << "Reading " << nrLines << " evidence file lines..." << endl;
+
+    if( nrLines ) {
+        // detect version (pre-2010 or 2010)
+        const char *second = (eol == end) ? end : eol + 1;
+        line = uaiLine( second, uaiLineEnd( second, end ) );
+        if( line.size() == 0 )
+            DAI_THROWE(INVALID_EVIDENCE_FILE,"Cannot read second line of evidence file");
+        vector<string> cols = tokenizeString( line, false, " \t" );
+        bool oldVersion = true;
+        if( cols.size() % 2 )
+            oldVersion = false;
+        if( verbose >= 2 ) {
+            if( oldVersion )
+                cout << "Detected old (2006, 2008) evidence file format" << endl;
+            else
+                cout << "Detected new (2010) evidence file format" << endl;
+        }
+        if( oldVersion ) {
+            // the file consists of a single evidence case, the header line being its number of observations
+            _nrCases = 1;
+            _pos = begin;
+        } else {
+            _nrCases = nrLines;
+            _pos = second;
         }
+        if( verbose >= 2 )
+            cout << "Reading " << _nrCases << " evidence cases..." << endl;
+    }
+}
+
 
-        // close file
-        is.close();
-    } else
-        DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+bool UaiAieEvidenceReader::next( std::map<size_t, size_t> &evid ) {
+    evid.clear();
+    if( _case == _nrCases )
+        return false;
+    const char *end = _file.data() + _file.size();
+
+    // read number of variables
+    size_t nrObs;
+    if( !uaiReadSize( _pos, end, nrObs ) )
+        DAI_THROWE(INVALID_EVIDENCE_FILE,"Evidence case " + toString(_case) + ": Cannot read number of observations");
+    if( _verbose >= 2 )
+        cout << "Evidence case " << _case << ": reading " << nrObs << " observations..." << endl;
+
+    // for each observation, read the variable label and the observed value
+    for( size_t j = 0; j < nrObs; j++ ) {
+        size_t label, val;
+        if( !uaiReadSize( _pos, end, label ) )
+            DAI_THROWE(INVALID_EVIDENCE_FILE,"Evidence case " + toString(_case) + ": Cannot read label for " + toString(j) + "'th observed variable");
+        if( !uaiReadSize( _pos, end, val ) )
+            DAI_THROWE(INVALID_EVIDENCE_FILE,"Evidence case " + toString(_case) + ": Cannot read value of " + toString(j) + "'th observed variable");
+        if( _verbose >= 3 )
+            cout << "  variable: " << label << ", value: " << val << endl;
+        evid[label] = val;
+    }
+    _case++;
+    return true;
+}
+
+
+std::vector<std::map<size_t, size_t> > ReadUaiAieEvidenceFile( const char* filename, size_t verbose ) {
+    UaiAieEvidenceReader reader( filename, verbose );
+    vector<map<size_t, size_t> > evid( reader.nrCases() );
+    for( size_t i = 0; i < evid.size(); i++ )
+        reader.next( evid[i] );
 
     if( evid.size() == 0 )
         evid.resize( 1 );
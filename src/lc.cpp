@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <map>
 #include <set>
+#include <fstream>
 #include <dai/lc.h>
 #include <dai/util.h>
 #include <dai/alldai.h>
@@ -45,6 +46,10 @@ void LC::setProperties( const PropertySet &opts ) {
         props.damping = opts.getStringAs<Real>("damping");
     else
         props.damping = 0.0;
+    if( opts.hasKey("cavfile") )
+        props.cavfile = opts.getStringAs<string>("cavfile");
+    else
+        props.cavfile = "";
 }
 
 
@@ -59,6 +64,7 @@ PropertySet LC::getProperties() const {
     opts.set( "cavaiopts", props.cavaiopts );
     opts.set( "reinit", props.reinit );
     opts.set( "damping", props.damping );
+    opts.set( "cavfile", props.cavfile );
     return opts;
 }
 
@@ -74,12 +80,13 @@ string LC::printProperties() const {
     s << "cavainame=" << props.cavainame << ",";
     s << "cavaiopts=" << props.cavaiopts << ",";
     s << "reinit=" << props.reinit << ",";
-    s << "damping=" << props.damping << "]";
+    s << "damping=" << props.damping << ",";
+    s << "cavfile=" << props.cavfile << "]";
     return s.str();
 }
 
 
-LC::LC( const FactorGraph & fg, const PropertySet &opts ) : DAIAlgFG(fg), _pancakes(), _cavitydists(), _phis(), _beliefs(), _maxdiff(0.0), _iters(0), props() {
+LC::LC( const FactorGraph & fg, const PropertySet &opts ) : DAIAlgFG(fg), _pancakes(), _cavitydists(), _phis(), _beliefs(), _invfactors(), _colors(), _maxdiff(0.0), _iters(0), props() {
     setProperties( opts );
 
     // create pancakes
@@ -102,6 +109,23 @@ LC::LC( const FactorGraph & fg, const PropertySet &opts ) : DAIAlgFG(fg), _panca
     _beliefs.reserve( nrVars() );
     for( size_t i=0; i < nrVars(); i++ )
         _beliefs.push_back(Factor(var(i)));
+
+    // greedily color the variables such that no variable has the same color as a variable in its Markov blanket
+    vector<size_t> var2color( nrVars(), -1UL );
+    vector<bool> forbidden;
+    for( size_t i = 0; i < nrVars(); i++ ) {
+        forbidden.assign( _colors.size(), false );
+        bforeach( size_t j, bipGraph().delta1( i, false ) )
+            if( var2color[j] != -1UL )
+                forbidden[var2color[j]] = true;
+        size_t c = 0;
+        while( c < forbidden.size() && forbidden[c] )
+            c++;
+        if( c == _colors.size() )
+            _colors.push_back( vector<size_t>() );
+        _colors[c].push_back( i );
+        var2color[i] = c;
+    }
 }
 
 
@@ -123,6 +147,16 @@ Factor LC::belief (const VarSet &ns) const {
 
 
 Real LC::CalcCavityDist (size_t i, const std::string &name, const PropertySet &opts) {
+    InfAlg *cav = NULL;
+    if( props.cavity != Properties::CavityType::UNIFORM )
+        cav = newInfAlg( name, *this, opts );
+    Real maxdiff = calcCavityDist( i, cav );
+    delete cav;
+    return maxdiff;
+}
+
+
+Real LC::calcCavityDist( size_t i, const InfAlg *cavai ) {
     Factor Bi;
     Real maxdiff = 0;
 
@@ -132,7 +166,7 @@ Real LC::CalcCavityDist (size_t i, const std::string &name, const PropertySet &o
     if( props.cavity == Properties::CavityType::UNIFORM )
         Bi = Factor(delta(i));
     else {
-        InfAlg *cav = newInfAlg( name, *this, opts );
+        InfAlg *cav = cavai->clone();
         cav->makeCavity( i );
 
         if( props.cavity == Properties::CavityType::FULL )
@@ -171,12 +205,32 @@ Real LC::InitCavityDists( const std::string &name, const PropertySet &opts ) {
             cerr << "Using pairwise(new) " << name << opts << "...";
     }
 
-    Real maxdiff = 0.0;
+    // All cavities are approximated by clones of the same inference algorithm
+    InfAlg *cavai = NULL;
+    if( props.cavity != Properties::CavityType::UNIFORM )
+        cavai = newInfAlg( name, *this, opts );
+
+    // The cavity distributions are independent, so they can be calculated concurrently;
+    // exceptions cannot leave a parallel region, so the first one is rethrown afterwards
+    vector<Real> md( nrVars(), 0.0 );
+    vector<Exception> errors;
+    DAI_OMP(parallel for schedule(dynamic))
     for( size_t i = 0; i < nrVars(); i++ ) {
-        Real md = CalcCavityDist(i, name, opts);
-        if( md > maxdiff )
-            maxdiff = md;
+        try {
+            md[i] = calcCavityDist( i, cavai );
+        } catch( Exception &e ) {
+            DAI_OMP(critical)
+            errors.push_back( e );
+        }
     }
+    delete cavai;
+    if( errors.size() )
+        throw errors.front();
+
+    Real maxdiff = 0.0;
+    for( size_t i = 0; i < nrVars(); i++ )
+        if( md[i] > maxdiff )
+            maxdiff = md[i];
 
     if( props.verbose >= 1 ) {
         cerr << this->name() << "::InitCavityDists used " << toc() - tic << " seconds." << endl;
@@ -201,6 +255,24 @@ long LC::SetCavityDists( std::vector<Factor> &Q ) {
 }
 
 
+void LC::SaveCavityDists( const std::string &filename ) const {
+    FactorGraph( _cavitydists ).WriteToFile( filename.c_str(), 17 );
+}
+
+
+void LC::LoadCavityDists( const std::string &filename ) {
+    FactorGraph cavfg;
+    cavfg.ReadFromFile( filename.c_str() );
+    if( cavfg.nrFactors() != nrVars() )
+        DAI_THROWE(INVALID_FACTORGRAPH_FILE,"File " + filename + " contains " + toString(cavfg.nrFactors()) + " cavity distributions instead of " + toString(nrVars()));
+    for( size_t i = 0; i < nrVars(); i++ )
+        if( cavfg.factor(i).vars() != _cavitydists[i].vars() )
+            DAI_THROWE(INVALID_FACTORGRAPH_FILE,"Cavity distribution " + toString(i) + " in file " + filename + " does not match the Markov blanket of variable " + toString(var(i)));
+    for( size_t i = 0; i < nrVars(); i++ )
+        _cavitydists[i] = cavfg.factor(i);
+}
+
+
 void LC::init() {
     for( size_t i = 0; i < nrVars(); ++i )
         bforeach( const Neighbor &I, nbV(i) )
@@ -211,25 +283,48 @@ void LC::init() {
 }
 
 
+Factor LC::pancakeMarginal( const Factor &pancake, size_t I, const Factor *invphi, const VarSet &ns ) const {
+    const Factor &invf = _invfactors[I];
+    DAI_DEBASSERT( invf.vars() << pancake.vars() );
+    DAI_DEBASSERT( ns << pancake.vars() );
+    DAI_DEBASSERT( invphi == NULL || invphi->vars() == ns );
+
+    Factor res( ns, 0.0 );
+    IndexFor i_f( invf.vars(), pancake.vars() );
+    IndexFor i_res( ns, pancake.vars() );
+    for( size_t x = 0; x < pancake.nrStates(); x++, ++i_f, ++i_res ) {
+        Real p = pancake[x] * invf[i_f];
+        if( invphi )
+            p *= (*invphi)[i_res];
+        res.set( i_res, res[i_res] + p );
+    }
+    return res;
+}
+
+
 Factor LC::NewPancake (size_t i, size_t _I, bool & hasNaNs) {
     size_t I = nbV(i)[_I];
     Factor piet = _pancakes[i];
+    Factor &phi = _phis[i][_I];
 
     // recalculate _pancake[i]
-    VarSet Ivars = factor(I).vars();
+    const VarSet &Ivars = factor(I).vars();
+    VarSet ns = Ivars / var(i);
     Factor A_I;
     for( VarSet::const_iterator k = Ivars.begin(); k != Ivars.end(); k++ )
         if( var(i) != *k )
-            A_I *= (_pancakes[findVar(*k)] * factor(I).inverse()).marginal( Ivars / var(i), false );
+            A_I *= pancakeMarginal( _pancakes[findVar(*k)], I, NULL, ns );
     if( Ivars.size() > 1 )
         A_I ^= (1.0 / (Ivars.size() - 1));
-    Factor A_Ii = (_pancakes[i] * factor(I).inverse() * _phis[i][_I].inverse()).marginal( Ivars / var(i), false );
+    Factor invphi = phi.inverse();
+    Factor A_Ii = pancakeMarginal( _pancakes[i], I, &invphi, ns );
     Factor quot = A_I / A_Ii;
     if( props.damping != 0.0 )
-        quot = (quot^(1.0 - props.damping)) * (_phis[i][_I]^props.damping);
+        for( size_t x = 0; x < quot.nrStates(); x++ )
+            quot.set( x, std::pow( quot[x], 1.0 - props.damping ) * std::pow( phi[x], props.damping ) );
 
-    piet *= quot / _phis[i][_I].normalized();
-    _phis[i][_I] = quot.normalized();
+    piet *= quot / phi.normalized();
+    phi = quot.normalized();
 
     piet.normalize();
 
@@ -250,9 +345,21 @@ Real LC::run() {
 
     double tic = toc();
 
-    Real md = InitCavityDists( props.cavainame, props.cavaiopts );
-    if( md > _maxdiff )
-        _maxdiff = md;
+    _invfactors.resize( nrFactors() );
+    for( size_t I = 0; I < nrFactors(); I++ )
+        _invfactors[I] = factor(I).inverse();
+
+    if( props.cavfile.size() && ifstream( props.cavfile.c_str() ).is_open() ) {
+        if( props.verbose >= 1 )
+            cerr << name() << "::run:  Reading cavity distributions from " << props.cavfile << endl;
+        LoadCavityDists( props.cavfile );
+    } else {
+        Real md = InitCavityDists( props.cavainame, props.cavaiopts );
+        if( md > _maxdiff )
+            _maxdiff = md;
+        if( props.cavfile.size() )
+            SaveCavityDists( props.cavfile );
+    }
 
     for( size_t i = 0; i < nrVars(); i++ ) {
         _pancakes[i] = _cavitydists[i];
@@ -298,13 +405,34 @@ Real LC::run() {
         if( props.updates == Properties::UpdateType::SEQRND )
             random_shuffle( update_seq.begin(), update_seq.end(), rnd );
 
-        for( size_t t=0; t < nredges; t++ ) {
-            size_t i = update_seq[t].first;
-            size_t _I = update_seq[t].second;
-            _pancakes[i] = NewPancake( i, _I, hasNaNs);
-            if( hasNaNs )
-                return 1.0;
-            CalcBelief( i );
+        if( props.updates == Properties::UpdateType::COLORED ) {
+            // variables with the same color do not read each other's pancakes
+            for( size_t c = 0; c < _colors.size(); c++ ) {
+                const vector<size_t> &group = _colors[c];
+                DAI_OMP(parallel for schedule(dynamic))
+                for( size_t k = 0; k < group.size(); k++ ) {
+                    size_t i = group[k];
+                    bool hasNaNs_i = false;
+                    for( size_t _I = 0; _I < nbV(i).size() && !hasNaNs_i; _I++ )
+                        _pancakes[i] = NewPancake( i, _I, hasNaNs_i );
+                    if( hasNaNs_i ) {
+                        DAI_OMP(critical)
+                        hasNaNs = true;
+                    } else
+                        CalcBelief( i );
+                }
+                if( hasNaNs )
+                    return 1.0;
+            }
+        } else {
+            for( size_t t=0; t < nredges; t++ ) {
+                size_t i = update_seq[t].first;
+                size_t _I = update_seq[t].second;
+                _pancakes[i] = NewPancake( i, _I, hasNaNs);
+                if( hasNaNs )
+                    return 1.0;
+                CalcBelief( i );
+            }
         }
 
         // compare new beliefs with old ones
@@ -10,6 +10,7 @@
 #include <ctime>
 #include <cmath>
 #include <cstdlib>
+#include <limits>
 #include <dai/mr.h>
 #include <dai/bp.h>
 #include <dai/jtree.h>
@@ -111,57 +112,50 @@ Real MR::Gamma(size_t i, size_t _l1, size_t _l2) {
 }
 
 
-Real MR::_tJ(size_t i, sub_nb A) {
-    sub_nb::size_type _j = A.find_first();
-    if( _j == sub_nb::npos )
-        return 1.0;
-    else
-        return tJ[i][_j] * _tJ(i, A.reset(_j));
-}
-
-
-Real MR::appM(size_t i, sub_nb A) {
-    sub_nb::size_type _j = A.find_first();
-    if( _j == sub_nb::npos )
-        return 1.0;
-    else {
-        sub_nb A_j(A); A_j.reset(_j);
-
-        Real result = M[i][_j] * appM(i, A_j);
-        for( size_t _k = 0; _k < A_j.size(); _k++ )
-            if( A_j.test(_k) ) {
-                sub_nb A_jk(A_j); A_jk.reset(_k);
-                result += cors[i][_j][_k] * appM(i,A_jk);
-            }
-
-        return result;
+void MR::calcSubsetTables( size_t i, std::vector<Real> &tJs, std::vector<Real> &appMs ) const {
+    size_t nr_nb = G.nb(i).size();
+    sub_mask nr_subs = (sub_mask)1 << nr_nb;
+    tJs.resize( nr_subs );
+    appMs.resize( nr_subs );
+
+    tJs[0] = 1.0;
+    appMs[0] = 1.0;
+    for( sub_mask A = 1; A < nr_subs; A++ ) {
+        // _j is the first neighbor in A
+        size_t _j = 0;
+        while( !((A >> _j) & 1) )
+            _j++;
+        sub_mask A_j = A & (A - 1);
+
+        tJs[A] = tJ[i][_j] * tJs[A_j];
+
+        Real result = M[i][_j] * appMs[A_j];
+        for( size_t _k = _j + 1; _k < nr_nb; _k++ )
+            if( (A_j >> _k) & 1 )
+                result += cors[i][_j][_k] * appMs[A_j & ~((sub_mask)1 << _k)];
+        appMs[A] = result;
     }
 }
 
 
-void MR::sum_subs(size_t j, sub_nb A, Real *sum_even, Real *sum_odd) {
+void MR::sum_subs( sub_mask A, const std::vector<Real> &tJs, const std::vector<Real> &appMs, Real *sum_even, Real *sum_odd ) const {
     *sum_even = 0.0;
     *sum_odd = 0.0;
 
-    sub_nb B(A.size());
+    // enumerate all subsets B of A in order of increasing bitmask
+    sub_mask B = 0;
     do {
-        if( B.count() % 2 )
-            *sum_odd += _tJ(j,B) * appM(j,B);
+        bool odd = false;
+        for( sub_mask b = B; b; b &= b - 1 )
+            odd = !odd;
+        if( odd )
+            *sum_odd += tJs[B] * appMs[B];
         else
-            *sum_even += _tJ(j,B) * appM(j,B);
+            *sum_even += tJs[B] * appMs[B];
 
         // calc next subset B
-        size_t bit = 0;
-        for( ; bit < A.size(); bit++ )
-            if( A.test(bit) ) {
-                if( B.test(bit) )
-                    B.reset(bit);
-                else {
-                    B.set(bit);
-                    break;
-                }
-            }
-    } while (!B.none());
+        B = (B - A) & A;
+    } while( B != 0 );
 }
 
 
@@ -174,6 +168,9 @@ void MR::propagateCavityFields() {
         bforeach( const Neighbor &j, G.nb(i) )
             M[i][j.iter] = 0.1;
 
+    // workspace for FULL updates
+    vector<Real> tJs_i, appMs_i, tJs_j, appMs_j, numers;
+
     size_t run=0;
     do {
         maxdev=0.0;
@@ -186,28 +183,36 @@ void MR::propagateCavityFields() {
 
                 Real newM = 0.0;
                 if( props.updates == Properties::UpdateType::FULL ) {
+                    size_t nr_nb_i = G.nb(i).size();
+
                     // find indices in nb(j) that do not correspond with i
-                    sub_nb _nbj_min_i(G.nb(j).size());
-                    _nbj_min_i.set();
-                    _nbj_min_i.reset(_i);
+                    sub_mask _nbj_min_i = (((sub_mask)1 << G.nb(j).size()) - 1) & ~((sub_mask)1 << _i);
 
                     // find indices in nb(i) that do not correspond with j
-                    sub_nb _nbi_min_j(G.nb(i).size());
-                    _nbi_min_j.set();
-                    _nbi_min_j.reset(_j);
+                    sub_mask _nbi_min_j = (((sub_mask)1 << nr_nb_i) - 1) & ~((sub_mask)1 << _j);
 
-                    sum_subs(j, _nbj_min_i, &sum_even, &sum_odd);
+                    calcSubsetTables( j, tJs_j, appMs_j );
+                    sum_subs( _nbj_min_i, tJs_j, appMs_j, &sum_even, &sum_odd );
                     newM = (tanh(theta[j]) * sum_even + sum_odd) / (sum_even + tanh(theta[j]) * sum_odd);
 
-                    sum_subs(i, _nbi_min_j, &sum_even, &sum_odd);
+                    calcSubsetTables( i, tJs_i, appMs_i );
+                    sum_subs( _nbi_min_j, tJs_i, appMs_i, &sum_even, &sum_odd );
                     Real denom = sum_even + tanh(theta[i]) * sum_odd;
+
+                    // the terms of the numerator are independent, so they can be calculated concurrently
+                    // (which is only worthwhile for large neighborhoods); they are summed in a fixed order
+                    numers.assign( nr_nb_i, 0.0 );
+                    DAI_OMP(parallel for if(nr_nb_i >= 12))
+                    for( size_t _k = 0; _k < nr_nb_i; _k++ )
+                        if( _k != _j ) {
+                            Real sum_even_k, sum_odd_k;
+                            sum_subs( _nbi_min_j & ~((sub_mask)1 << _k), tJs_i, appMs_i, &sum_even_k, &sum_odd_k );
+                            numers[_k] = tJ[i][_k] * cors[i][_j][_k] * (tanh(theta[i]) * sum_even_k + sum_odd_k);
+                        }
                     Real numer = 0.0;
-                    for(size_t _k=0; _k < G.nb(i).size(); _k++) if(_k != _j) {
-                        sub_nb _nbi_min_jk(_nbi_min_j);
-                        _nbi_min_jk.reset(_k);
-                        sum_subs(i, _nbi_min_jk, &sum_even, &sum_odd);
-                        numer += tJ[i][_k] * cors[i][_j][_k] * (tanh(theta[i]) * sum_even + sum_odd);
-                    }
+                    for( size_t _k = 0; _k < nr_nb_i; _k++ )
+                        if( _k != _j )
+                            numer += numers[_k];
                     newM -= numer / denom;
                 } else if( props.updates == Properties::UpdateType::LINEAR ) {
                     newM = T(j,_i);
@@ -243,28 +248,36 @@ void MR::propagateCavityFields() {
 
 
 void MR::calcMagnetizations() {
-    for( size_t i = 0; i < G.nrNodes(); i++ ) {
-        if( props.updates == Properties::UpdateType::FULL ) {
-            // find indices in nb(i)
-            sub_nb _nbi( G.nb(i).size() );
-            _nbi.set();
+    // the magnetizations are independent, so they can be calculated concurrently
+    DAI_OMP(parallel)
+    {
+        // workspace for FULL updates
+        vector<Real> tJs, appMs;
 
-            // calc numerator1 and denominator1
-            Real sum_even, sum_odd;
-            sum_subs(i, _nbi, &sum_even, &sum_odd);
+        DAI_OMP(for schedule(dynamic))
+        for( size_t i = 0; i < G.nrNodes(); i++ ) {
+            if( props.updates == Properties::UpdateType::FULL ) {
+                // find indices in nb(i)
+                sub_mask _nbi = ((sub_mask)1 << G.nb(i).size()) - 1;
+
+                // calc numerator1 and denominator1
+                Real sum_even, sum_odd;
+                calcSubsetTables( i, tJs, appMs );
+                sum_subs( _nbi, tJs, appMs, &sum_even, &sum_odd );
 
-            Mag[i] = (tanh(theta[i]) * sum_even + sum_odd) / (sum_even + tanh(theta[i]) * sum_odd);
+                Mag[i] = (tanh(theta[i]) * sum_even + sum_odd) / (sum_even + tanh(theta[i]) * sum_odd);
 
-        } else if( props.updates == Properties::UpdateType::LINEAR ) {
-            sub_nb empty( G.nb(i).size() );
-            Mag[i] = T(i,empty);
+            } else if( props.updates == Properties::UpdateType::LINEAR ) {
+                sub_nb empty( G.nb(i).size() );
+                Mag[i] = T(i,empty);
 
-            for( size_t _l1 = 0; _l1 < G.nb(i).size(); _l1++ )
-                for( size_t _l2 = _l1 + 1; _l2 < G.nb(i).size(); _l2++ )
-                    Mag[i] += Gamma(i,_l1,_l2) * tJ[i][_l1] * tJ[i][_l2] * cors[i][_l1][_l2];
+                for( size_t _l1 = 0; _l1 < G.nb(i).size(); _l1++ )
+                    for( size_t _l2 = _l1 + 1; _l2 < G.nb(i).size(); _l2++ )
+                        Mag[i] += Gamma(i,_l1,_l2) * tJ[i][_l1] * tJ[i][_l2] * cors[i][_l1][_l2];
+            }
+            if( abs( Mag[i] ) > 1.0 )
+                Mag[i] = (Mag[i] > 0.0) ? 1.0 : -1.0;
         }
-        if( abs( Mag[i] ) > 1.0 )
-            Mag[i] = (Mag[i] > 0.0) ? 1.0 : -1.0;
     }
 }
 
@@ -344,6 +357,12 @@ Real MR::run() {
         if( props.verbose >= 1 )
             cerr << "Starting " << identify() << "...";
 
+        // the subsets of neighbors are represented as bitmasks for FULL updates
+        if( props.updates == Properties::UpdateType::FULL )
+            for( size_t i = 0; i < G.nrNodes(); i++ )
+                if( G.nb(i).size() >= (size_t)std::numeric_limits<sub_mask>::digits )
+                    DAI_THROWE(NOT_IMPLEMENTED,"MR with updates=FULL does not support variables with " + toString( G.nb(i).size() ) + " neighbors");
+
         double tic = toc();
 
         // approximate correlations of cavity spins
@@ -0,0 +1,359 @@
+/*  This file is part of libDAI - http://www.libdai.org/
+ *
+ *  Copyright (c) 2006-2011, The libDAI authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license that can be found in the LICENSE file.
+ */
+
+
+#include <algorithm>
+#include <deque>
+#include <dai/util.h>
+#include <dai/pseudolikelihood.h>
+#include <boost/lexical_cast.hpp>
+
+
+namespace dai {
+
+
+using namespace std;
+
+
+const std::string PseudoLikelihood::MAX_ITERS_KEY("max_iters");
+const std::string PseudoLikelihood::TOL_KEY("tol");
+const std::string PseudoLikelihood::L2_KEY("l2");
+const std::string PseudoLikelihood::HISTORY_KEY("history");
+const std::string PseudoLikelihood::VERBOSE_KEY("verbose");
+const size_t PseudoLikelihood::MAX_ITERS_DEFAULT = 100;
+const Real PseudoLikelihood::TOL_DEFAULT = 1e-6;
+const Real PseudoLikelihood::L2_DEFAULT = 0.0;
+const size_t PseudoLikelihood::HISTORY_DEFAULT = 10;
+
+
+/// Returns the inner product of the first \a n entries of \a a and \a b
+static Real dot( const vector<Real> &a, const vector<Real> &b, size_t n ) {
+    Real result = 0.0;
+    for( size_t j = 0; j < n; j++ )
+        result += a[j] * b[j];
+    return result;
+}
+
+
+PseudoLikelihood::PseudoLikelihood( FactorGraph &fg, const PropertySet &opts ) : _fg(fg), _estimate(), _offsets(), _nrEstimated(0), _factorVars(), _factorStrides(), _varStrides(), _max_iters(MAX_ITERS_DEFAULT), _tol(TOL_DEFAULT), _l2(L2_DEFAULT), _history(HISTORY_DEFAULT), _verbose(0), _iters(0) {
+    setProperties( opts );
+    vector<size_t> factors( fg.nrFactors() );
+    for( size_t I = 0; I < fg.nrFactors(); I++ )
+        factors[I] = I;
+    construct( factors );
+}
+
+
+PseudoLikelihood::PseudoLikelihood( FactorGraph &fg, const std::vector<size_t> &factors, const PropertySet &opts ) : _fg(fg), _estimate(), _offsets(), _nrEstimated(0), _factorVars(), _factorStrides(), _varStrides(), _max_iters(MAX_ITERS_DEFAULT), _tol(TOL_DEFAULT), _l2(L2_DEFAULT), _history(HISTORY_DEFAULT), _verbose(0), _iters(0) {
+    setProperties( opts );
+    construct( factors );
+}
+
+
+void PseudoLikelihood::setProperties( const PropertySet &opts ) {
+    if( opts.hasKey(MAX_ITERS_KEY) )
+        _max_iters = opts.getStringAs<size_t>(MAX_ITERS_KEY);
+    if( opts.hasKey(TOL_KEY) )
+        _tol = opts.getStringAs<Real>(TOL_KEY);
+    if( opts.hasKey(L2_KEY) )
+        _l2 = opts.getStringAs<Real>(L2_KEY);
+    if( opts.hasKey(HISTORY_KEY) )
+        _history = opts.getStringAs<size_t>(HISTORY_KEY);
+    if( opts.hasKey(VERBOSE_KEY) )
+        _verbose = opts.getStringAs<size_t>(VERBOSE_KEY);
+}
+
+
+void PseudoLikelihood::construct( const std::vector<size_t> &factors ) {
+    _estimate.assign( _fg.nrFactors(), 0 );
+    for( size_t k = 0; k < factors.size(); k++ ) {
+        DAI_ASSERT( factors[k] < _fg.nrFactors() );
+        _estimate[factors[k]] = 1;
+    }
+
+    // The parameters of the estimated factors come first
+    _offsets.resize( _fg.nrFactors() );
+    size_t offset = 0;
+    for( size_t pass = 0; pass < 2; pass++ ) {
+        for( size_t I = 0; I < _fg.nrFactors(); I++ )
+            if( (bool)_estimate[I] == (pass == 0) ) {
+                _offsets[I] = offset;
+                offset += _fg.factor(I).nrStates();
+            }
+        if( pass == 0 )
+            _nrEstimated = offset;
+    }
+
+    // Strides of the variables in the linear states of the factors
+    _factorVars.resize( _fg.nrFactors() );
+    _factorStrides.resize( _fg.nrFactors() );
+    for( size_t I = 0; I < _fg.nrFactors(); I++ ) {
+        const VarSet &vs = _fg.factor(I).vars();
+        _factorVars[I].clear();
+        _factorStrides[I].clear();
+        size_t stride = 1;
+        for( VarSet::const_iterator v = vs.begin(); v != vs.end(); v++ ) {
+            _factorVars[I].push_back( _fg.findVar( *v ) );
+            _factorStrides[I].push_back( stride );
+            stride *= v->states();
+        }
+    }
+    _varStrides.resize( _fg.nrVars() );
+    for( size_t i = 0; i < _fg.nrVars(); i++ ) {
+        _varStrides[i].clear();
+        bforeach( const Neighbor &I, _fg.nbV(i) ) {
+            size_t pos = find( _factorVars[I].begin(), _factorVars[I].end(), i ) - _factorVars[I].begin();
+            _varStrides[i].push_back( _factorStrides[I][pos] );
+        }
+    }
+}
+
+
+std::vector<Real> PseudoLikelihood::parameters() const {
+    size_t total = 0;
+    for( size_t I = 0; I < _fg.nrFactors(); I++ )
+        total += _fg.factor(I).nrStates();
+    vector<Real> theta( total );
+    for( size_t I = 0; I < _fg.nrFactors(); I++ ) {
+        const Factor &f = _fg.factor(I);
+        for( size_t j = 0; j < f.nrStates(); j++ )
+            theta[_offsets[I] + j] = dai::log( f[j] );
+    }
+    return theta;
+}
+
+
+std::vector<size_t> PseudoLikelihood::findColumns( const EvidenceTable &data ) const {
+    vector<size_t> cols( _fg.nrVars() );
+    for( size_t i = 0; i < _fg.nrVars(); i++ ) {
+        vector<Var>::const_iterator v = find( data.vars().begin(), data.vars().end(), _fg.var(i) );
+        if( v == data.vars().end() )
+            DAI_THROWE(OBJECT_NOT_FOUND,"Variable " + boost::lexical_cast<string>(_fg.var(i).label()) + " does not occur in the data");
+        cols[i] = v - data.vars().begin();
+    }
+    return cols;
+}
+
+
+Real PseudoLikelihood::objective( const EvidenceTable &data, const std::vector<size_t> &cols, const std::vector<Real> &theta, std::vector<Real> *grad ) const {
+    size_t N = data.nrSamples();
+    if( grad )
+        grad->assign( _nrEstimated, 0.0 );
+    if( N == 0 )
+        return 0.0;
+
+    size_t maxStates = 0;
+    for( size_t i = 0; i < _fg.nrVars(); i++ )
+        maxStates = std::max( maxStates, _fg.var(i).states() );
+
+    // The samples are divided into a number of blocks that does not depend on the number of
+    // threads; the blocks are processed concurrently and their results are added in order
+    const size_t minBlockSize = 1024;
+    const size_t maxBlocks = 64;
+    size_t nrBlocks = std::min( maxBlocks, (N + minBlockSize - 1) / minBlockSize );
+    vector<Real> blockValue( nrBlocks, 0.0 );
+    vector<vector<Real> > blockGrad( grad ? nrBlocks : 0 );
+    vector<Exception> errors;
+    DAI_OMP(parallel)
+    {
+        vector<size_t> x( _fg.nrVars() );
+        vector<size_t> base( _fg.nrFactors() );
+        vector<Real> e( maxStates );
+        DAI_OMP(for schedule(dynamic))
+        for( size_t block = 0; block < nrBlocks; block++ ) {
+            try {
+                Real value = 0.0;
+                vector<Real> *g = NULL;
+                if( grad ) {
+                    blockGrad[block].assign( _nrEstimated, 0.0 );
+                    g = &(blockGrad[block]);
+                }
+                for( size_t s = N * block / nrBlocks; s < N * (block + 1) / nrBlocks; s++ ) {
+                    for( size_t i = 0; i < _fg.nrVars(); i++ ) {
+                        if( !data.observed( s, cols[i] ) )
+                            DAI_THROWE(INVALID_EVIDENCE_FILE,"Sample " + boost::lexical_cast<string>(s) + " is not fully observed");
+                        x[i] = data.state( s, cols[i] );
+                    }
+                    // Position of the observed state of each factor in theta
+                    for( size_t I = 0; I < _fg.nrFactors(); I++ ) {
+                        size_t b = _offsets[I];
+                        for( size_t j = 0; j < _factorVars[I].size(); j++ )
+                            b += x[_factorVars[I][j]] * _factorStrides[I][j];
+                        base[I] = b;
+                    }
+                    // Conditional distribution of each variable given its Markov blanket
+                    for( size_t i = 0; i < _fg.nrVars(); i++ ) {
+                        size_t states = _fg.var(i).states();
+                        const Neighbors &nb = _fg.nbV(i);
+                        fill( e.begin(), e.begin() + states, 0.0 );
+                        for( size_t n = 0; n < nb.size(); n++ ) {
+                            size_t stride = _varStrides[i][n];
+                            const Real *t = &(theta[base[nb[n]] - x[i] * stride]);
+                            for( size_t k = 0; k < states; k++ )
+                                e[k] += t[k * stride];
+                        }
+                        Real emax = *max_element( e.begin(), e.begin() + states );
+                        if( emax == -INFINITY ) {
+                            value = -INFINITY;
+                            continue;
+                        }
+                        Real Z = 0.0;
+                        for( size_t k = 0; k < states; k++ )
+                            Z += exp( e[k] - emax );
+                        Real logZ = emax + log( Z );
+                        value += e[x[i]] - logZ;
+                        if( g )
+                            for( size_t n = 0; n < nb.size(); n++ ) {
+                                if( !_estimate[nb[n]] )
+                                    continue;
+                                size_t stride = _varStrides[i][n];
+                                Real *gt = &((*g)[base[nb[n]] - x[i] * stride]);
+                                for( size_t k = 0; k < states; k++ )
+                                    gt[k * stride] += exp( e[k] - logZ );
+                                (*g)[base[nb[n]]] -= 1.0;
+                            }
+                    }
+                }
+                blockValue[block] = value;
+            } catch( Exception &err ) {
+                DAI_OMP(critical)
+                errors.push_back( err );
+            }
+        }
+    }
+    if( errors.size() )
+        throw errors.front();
+
+    Real value = 0.0;
+    for( size_t block = 0; block < nrBlocks; block++ ) {
+        value += blockValue[block];
+        if( grad )
+            for( size_t j = 0; j < _nrEstimated; j++ )
+                (*grad)[j] += blockGrad[block][j];
+    }
+    if( grad )
+        for( size_t j = 0; j < _nrEstimated; j++ )
+            (*grad)[j] /= N;
+    return -value / N;
+}
+
+
+Real PseudoLikelihood::logPseudoLikelihood( const EvidenceTable &data ) const {
+    return -objective( data, findColumns( data ), parameters(), NULL );
+}
+
+
+Real PseudoLikelihood::run( const EvidenceTable &data ) {
+    vector<size_t> cols = findColumns( data );
+    size_t n = _nrEstimated;
+
+    // Start from uniform factors
+    vector<Real> theta = parameters();
+    fill( theta.begin(), theta.begin() + n, 0.0 );
+
+    // Objective including the regularization term, and its gradient
+    vector<Real> grad;
+    Real f = objective( data, cols, theta, &grad );
+    for( size_t j = 0; j < n; j++ )
+        grad[j] += _l2 * theta[j];
+    f += 0.5 * _l2 * dot( theta, theta, n );
+
+    // L-BFGS with a backtracking line search (see [\ref NoW06], Algorithm 7.5)
+    deque<vector<Real> > S, Y;
+    deque<Real> rho;
+    vector<Real> d( n ), thetaNew( theta ), gradNew;
+    Real fNew = f;
+    for( _iters = 0; _iters < _max_iters; ) {
+        Real gmax = 0.0;
+        for( size_t j = 0; j < n; j++ )
+            gmax = std::max( gmax, fabs( grad[j] ) );
+        if( gmax <= _tol )
+            break;
+
+        // Two-loop recursion for the search direction d = -H grad
+        d = grad;
+        vector<Real> alpha( S.size() );
+        for( size_t m = S.size(); m-- > 0; ) {
+            alpha[m] = rho[m] * dot( S[m], d, n );
+            for( size_t j = 0; j < n; j++ )
+                d[j] -= alpha[m] * Y[m][j];
+        }
+        Real gamma = S.empty() ? 1.0 / sqrt( dot( grad, grad, n ) ) : dot( S.back(), Y.back(), n ) / dot( Y.back(), Y.back(), n );
+        for( size_t j = 0; j < n; j++ )
+            d[j] *= gamma;
+        for( size_t m = 0; m < S.size(); m++ ) {
+            Real beta = rho[m] * dot( Y[m], d, n );
+            for( size_t j = 0; j < n; j++ )
+                d[j] += S[m][j] * (alpha[m] - beta);
+        }
+        for( size_t j = 0; j < n; j++ )
+            d[j] = -d[j];
+
+        // Backtracking line search satisfying the Armijo condition
+        Real slope = dot( d, grad, n );
+        Real step = 1.0;
+        bool found = false;
+        for( size_t trial = 0; trial < 50 && !found; trial++, step *= 0.5 ) {
+            for( size_t j = 0; j < n; j++ )
+                thetaNew[j] = theta[j] + step * d[j];
+            fNew = objective( data, cols, thetaNew, &gradNew );
+            for( size_t j = 0; j < n; j++ )
+                gradNew[j] += _l2 * thetaNew[j];
+            fNew += 0.5 * _l2 * dot( thetaNew, thetaNew, n );
+            found = (fNew <= f + 1e-4 * step * slope);
+        }
+        if( !found )
+            break;
+        _iters++;
+
+        // Update the correction pairs
+        S.push_back( vector<Real>( n ) );
+        Y.push_back( vector<Real>( n ) );
+        for( size_t j = 0; j < n; j++ ) {
+            S.back()[j] = thetaNew[j] - theta[j];
+            Y.back()[j] = gradNew[j] - grad[j];
+        }
+        Real sy = dot( S.back(), Y.back(), n );
+        if( sy > 0.0 ) {
+            rho.push_back( 1.0 / sy );
+            if( S.size() > _history ) {
+                S.pop_front();
+                Y.pop_front();
+                rho.pop_front();
+            }
+        } else { // curvature condition violated: skip this pair
+            S.pop_back();
+            Y.pop_back();
+        }
+
+        bool converged = (f - fNew) <= _tol * std::max( 1.0, fabs( fNew ) );
+        swap( theta, thetaNew );
+        swap( grad, gradNew );
+        f = fNew;
+        if( _verbose >= 1 )
+            cerr << "PseudoLikelihood::run:  iteration " << _iters << ", objective " << f << endl;
+        if( converged )
+            break;
+    }
+
+    // Set the estimated factors
+    for( size_t I = 0; I < _fg.nrFactors(); I++ )
+        if( _estimate[I] ) {
+            const Factor &old = _fg.factor(I);
+            Real tmax = *max_element( theta.begin() + _offsets[I], theta.begin() + _offsets[I] + old.nrStates() );
+            Prob p( old.nrStates() );
+            for( size_t j = 0; j < old.nrStates(); j++ )
+                p.set( j, exp( theta[_offsets[I] + j] - tmax ) );
+            p.normalize();
+            _fg.setFactor( I, Factor( old.vars(), p ) );
+        }
+
+    return -(f - 0.5 * _l2 * dot( theta, theta, n ));
+}
+
+
+} // end of namespace dai
@@ -8,7 +8,6 @@
 
 #include <algorithm>
 #include <cmath>
-#include <boost/dynamic_bitset.hpp>
 #include <dai/regiongraph.h>
 #include <dai/factorgraph.h>
 #include <dai/clustergraph.h>
@@ -33,18 +32,35 @@ void RegionGraph::construct( const FactorGraph &fg, const std::vector<VarSet> &o
     bforeach( const VarSet &alpha, ors )
         _ORs.push_back( FRegion(Factor(alpha, 1.0), 1.0) );
 
-    // For each factor, find an outer region that subsumes that factor.
+    // Index the outer regions by the labels of the variables they contain
+    hash_map<size_t, vector<size_t> > label2ORs;
+    for( size_t alpha = 0; alpha < nrORs(); alpha++ )
+        for( VarSet::const_iterator n = OR(alpha).vars().begin(); n != OR(alpha).vars().end(); n++ )
+            label2ORs[n->label()].push_back( alpha );
+
+    // For each factor, find the first outer region that subsumes that factor.
     // Then, multiply the outer region with that factor.
+    // Only the outer regions that contain the first variable of the factor need to be considered.
     _fac2OR.clear();
     _fac2OR.reserve( nrFactors() );
     for( size_t I = 0; I < nrFactors(); I++ ) {
-        size_t alpha;
-        for( alpha = 0; alpha < nrORs(); alpha++ )
-            if( OR(alpha).vars() >> factor(I).vars() ) {
-                _fac2OR.push_back( alpha );
-                break;
+        const VarSet &ns = factor(I).vars();
+        bool found = false;
+        if( ns.empty() ) {
+            if( nrORs() ) {
+                _fac2OR.push_back( 0 );
+                found = true;
             }
-        DAI_ASSERT( alpha != nrORs() );
+        } else {
+            const vector<size_t> &candidates = label2ORs[ns.begin()->label()];
+            for( vector<size_t>::const_iterator alpha = candidates.begin(); alpha != candidates.end(); alpha++ )
+                if( OR(*alpha).vars() >> ns ) {
+                    _fac2OR.push_back( *alpha );
+                    found = true;
+                    break;
+                }
+        }
+        DAI_ASSERT( found );
     }
     recomputeORs();
 
@@ -64,49 +80,100 @@ void RegionGraph::constructCVM( const FactorGraph &fg, const std::vector<VarSet>
     if( verbose )
         cerr << "  Erasing non-maximal clusters" << endl;
     cg.eraseNonMaximal();
+    const BipartiteGraph &cgG = cg.bipGraph();
+
+    // The inner regions found so far, indexed by their variables (using the variable indices of cg)
+    // and by their contents (to detect duplicates)
+    vector<VarSet> betas;
+    hash_map<VarSet, size_t> betaIndex;
+    vector<vector<size_t> > var2betas( cg.nrVars() );
+    hash_map<size_t, size_t> label2var;
+    for( size_t i = 0; i < cg.nrVars(); i++ )
+        label2var[cg.var(i).label()] = i;
 
     // Create inner regions - first pass
+    // Only clusters that have at least one variable in common need to be intersected
     if( verbose )
         cerr << "  Creating inner regions (first pass)" << endl;
-    set<VarSet> betas;
+    vector<size_t> visited( cg.nrClusters(), -1 );
     for( size_t alpha = 0; alpha < cg.nrClusters(); alpha++ )
-        for( size_t alpha2 = alpha; (++alpha2) != cg.nrClusters(); ) {
-            VarSet intersection = cg.cluster(alpha) & cg.cluster(alpha2);
-            if( intersection.size() > 0 )
-                betas.insert( intersection );
-        }
+        bforeach( const Neighbor &i, cgG.nb2(alpha) )
+            bforeach( const Neighbor &alpha2, cgG.nb1(i) )
+                if( alpha2 > alpha && visited[alpha2] != alpha ) {
+                    visited[alpha2] = alpha;
+                    VarSet intersection = cg.cluster(alpha) & cg.cluster(alpha2);
+                    if( betaIndex.find( intersection ) == betaIndex.end() ) {
+                        betaIndex[intersection] = betas.size();
+                        for( VarSet::const_iterator n = intersection.begin(); n != intersection.end(); n++ )
+                            var2betas[label2var[n->label()]].push_back( betas.size() );
+                        betas.push_back( intersection );
+                    }
+                }
 
     // Create inner regions - subsequent passes
+    // In each pass, only the inner regions found in the previous pass are intersected
+    // with all other (overlapping) inner regions, until no new intersections are found
     if( verbose )
         cerr << "  Creating inner regions (next passes)" << endl;
-    set<VarSet> new_betas;
-    do {
-        new_betas.clear();
-        for( set<VarSet>::const_iterator gamma = betas.begin(); gamma != betas.end(); gamma++ )
-            for( set<VarSet>::const_iterator gamma2 = gamma; (++gamma2) != betas.end(); ) {
-                VarSet intersection = (*gamma) & (*gamma2);
-                if( (intersection.size() > 0) && (betas.count(intersection) == 0) )
-                    new_betas.insert( intersection );
+    for( size_t begin = 0; begin < betas.size(); ) {
+        size_t end = betas.size();
+        visited.assign( end, -1 );
+        for( size_t gamma = begin; gamma < end; gamma++ ) {
+            // copy, since betas may be reallocated when new inner regions are added
+            VarSet gammaVars = betas[gamma];
+            for( VarSet::const_iterator n = gammaVars.begin(); n != gammaVars.end(); n++ ) {
+                size_t i = label2var[n->label()];
+                // var2betas[i] is sorted, and may grow inside this loop
+                for( size_t k = 0; k < var2betas[i].size() && var2betas[i][k] < end; k++ ) {
+                    size_t gamma2 = var2betas[i][k];
+                    // pairs within the current pass are intersected only once
+                    if( gamma2 == gamma || visited[gamma2] == gamma || (gamma2 >= begin && gamma2 < gamma) )
+                        continue;
+                    visited[gamma2] = gamma;
+                    VarSet intersection = gammaVars & betas[gamma2];
+                    if( (intersection.size() > 0) && (betaIndex.find( intersection ) == betaIndex.end()) ) {
+                        betaIndex[intersection] = betas.size();
+                        for( VarSet::const_iterator m = intersection.begin(); m != intersection.end(); m++ )
+                            var2betas[label2var[m->label()]].push_back( betas.size() );
+                        betas.push_back( intersection );
+                    }
+                }
             }
-        betas.insert(new_betas.begin(), new_betas.end());
-    } while( new_betas.size() );
+        }
+        begin = end;
+    }
 
     // Create inner regions - final phase
+    // (the inner regions are sorted, such that their order does not depend on the order in which they were found)
     if( verbose )
         cerr << "  Creating inner regions (final phase)" << endl;
+    sort( betas.begin(), betas.end() );
     vector<Region> irs;
     irs.reserve( betas.size() );
-    for( set<VarSet>::const_iterator beta = betas.begin(); beta != betas.end(); beta++ )
+    for( vector<VarSet>::const_iterator beta = betas.begin(); beta != betas.end(); beta++ )
         irs.push_back( Region(*beta,0.0) );
 
     // Create edges
+    // An outer region containing beta has to contain the variable of beta that occurs in the fewest clusters
     if( verbose )
         cerr << "  Creating edges" << endl;
     vector<pair<size_t,size_t> > edges;
-    for( size_t beta = 0; beta < irs.size(); beta++ )
-        for( size_t alpha = 0; alpha < cg.nrClusters(); alpha++ )
+    vector<size_t> alphas;
+    for( size_t beta = 0; beta < irs.size(); beta++ ) {
+        size_t rarest = -1;
+        for( VarSet::const_iterator n = irs[beta].begin(); n != irs[beta].end(); n++ ) {
+            size_t i = label2var[n->label()];
+            if( rarest == -1UL || cgG.nb1(i).size() < cgG.nb1(rarest).size() )
+                rarest = i;
+        }
+        alphas.clear();
+        bforeach( const Neighbor &alpha, cgG.nb1(rarest) )
             if( cg.cluster(alpha) >> irs[beta] )
-                edges.push_back( pair<size_t,size_t>(alpha,beta) );
+                alphas.push_back( alpha );
+        sort( alphas.begin(), alphas.end() );
+        for( vector<size_t>::const_iterator alpha = alphas.begin(); alpha != alphas.end(); alpha++ )
+            edges.push_back( pair<size_t,size_t>(*alpha,beta) );
+    }
 
     // Construct region graph
     if( verbose )
@@ -126,37 +193,36 @@ void RegionGraph::constructCVM( const FactorGraph &fg, const std::vector<VarSet>
 void RegionGraph::calcCVMCountingNumbers() {
     // Calculates counting numbers of inner regions based upon counting numbers of outer regions
 
-    vector<vector<size_t> > ancestors(nrIRs());
-    boost::dynamic_bitset<> assigned(nrIRs());
-    for( size_t beta = 0; beta < nrIRs(); beta++ ) {
-        IR(beta).c() = 0.0;
-        for( size_t beta2 = 0; beta2 < nrIRs(); beta2++ )
-            if( (beta2 != beta) && IR(beta2) >> IR(beta) )
-                ancestors[beta].push_back(beta2);
+    // Index the inner regions by the labels of the variables they contain
+    hash_map<size_t, vector<size_t> > label2IRs;
+    for( size_t beta = 0; beta < nrIRs(); beta++ )
+        for( VarSet::const_iterator n = IR(beta).begin(); n != IR(beta).end(); n++ )
+            label2IRs[n->label()].push_back( beta );
+
+    // Visit the inner regions in topological order (i.e., in order of decreasing size),
+    // such that the counting numbers of all ancestors are known when visiting an inner region
+    vector<pair<size_t,size_t> > order;
+    order.reserve( nrIRs() );
+    for( size_t beta = 0; beta < nrIRs(); beta++ )
+        order.push_back( make_pair( IR(beta).size(), beta ) );
+    sort( order.begin(), order.end() );
+
+    vector<size_t> all;
+    for( vector<pair<size_t,size_t> >::const_reverse_iterator it = order.rbegin(); it != order.rend(); it++ ) {
+        size_t beta = it->second;
+        Real c = 1.0;
+        bforeach( const Neighbor &alpha, nbIR(beta) )
+            c -= OR(alpha).c();
+        // the ancestors of beta contain all variables of beta, in particular its first one
+        if( IR(beta).empty() && all.empty() )
+            for( size_t beta2 = 0; beta2 < nrIRs(); beta2++ )
+                all.push_back( beta2 );
+        const vector<size_t> &candidates = IR(beta).empty() ? all : label2IRs[IR(beta).begin()->label()];
+        for( vector<size_t>::const_iterator beta2 = candidates.begin(); beta2 != candidates.end(); beta2++ )
+            if( (*beta2 != beta) && (IR(*beta2).size() > IR(beta).size()) && (IR(*beta2) >> IR(beta)) )
+                c -= IR(*beta2).c();
+        IR(beta).c() = c;
     }
-
-    bool new_counting;
-    do {
-        new_counting = false;
-        for( size_t beta = 0; beta < nrIRs(); beta++ ) {
-            if( !assigned[beta] ) {
-                bool has_unassigned_ancestor = false;
-                for( vector<size_t>::const_iterator beta2 = ancestors[beta].begin(); (beta2 != ancestors[beta].end()) && !has_unassigned_ancestor; beta2++ )
-                    if( !assigned[*beta2] )
-                        has_unassigned_ancestor = true;
-                if( !has_unassigned_ancestor ) {
-                    Real c = 1.0;
-                    bforeach( const Neighbor &alpha, nbIR(beta) )
-                        c -= OR(alpha).c();
-                    for( vector<size_t>::const_iterator beta2 = ancestors[beta].begin(); beta2 != ancestors[beta].end(); beta2++ )
-                        c -= IR(*beta2).c();
-                    IR(beta).c() = c;
-                    assigned.set(beta, true);
-                    new_counting = true;
-                }
-            }
-        }
-    } while( new_counting );
 }
 
 
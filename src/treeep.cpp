@@ -9,6 +9,7 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <dai/jtree.h>
 #include <dai/treeep.h>
 #include <dai/util.h>
@@ -38,6 +39,14 @@ void TreeEP::setProperties( const PropertySet &opts ) {
         props.verbose = opts.getStringAs<size_t>("verbose");
     else
         props.verbose = 0;
+    if( opts.hasKey("updates") )
+        props.updates = opts.getStringAs<Properties::UpdateType>("updates");
+    else
+        props.updates = Properties::UpdateType::SEQFIX;
+    if( opts.hasKey("skiptol") )
+        props.skiptol = opts.getStringAs<Real>("skiptol");
+    else
+        props.skiptol = 0.0;
 }
 
 
@@ -48,6 +57,8 @@ PropertySet TreeEP::getProperties() const {
     opts.set( "maxtime", props.maxtime );
     opts.set( "verbose", props.verbose );
     opts.set( "type", props.type );
+    opts.set( "updates", props.updates );
+    opts.set( "skiptol", props.skiptol );
     return opts;
 }
 
@@ -59,12 +70,14 @@ string TreeEP::printProperties() const {
     s << "maxiter=" << props.maxiter << ",";
     s << "maxtime=" << props.maxtime << ",";
     s << "verbose=" << props.verbose << ",";
-    s << "type=" << props.type << "]";
+    s << "type=" << props.type << ",";
+    s << "updates=" << props.updates << ",";
+    s << "skiptol=" << props.skiptol << "]";
     return s.str();
 }
 
 
-TreeEP::TreeEP( const FactorGraph &fg, const PropertySet &opts ) : JTree(fg, opts("updates",string("HUGIN")), false), _maxdiff(0.0), _iters(0), props(), _Q() {
+TreeEP::TreeEP( const FactorGraph &fg, const PropertySet &opts ) : JTree(fg, opts("updates",string("HUGIN")), false), _maxdiff(0.0), _iters(0), props(), _Q(), _colors() {
     setProperties( opts );
 
     if( opts.hasKey("tree") ) {
@@ -168,6 +181,27 @@ void TreeEP::construct( const FactorGraph& fg, const RootedTree& tree ) {
                     break;
             }
 
+    // Greedily color the off-tree factors such that factors with the same color have subtrees without common outer regions
+    _colors.clear();
+    vector<vector<size_t> > OR2colors( nrORs() );
+    vector<size_t> forbidden;
+    for( map<size_t, TreeEPSubTree>::const_iterator q = _Q.begin(); q != _Q.end(); q++ ) {
+        const vector<size_t> &a = q->second.a();
+        forbidden.clear();
+        for( size_t k = 0; k < a.size(); k++ )
+            forbidden.insert( forbidden.end(), OR2colors[a[k]].begin(), OR2colors[a[k]].end() );
+        sort( forbidden.begin(), forbidden.end() );
+        size_t c = 0;
+        for( vector<size_t>::const_iterator f = forbidden.begin(); f != forbidden.end() && *f <= c; f++ )
+            if( *f == c )
+                c++;
+        if( c == _colors.size() )
+            _colors.push_back( vector<size_t>() );
+        _colors[c].push_back( q->first );
+        for( size_t k = 0; k < a.size(); k++ )
+            OR2colors[a[k]].push_back( c );
+    }
+
     if( props.verbose >= 3 )
         cerr << "Resulting regiongraph: " << *this << endl;
 }
@@ -197,12 +231,20 @@ Real TreeEP::run() {
     // been reached or until the maximum belief difference is smaller than tolerance
     Real maxDiff = INFINITY;
     for( _iters = 0; _iters < props.maxiter && maxDiff > props.tol && (toc() - tic) < props.maxtime; _iters++ ) {
-        for( size_t I = 0; I < nrFactors(); I++ )
-            if( offtree(I) ) {
-                _Q[I].InvertAndMultiply( Qa, Qb );
-                _Q[I].HUGIN_with_I( Qa, Qb );
-                _Q[I].InvertAndMultiply( Qa, Qb );
+        if( props.updates == Properties::UpdateType::SEQFIX ) {
+            for( size_t I = 0; I < nrFactors(); I++ )
+                if( offtree(I) )
+                    updateOffTreeFactor( I );
+        } else if( props.updates == Properties::UpdateType::COLORED ) {
+            // Off-tree factors with the same color have disjoint subtrees, so they can be updated concurrently
+            for( size_t c = 0; c < _colors.size(); c++ ) {
+                const vector<size_t> &group = _colors[c];
+                DAI_OMP(parallel for schedule(dynamic))
+                for( size_t k = 0; k < group.size(); k++ )
+                    updateOffTreeFactor( group[k] );
             }
+        } else
+            DAI_THROW(UNKNOWN_ENUM_VALUE);
 
         // calculate new beliefs and compare with old ones
         vector<Factor> newBeliefs = beliefs();
@@ -234,6 +276,16 @@ Real TreeEP::run() {
 }
 
 
+void TreeEP::updateOffTreeFactor( size_t I ) {
+    TreeEPSubTree &Q = _Q.find(I)->second;
+    if( props.skiptol > 0.0 && Q.unchanged( Qa, Qb, props.skiptol ) )
+        return;
+    Q.InvertAndMultiply( Qa, Qb );
+    Q.HUGIN_with_I( Qa, Qb );
+    Q.InvertAndMultiply( Qa, Qb );
+}
+
+
 Real TreeEP::logZ() const {
     Real s = 0.0;
 
@@ -291,6 +343,46 @@ TreeEP::TreeEPSubTree::TreeEPSubTree( const RootedTree &subRTree, const RootedTr
 
     // Find remaining variables (which are not in the new root)
     _nsrem = _ns / _Qa[0].vars();
+
+    // Create index cache
+    _parentInd.reserve( _RTree.size() );
+    _childInd.reserve( _RTree.size() );
+    _clampInd.reserve( _RTree.size() );
+    _clampTarget.reserve( _RTree.size() );
+    for( size_t i = 0; i < _RTree.size(); i++ ) {
+        const VarSet &parent = _Qa[_RTree[i].first].vars();
+        const VarSet &child = _Qa[_RTree[i].second].vars();
+        _parentInd.push_back( ind_t() );
+        _parentInd[i].reserve( BigInt_size_t( parent.nrStates() ) );
+        for( IndexFor k( _Qb[i].vars(), parent ); k.valid(); ++k )
+            _parentInd[i].push_back( k );
+        _childInd.push_back( ind_t() );
+        _childInd[i].reserve( BigInt_size_t( child.nrStates() ) );
+        for( IndexFor k( _Qb[i].vars(), child ); k.valid(); ++k )
+            _childInd[i].push_back( k );
+
+        _clampInd.push_back( ind_t() );
+        _clampTarget.push_back( ind_t() );
+        VarSet clamped = child & _nsrem;
+        if( clamped.size() ) {
+            for( IndexFor k( _nsrem, child ); k.valid(); ++k )
+                _clampInd[i].push_back( k );
+            // state of clamped that corresponds with a state of _nsrem
+            ind_t clampedInd;
+            for( IndexFor k( clamped, _nsrem ); k.valid(); ++k )
+                clampedInd.push_back( k );
+            // state of _nsrem that corresponds with a state of clamped (and zeroes for other variables)
+            ind_t nsremInd;
+            for( IndexFor k( _nsrem, clamped ); k.valid(); ++k )
+                nsremInd.push_back( k );
+            for( size_t s = 0; s < clampedInd.size(); s++ )
+                _clampTarget[i].push_back( nsremInd[clampedInd[s]] );
+        }
+    }
+    for( IndexFor k( _ns, _Qa[0].vars() ); k.valid(); ++k )
+        _rootInd.push_back( k );
+    for( IndexFor k( _ns, _nsrem ); k.valid(); ++k )
+        _remInd.push_back( k );
 }
 
 
@@ -299,6 +391,8 @@ void TreeEP::TreeEPSubTree::init() {
         _Qa[alpha].fill( 1.0 );
     for( size_t beta = 0; beta < _Qb.size(); beta++ )
         _Qb[beta].fill( 1.0 );
+    _QaOut.clear();
+    _QbOut.clear();
 }
 
 
@@ -311,10 +405,24 @@ void TreeEP::TreeEPSubTree::InvertAndMultiply( const std::vector<Factor> &Qa, co
 }
 
 
+void TreeEP::TreeEPSubTree::passMessage( const Prob &from, const ind_t &fromInd, Prob &to, const ind_t &toInd, Prob &sep ) {
+    // Marginalize from onto the separator
+    _newQb.p().assign( sep.size(), 0.0 );
+    for( size_t x = 0; x < from.size(); x++ )
+        _newQb.set( fromInd[x], _newQb[fromInd[x]] + from[x] );
+    // Multiply to with the quotient of the new and old separator marginals (where division by zero yields zero)
+    for( size_t b = 0; b < sep.size(); b++ )
+        sep.set( b, sep[b] == 0.0 ? 0.0 : _newQb[b] / sep[b] );
+    for( size_t x = 0; x < to.size(); x++ )
+        to.set( x, to[x] * sep[toInd[x]] );
+    sep.p().swap( _newQb.p() );
+}
+
+
 void TreeEP::TreeEPSubTree::HUGIN_with_I( std::vector<Factor> &Qa, std::vector<Factor> &Qb ) {
     // Backup _Qa and _Qb
-    vector<Factor> _Qa_old(_Qa);
-    vector<Factor> _Qb_old(_Qb);
+    _Qa_old = _Qa;
+    _Qb_old = _Qb;
 
     // Clear Qa and Qb
     for( size_t alpha = 0; alpha < _Qa.size(); alpha++ )
@@ -323,27 +431,30 @@ void TreeEP::TreeEPSubTree::HUGIN_with_I( std::vector<Factor> &Qa, std::vector<F
         Qb[_b[beta]].fill( 0.0 );
 
     // For all states of _nsrem
-    for( State s(_nsrem); s.valid(); s++ ) {
+    const Prob &I = _I->p();
+    for( size_t s = 0; s < _remInd.size(); s++ ) {
         // Multiply root with slice of I
-        _Qa[0] *= _I->slice( _nsrem, s );
+        Prob &root = _Qa[0].p();
+        for( size_t x = 0; x < root.size(); x++ )
+            root.set( x, root[x] * I[_rootInd[x] + _remInd[s]] );
 
         // CollectEvidence
         for( size_t i = _RTree.size(); (i--) != 0; ) {
+            Prob &child = _Qa[_RTree[i].second].p();
             // clamp variables in nsrem
-            for( VarSet::const_iterator n = _nsrem.begin(); n != _nsrem.end(); n++ )
-                if( _Qa[_RTree[i].second].vars() >> *n )
-                    _Qa[_RTree[i].second] *= createFactorDelta( *n, s(*n) );
-            Factor new_Qb = _Qa[_RTree[i].second].marginal( _Qb[i].vars(), false );
-            _Qa[_RTree[i].first] *= new_Qb / _Qb[i];
-            _Qb[i] = new_Qb;
+            if( _clampInd[i].size() ) {
+                const ind_t &ind = _clampInd[i];
+                size_t target = _clampTarget[i][s];
+                for( size_t x = 0; x < child.size(); x++ )
+                    if( ind[x] != target )
+                        child.set( x, 0.0 );
+            }
+            passMessage( child, _childInd[i], _Qa[_RTree[i].first].p(), _parentInd[i], _Qb[i].p() );
         }
 
         // DistributeEvidence
-        for( size_t i = 0; i < _RTree.size(); i++ ) {
-            Factor new_Qb = _Qa[_RTree[i].first].marginal( _Qb[i].vars(), false );
-            _Qa[_RTree[i].second] *= new_Qb / _Qb[i];
-            _Qb[i] = new_Qb;
-        }
+        for( size_t i = 0; i < _RTree.size(); i++ )
+            passMessage( _Qa[_RTree[i].first].p(), _parentInd[i], _Qa[_RTree[i].second].p(), _childInd[i], _Qb[i].p() );
 
         // Store Qa's and Qb's
         for( size_t alpha = 0; alpha < _Qa.size(); alpha++ )
@@ -358,17 +469,34 @@ void TreeEP::TreeEPSubTree::HUGIN_with_I( std::vector<Factor> &Qa, std::vector<F
 
     // Normalize Qa and Qb
     _logZ = 0.0;
+    _QaOut.resize( _Qa.size() );
+    _QbOut.resize( _Qb.size() );
     for( size_t alpha = 0; alpha < _Qa.size(); alpha++ ) {
         _logZ += log(Qa[_a[alpha]].sum());
         Qa[_a[alpha]].normalize();
+        _QaOut[alpha] = Qa[_a[alpha]].p();
     }
     for( size_t beta = 0; beta < _Qb.size(); beta++ ) {
         _logZ -= log(Qb[_b[beta]].sum());
         Qb[_b[beta]].normalize();
+        _QbOut[beta] = Qb[_b[beta]].p();
     }
 }
 
 
+bool TreeEP::TreeEPSubTree::unchanged( const std::vector<Factor> &Qa, const std::vector<Factor> &Qb, Real tol ) const {
+    if( _QaOut.size() != _Qa.size() )
+        return false;
+    for( size_t alpha = 0; alpha < _Qa.size(); alpha++ )
+        if( dist( Qa[_a[alpha]].p(), _QaOut[alpha], DISTLINF ) >= tol )
+            return false;
+    for( size_t beta = 0; beta < _Qb.size(); beta++ )
+        if( dist( Qb[_b[beta]].p(), _QbOut[beta], DISTLINF ) >= tol )
+            return false;
+    return true;
+}
+
+
 Real TreeEP::TreeEPSubTree::logZ( const std::vector<Factor> &Qa, const std::vector<Factor> &Qb ) const {
     Real s = 0.0;
     for( size_t alpha = 0; alpha < _Qa.size(); alpha++ )
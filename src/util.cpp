@@ -7,16 +7,26 @@
 
 
 #include <dai/util.h>
+#include <limits>
+#include <cstdlib>
+#include <cctype>
 #include <boost/random.hpp>
+#include <boost/cstdint.hpp>
 
 #ifdef WINDOWS
     #include <windows.h>
     #include <boost/math/special_functions/atanh.hpp>  // for atanh
     #include <boost/math/special_functions/log1p.hpp>  // for log1p
     #include <float.h>  // for _isnan
+    #include <fstream>
 #else
     // Assume POSIX compliant system. We need the following for querying the system time
     #include <sys/time.h>
+    // and the following for memory-mapping files
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
 #endif
 
 
@@ -79,21 +89,32 @@ boost::variate_generator<_rnd_gen_type&, boost::uniform_real<Real> > _uni_rnd(_r
 boost::variate_generator<_rnd_gen_type&, boost::normal_distribution<Real> > _normal_rnd(_rnd_gen, _normal_dist);
 
 
+// The global random number generator is shared by all threads; calls are serialized by a named critical section
+
 void rnd_seed( size_t seed ) {
-    _rnd_gen.seed( static_cast<unsigned int>(seed) );
-    _normal_rnd.distribution().reset(); // needed for clearing the cache used in boost::normal_distribution
+    DAI_OMP(critical(dai_rnd))
+    {
+        _rnd_gen.seed( static_cast<unsigned int>(seed) );
+        _normal_rnd.distribution().reset(); // needed for clearing the cache used in boost::normal_distribution
+    }
 }
 
 Real rnd_uniform() {
-    return _uni_rnd();
+    Real x;
+    DAI_OMP(critical(dai_rnd))
+    x = _uni_rnd();
+    return x;
 }
 
 Real rnd_stdnormal() {
-    return _normal_rnd();
+    Real x;
+    DAI_OMP(critical(dai_rnd))
+    x = _normal_rnd();
+    return x;
 }
 
 int rnd_int( int min, int max ) {
-    return (int)floor(_uni_rnd() * (max + 1 - min) + min);
+    return (int)floor(rnd_uniform() * (max + 1 - min) + min);
 }
 
 std::vector<std::string> tokenizeString( const std::string& s, bool singleDelim, const std::string& delim ) {
@@ -121,4 +142,129 @@ std::vector<std::string> tokenizeString( const std::string& s, bool singleDelim,
 }
 
 
+bool parseNumber( const char *begin, const char *end, size_t &x ) {
+    if( begin == end )
+        return false;
+    size_t result = 0;
+    for( const char *c = begin; c != end; ++c ) {
+        if( *c < '0' || *c > '9' )
+            return false;
+        size_t digit = *c - '0';
+        if( result > (std::numeric_limits<size_t>::max() - digit) / 10 )
+            return false;
+        result = 10 * result + digit;
+    }
+    x = result;
+    return true;
+}
+
+
+bool parseNumber( const char *begin, const char *end, Real &x ) {
+    // Powers of ten that are exactly representable as doubles
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    // Largest integer below which all integers are exactly representable as doubles
+    static const boost::uint64_t maxMantissa = (boost::uint64_t)1 << 53;
+
+    // If the decimal mantissa and the power of ten are both exactly representable,
+    // a single multiplication or division gives the correctly rounded result
+    const char *c = begin;
+    bool negative = false;
+    if( c != end && (*c == '-' || *c == '+') )
+        negative = (*c++ == '-');
+    boost::uint64_t mantissa = 0;
+    long exponent = 0;
+    size_t digits = 0;
+    bool fast = true;
+    for( ; c != end && *c >= '0' && *c <= '9'; ++c, ++digits )
+        if( (mantissa = 10 * mantissa + (*c - '0')) >= maxMantissa )
+            fast = false;
+    if( c != end && *c == '.' )
+        for( ++c; c != end && *c >= '0' && *c <= '9'; ++c, ++digits, --exponent )
+            if( (mantissa = 10 * mantissa + (*c - '0')) >= maxMantissa )
+                fast = false;
+    if( digits > 0 && c != end && (*c == 'e' || *c == 'E') ) {
+        const char *e = c + 1;
+        bool negativeExp = false;
+        if( e != end && (*e == '-' || *e == '+') )
+            negativeExp = (*e++ == '-');
+        long exp = 0;
+        if( e != end && *e >= '0' && *e <= '9' ) {
+            for( ; e != end && *e >= '0' && *e <= '9'; ++e )
+                if( exp < 10000 )
+                    exp = 10 * exp + (*e - '0');
+            exponent += negativeExp ? -exp : exp;
+            c = e;
+        }
+    }
+    if( fast && digits > 0 && c == end && exponent >= -22 && exponent <= 22 ) {
+        double result = (double)mantissa;
+        if( exponent < 0 )
+            result /= powersOfTen[-exponent];
+        else
+            result *= powersOfTen[exponent];
+        x = negative ? -result : result;
+        return true;
+    }
+
+    // Otherwise (or if the number is not in the usual notation, e.g., "inf"), use strtod
+    std::string s( begin, end );
+    if( s.empty() || isspace( (unsigned char)s[0] ) )
+        return false;
+    char *s_end;
+    double result = strtod( s.c_str(), &s_end );
+    if( s_end != s.c_str() + s.size() )
+        return false;
+    x = result;
+    return true;
+}
+
+
+#ifdef WINDOWS
+MappedFile::MappedFile( const char *filename ) : _data(NULL), _size(0), _buf() {
+    std::ifstream is( filename, std::ios::binary );
+    if( !is.is_open() )
+        DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+    is.seekg( 0, std::ios::end );
+    _size = is.tellg();
+    is.seekg( 0, std::ios::beg );
+    _buf.resize( _size );
+    if( _size ) {
+        is.read( &(_buf[0]), _size );
+        if( !is )
+            DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+        _data = &(_buf[0]);
+    }
+}
+
+MappedFile::~MappedFile() {}
+#else
+MappedFile::MappedFile( const char *filename ) : _data(NULL), _size(0), _buf() {
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+        DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+    struct stat st;
+    if( fstat( fd, &st ) != 0 ) {
+        close( fd );
+        DAI_THROWE(CANNOT_READ_FILE,"Cannot read from file " + std::string(filename));
+    }
+    _size = st.st_size;
+    if( _size ) { // mapping an empty file fails
+        void *p = mmap( NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( p == MAP_FAILED ) {
+            close( fd );
+            DAI_THROWE(CANNOT_READ_FILE,"Cannot map file " + std::string(filename));
+        }
+        _data = static_cast<const char *>( p );
+    }
+    close( fd ); // the mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+    if( _size )
+        munmap( const_cast<char *>(_data), _size );
+}
+#endif
+
+
 } // end of namespace dai
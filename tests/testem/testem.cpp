@@ -22,13 +22,14 @@ using namespace dai;
 void usage( const string &msg ) {
     cerr << msg << endl;
     cerr << "Usage:" << endl;
-    cerr << " testem factorgraph.fg evidence.tab emconfig.em" << endl;
+    cerr << " testem factorgraph.fg evidence.tab emconfig.em [batchsize]" << endl;
+    cerr << "If batchsize is given, online EM is performed with mini-batches of batchsize samples." << endl;
     exit( 1 );
 }
 
 
 int main( int argc, char** argv ) {
-    if( argc != 4 )
+    if( argc != 4 && argc != 5 )
         usage("Incorrect number of arguments.");
 
     FactorGraph fg;
@@ -51,10 +52,19 @@ int main( int argc, char** argv ) {
     ifstream emstream( argv[3] );
     EMAlg em(e, *inf, emstream);
 
-    while( !em.hasSatisfiedTermConditions() ) {
-        Real l = em.iterate();
-        cout << "Iteration " << em.Iterations() << " likelihood: " << l <<endl;
-    }
+    if( argc == 5 ) {
+        size_t batchSize = fromString<size_t>( argv[4] );
+        ifstream bstream( argv[2] );
+        EvidenceTabReader reader( bstream, fg );
+        while( !em.hasSatisfiedTermConditions() ) {
+            Real l = em.iterateOnline( reader, batchSize );
+            cout << "Pass " << em.Iterations() << " likelihood: " << l <<endl;
+        }
+    } else
+        while( !em.hasSatisfiedTermConditions() ) {
+            Real l = em.iterate();
+            cout << "Iteration " << em.Iterations() << " likelihood: " << l <<endl;
+        }
 
     cout << endl << "Inferred Factor Graph:" << endl << "######################" << endl;
     cout.precision(12);
@@ -0,0 +1,136 @@
+/*  This file is part of libDAI - http://www.libdai.org/
+ *
+ *  Copyright (c) 2006-2011, The libDAI authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license that can be found in the LICENSE file.
+ */
+
+
+#include <dai/evidence.h>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+
+using namespace dai;
+
+
+#define BOOST_TEST_MODULE EvidenceTest
+
+
+#include <boost/test/unit_test.hpp>
+
+
+FactorGraph createFactorGraph() {
+    std::vector<Factor> facs;
+    facs.push_back( Factor( VarSet( Var(1, 2), Var(3, 3) ) ) );
+    facs.push_back( Factor( VarSet( Var(2, 70), Var(3, 3) ) ) );
+    return FactorGraph( facs );
+}
+
+
+const char *tabContents = "1\t3\t2\n\n0\t0\t1\n1\t2\t69\n1\t\t1\n\t\t\n";
+
+
+BOOST_AUTO_TEST_CASE( TabFileTest ) {
+    FactorGraph fg = createFactorGraph();
+    Var x1( 1, 2 ), x2( 2, 70 ), x3( 3, 3 );
+
+    Evidence e;
+    std::istringstream is( tabContents );
+    e.addEvidenceTabFile( is, fg );
+    BOOST_CHECK_EQUAL( e.nrSamples(), 4 );
+    Evidence::const_iterator s = e.begin();
+    BOOST_CHECK_EQUAL( s->size(), 3 );
+    BOOST_CHECK_EQUAL( s->find(x1)->second, 0 );
+    BOOST_CHECK_EQUAL( s->find(x2)->second, 1 );
+    BOOST_CHECK_EQUAL( s->find(x3)->second, 0 );
+    s++;
+    BOOST_CHECK_EQUAL( s->find(x2)->second, 69 );
+    BOOST_CHECK_EQUAL( s->find(x3)->second, 2 );
+    s++;
+    BOOST_CHECK_EQUAL( s->size(), 2 );
+    BOOST_CHECK( s->find(x3) == s->end() );
+    s++;
+    BOOST_CHECK_EQUAL( s->size(), 0 );
+
+    std::istringstream is2( "1\t3\n\n0\t0\n1\t3\n" );
+    BOOST_CHECK_THROW( e.addEvidenceTabFile( is2, fg ), Exception );
+    BOOST_CHECK_EQUAL( e.nrSamples(), 4 );
+    std::istringstream is3( "1\t3\n\n0\t0\n1\n" );
+    BOOST_CHECK_THROW( e.addEvidenceTabFile( is3, fg ), Exception );
+    std::istringstream is4( "1\t4\n\n0\t0\n" );
+    BOOST_CHECK_THROW( e.addEvidenceTabFile( is4, fg ), Exception );
+    std::istringstream is5( "1\t3\n0\t0\n" );
+    BOOST_CHECK_THROW( e.addEvidenceTabFile( is5, fg ), Exception );
+    BOOST_CHECK_EQUAL( e.nrSamples(), 4 );
+
+    std::istringstream is6( tabContents );
+    EvidenceTabReader reader( is6, fg );
+    Evidence batch;
+    BOOST_CHECK_EQUAL( reader.read( batch, 3 ), 3 );
+    BOOST_CHECK( *batch.begin() == *e.begin() );
+    BOOST_CHECK_EQUAL( reader.read( batch, 3 ), 1 );
+    BOOST_CHECK( *batch.begin() == *(e.begin() + 3) );
+    BOOST_CHECK_EQUAL( reader.read( batch, 3 ), 0 );
+    reader.rewind();
+    BOOST_CHECK_EQUAL( reader.read( batch, 5 ), 4 );
+}
+
+
+BOOST_AUTO_TEST_CASE( TableTest ) {
+    FactorGraph fg = createFactorGraph();
+    Evidence e;
+    std::istringstream is( tabContents );
+    e.addEvidenceTabFile( is, fg );
+
+    EvidenceTable t( e );
+    BOOST_CHECK_EQUAL( t.nrSamples(), 4 );
+    BOOST_CHECK_EQUAL( t.nrVars(), 3 );
+    BOOST_CHECK( t.vars()[0] == Var(1, 2) );
+    BOOST_CHECK( t.vars()[1] == Var(2, 70) );
+    BOOST_CHECK( t.vars()[2] == Var(3, 3) );
+    BOOST_CHECK( t.observed( 1, 1 ) );
+    BOOST_CHECK_EQUAL( t.state( 1, 1 ), 69 );
+    BOOST_CHECK( !t.observed( 2, 2 ) );
+    for( size_t s = 0; s < e.nrSamples(); s++ )
+        BOOST_CHECK( t.observation( s ) == *(e.begin() + s) );
+
+    std::ofstream os( "evidence_test.tab" );
+    os << tabContents;
+    os.close();
+    EvidenceTable t2;
+    t2.ReadTabFile( "evidence_test.tab", fg );
+    BOOST_CHECK( t2.vars()[0] == Var(1, 2) );
+    BOOST_CHECK( t2.vars()[1] == Var(3, 3) );
+    BOOST_CHECK( t2.vars()[2] == Var(2, 70) );
+    for( size_t s = 0; s < e.nrSamples(); s++ )
+        BOOST_CHECK( t2.observation( s ) == *(e.begin() + s) );
+
+    // more samples than fit into a single word
+    Evidence e3;
+    for( size_t s = 0; s < 200; s++ ) {
+        Evidence::Observation obs;
+        obs[Var(2, 70)] = s % 70;
+        if( s % 3 )
+            obs[Var(3, 3)] = s % 3;
+        e3.addSample( obs );
+    }
+    EvidenceTable t3( e3 );
+    t3.WriteToFile( "evidence_test.evb" );
+    EvidenceTable t4;
+    t4.ReadFromFile( "evidence_test.evb" );
+    BOOST_CHECK_EQUAL( t4.nrSamples(), 200 );
+    BOOST_CHECK( t4.vars() == t3.vars() );
+    BOOST_CHECK_EQUAL( t4.bytes(), t3.bytes() );
+    EvidenceTableReader reader( t4 );
+    Evidence batch;
+    size_t n = 0;
+    while( reader.read( batch, 64 ) ) {
+        for( Evidence::const_iterator s = batch.begin(); s != batch.end(); s++, n++ )
+            BOOST_CHECK( *s == *(e3.begin() + n) );
+    }
+    BOOST_CHECK_EQUAL( n, 200 );
+
+    BOOST_CHECK_THROW( t4.ReadFromFile( "evidence_test.tab" ), Exception );
+}
@@ -10,6 +10,9 @@
 #include <dai/factorgraph.h>
 #include <vector>
 #include <strstream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
 
 
 using namespace dai;
@@ -374,6 +377,35 @@ BOOST_AUTO_TEST_CASE( QueriesTest ) {
 }
 
 
+BOOST_AUTO_TEST_CASE( FindTest ) {
+    // check the variable and factor indices, including factors with identical variables
+    std::vector<Factor> facs;
+    for( size_t i = 0; i < 100; i++ ) {
+        facs.push_back( Factor( VarSet( Var(i, 2), Var(i + 1, 2) ) ) );
+        facs.push_back( Factor( Var(i, 2) ) );
+    }
+    facs.push_back( Factor( VarSet( Var(5, 2), Var(6, 2) ), 2.0 ) );
+    FactorGraph G( facs );
+    for( size_t i = 0; i <= 100; i++ ) {
+        BOOST_CHECK_EQUAL( G.findVar( Var(i, 2) ), i );
+        if( i < 100 ) {
+            BOOST_CHECK_EQUAL( G.findFactor( VarSet( Var(i, 2), Var(i + 1, 2) ) ), 2 * i );
+            BOOST_CHECK_EQUAL( G.findFactor( Var(i, 2) ), 2 * i + 1 );
+        }
+    }
+    BOOST_CHECK_THROW( G.findVar( Var(101, 2) ), Exception );
+    BOOST_CHECK_THROW( G.findFactor( VarSet( Var(0, 2), Var(2, 2) ) ), Exception );
+
+    // the indices are copied and are not affected by changing factors
+    FactorGraph G2( G );
+    G.clampVar( 5, std::vector<size_t>( 1, 1 ) );
+    G2.setFactor( 10, Factor( VarSet( Var(5, 2), Var(6, 2) ), 3.0 ) );
+    BOOST_CHECK_EQUAL( G.findFactor( VarSet( Var(5, 2), Var(6, 2) ) ), 10 );
+    BOOST_CHECK_EQUAL( G2.findFactor( VarSet( Var(5, 2), Var(6, 2) ) ), 10 );
+    BOOST_CHECK_EQUAL( G2.findVar( Var(100, 2) ), 100 );
+}
+
+
 BOOST_AUTO_TEST_CASE( BackupRestoreTest ) {
     Var v0( 0, 2 );
     Var v1( 1, 2 );
@@ -476,6 +508,66 @@ BOOST_AUTO_TEST_CASE( BackupRestoreTest ) {
 }
 
 
+BOOST_AUTO_TEST_CASE( NestedBackupTest ) {
+    Var v0( 0, 2 );
+    Var v1( 1, 2 );
+    Var v2( 2, 2 );
+    VarSet v01( v0, v1 );
+    VarSet v12( v1, v2 );
+
+    std::vector<Factor> facs;
+    facs.push_back( Factor( v01 ) );
+    facs.push_back( Factor( v12 ) );
+    facs.push_back( Factor( v1 ) );
+
+    FactorGraph G( facs );
+    FactorGraph Gorg( G );
+
+    BOOST_CHECK_EQUAL( G.nrBackupLevels(), 0 );
+    BOOST_CHECK_THROW( G.popBackups(), Exception );
+
+    G.pushBackups();
+    BOOST_CHECK_EQUAL( G.nrBackupLevels(), 1 );
+    G.setFactor( 0, Factor( v01, 2.0 ), true );
+    G.setFactor( 0, Factor( v01, 3.0 ), true );
+    G.clamp( 1, 0, true );
+    BOOST_CHECK_EQUAL( G.factor(0)[0], 3.0 );
+    BOOST_CHECK_EQUAL( G.factor(0)[2], 0.0 );
+    BOOST_CHECK_EQUAL( G.factor(2)[1], 0.0 );
+    Factor f0 = G.factor(0);
+    Factor f1 = G.factor(1);
+    Factor f2 = G.factor(2);
+
+    G.pushBackups();
+    BOOST_CHECK_EQUAL( G.nrBackupLevels(), 2 );
+    G.makeCavity( 1, true );
+    BOOST_CHECK_EQUAL( G.factor(0), Factor( v01, 1.0 ) );
+    BOOST_CHECK_EQUAL( G.factor(1), Factor( v12, 1.0 ) );
+    BOOST_CHECK_EQUAL( G.factor(2), Factor( v1, 1.0 ) );
+    G.popBackups();
+    BOOST_CHECK_EQUAL( G.nrBackupLevels(), 1 );
+    BOOST_CHECK_EQUAL( G.factor(0), f0 );
+    BOOST_CHECK_EQUAL( G.factor(1), f1 );
+    BOOST_CHECK_EQUAL( G.factor(2), f2 );
+
+    G.popBackups();
+    BOOST_CHECK_EQUAL( G.nrBackupLevels(), 0 );
+    BOOST_CHECK_EQUAL( G.factor(0), Gorg.factor(0) );
+    BOOST_CHECK_EQUAL( G.factor(1), Gorg.factor(1) );
+    BOOST_CHECK_EQUAL( G.factor(2), Gorg.factor(2) );
+
+    G.backupFactor( 0 );
+    G.pushBackups();
+    G.setFactor( 0, Factor( v01, 2.0 ), true );
+    G.popBackups();
+    BOOST_CHECK_EQUAL( G.factor(0), Gorg.factor(0) );
+    BOOST_CHECK_THROW( G.backupFactor( 0 ), Exception );
+    G.setFactor( 0, Factor( v01, 2.0 ), false );
+    G.restoreFactor( 0 );
+    BOOST_CHECK_EQUAL( G.factor(0), Gorg.factor(0) );
+}
+
+
 BOOST_AUTO_TEST_CASE( TransformationsTest ) {
     Var v0( 0, 2 );
     Var v1( 1, 2 );
@@ -759,4 +851,76 @@ BOOST_AUTO_TEST_CASE( IOTest ) {
         for( size_t s = 0; s < G.factor(I).nrStates(); s++ )
             BOOST_CHECK_CLOSE( G.factor(I)[s], G3.factor(I)[s], tol );
     }
+
+    // comments, variables that are not ordered by label, and values that are not converted directly
+    std::ofstream os( "factorgraph_test.fg" );
+    os << "# two factors\n2\n\n# first factor\n2\n2 0\n3 2\n3\n0 0.5\n# comment\n3 1e-3\n5 12345678901234567890\n\n1\n2\n3\n1\n1 -2.5";
+    os.close();
+    FactorGraph G4;
+    G4.ReadFromFile( "factorgraph_test.fg" );
+    BOOST_CHECK_EQUAL( G4.nrVars(), 2 );
+    BOOST_CHECK_EQUAL( G4.var(0).states(), 2 );
+    BOOST_CHECK_EQUAL( G4.var(1).label(), 2 );
+    BOOST_CHECK_EQUAL( G4.var(1).states(), 3 );
+    BOOST_CHECK_EQUAL( G4.nrFactors(), 2 );
+    Factor f0( VarSet( G4.var(0), G4.var(1) ), 0.0 );
+    f0.set( 0, 0.5 );
+    f0.set( 1, 1e-3 );
+    f0.set( 5, 12345678901234567890.0 );
+    BOOST_CHECK( G4.factor(0) == f0 );
+    Factor f1( G4.var(1), 0.0 );
+    f1.set( 1, -2.5 );
+    BOOST_CHECK( G4.factor(1) == f1 );
+    BOOST_CHECK( G4.findFactor( G4.var(1) ) == 1 );
+    BOOST_CHECK_EQUAL( G4.nbV(1).size(), 2 );
+
+    // invalid files
+    const char *invalid[] = {
+        "2\n\n1\n0\n2\n0\n",                    // less factors than announced
+        "2\n\n1\n0\n2\n0\n\n1\n0\n3\n0\n",     // inconsistent dimensions
+        "1\n\n2\n4 4\n2 3\n0\n",                // inconsistent dimensions within a factor
+        "1\n\n1\n0\n2\n1\n2 1.0\n",            // entry index out of range
+        "1\n\n1\n0\n2\n1\n1 x\n",              // invalid value
+        "1 2\n\n1\n0\n2\n0\n",                  // no empty line
+        ""};
+    for( size_t i = 0; i < 7; i++ ) {
+        std::ofstream os( "factorgraph_test.fg" );
+        os << invalid[i];
+        os.close();
+        BOOST_CHECK_THROW( G4.ReadFromFile( "factorgraph_test.fg" ), Exception );
+    }
+    BOOST_CHECK_EQUAL( G4.nrFactors(), 2 );
+    BOOST_CHECK_THROW( G4.ReadFromFile( "factorgraph_test_nonexistent.fg" ), Exception );
+
+    // binary format
+    G.WriteToFile( "factorgraph_test.fgb" );
+    FactorGraph G5;
+    G5.ReadFromFile( "factorgraph_test.fgb" );
+    BOOST_CHECK( G.vars() == G5.vars() );
+    BOOST_CHECK( G.bipGraph() == G5.bipGraph() );
+    BOOST_CHECK( G.factors() == G5.factors() );
+    G4.WriteToFile( "factorgraph_test.fgb" );
+    G5.ReadFromFile( "factorgraph_test.fgb" );
+    BOOST_CHECK( G4.vars() == G5.vars() );
+    BOOST_CHECK( G4.factors() == G5.factors() );
+    BOOST_CHECK( G5.findFactor( G5.var(1) ) == 1 );
+    G5.clampVar( 1, std::vector<size_t>( 1, 2 ) );
+    BOOST_CHECK( G5.factor(1)[1] == 0.0 );
+    BOOST_CHECK( G4.factor(1)[1] == -2.5 );
+
+    // a truncated binary file, and a .fg file with the extension of the binary format
+    std::string contents;
+    {
+        std::ifstream is( "factorgraph_test.fgb", std::ios::binary );
+        std::ostringstream ss;
+        ss << is.rdbuf();
+        contents = ss.str();
+    }
+    std::ofstream osb( "factorgraph_test.fgb", std::ios::binary );
+    osb.write( contents.data(), contents.size() - 8 );
+    osb.close();
+    BOOST_CHECK_THROW( G5.ReadFromFile( "factorgraph_test.fgb" ), Exception );
+    G4.WriteToFile( "factorgraph_test.fg" );
+    rename( "factorgraph_test.fg", "factorgraph_test.fgb" );
+    BOOST_CHECK_THROW( G5.ReadFromFile( "factorgraph_test.fgb" ), Exception );
 }
@@ -0,0 +1,92 @@
+/*  This file is part of libDAI - http://www.libdai.org/
+ *
+ *  Copyright (c) 2006-2011, The libDAI authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license that can be found in the LICENSE file.
+ */
+
+
+#include <dai/pseudolikelihood.h>
+#include <vector>
+
+
+using namespace dai;
+
+
+const double tol = 1e-8;
+
+
+#define BOOST_TEST_MODULE PseudoLikelihoodTest
+
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+
+BOOST_AUTO_TEST_CASE( SingleFactorTest ) {
+    // for a single factor, the pseudo-likelihood is maximized by the empirical distribution
+    Var x1( 1, 2 ), x2( 2, 3 );
+    VarSet vs( x1, x2 );
+    size_t counts[6] = {1, 4, 2, 3, 5, 1};
+    Evidence e;
+    for( size_t j = 0; j < 6; j++ )
+        for( size_t c = 0; c < counts[j]; c++ ) {
+            Evidence::Observation obs;
+            obs[x1] = j % 2;
+            obs[x2] = j / 2;
+            e.addSample( obs );
+        }
+    EvidenceTable data( e );
+
+    FactorGraph fg( std::vector<Factor>( 1, Factor( vs ) ) );
+    PropertySet opts;
+    opts.set( PseudoLikelihood::TOL_KEY, 1e-12 );
+    PseudoLikelihood pl( fg, opts );
+    Real before = pl.logPseudoLikelihood( data );
+    Real after = pl.run( data );
+    BOOST_CHECK( after > before );
+    BOOST_CHECK( pl.Iterations() > 0 );
+    BOOST_CHECK_CLOSE( pl.logPseudoLikelihood( data ), after, tol );
+    for( size_t j = 0; j < 6; j++ )
+        BOOST_CHECK_CLOSE( fg.factor(0)[j], counts[j] / 16.0, 1e-3 );
+}
+
+
+BOOST_AUTO_TEST_CASE( FixedFactorsTest ) {
+    Var x0( 0, 2 ), x1( 1, 2 ), x2( 2, 2 );
+    std::vector<Factor> facs;
+    facs.push_back( Factor( VarSet( x0, x1 ) ) );
+    facs.push_back( Factor( VarSet( x1, x2 ) ) );
+    facs[1].set( 0, 2.0 );
+    facs[1].set( 3, 3.0 );
+    FactorGraph fg( facs );
+
+    Evidence e;
+    for( size_t s = 0; s < 50; s++ ) {
+        Evidence::Observation obs;
+        obs[x0] = s % 2;
+        obs[x1] = (s % 3) != 0;
+        obs[x2] = (s % 5) == 0;
+        e.addSample( obs );
+    }
+    EvidenceTable data( e );
+
+    PropertySet opts;
+    opts.set( PseudoLikelihood::L2_KEY, 0.01 );
+    PseudoLikelihood pl( fg, std::vector<size_t>( 1, 0 ), opts );
+    Real before = pl.logPseudoLikelihood( data );
+    BOOST_CHECK( pl.run( data ) > before );
+    BOOST_CHECK( fg.factor(1) == facs[1] );
+    BOOST_CHECK( !(fg.factor(0) == facs[0]) );
+
+    // all variables should have been observed
+    Evidence e2;
+    Evidence::Observation obs;
+    obs[x0] = 0;
+    obs[x1] = 1;
+    e2.addSample( obs );
+    BOOST_CHECK_THROW( pl.run( EvidenceTable( e2 ) ), Exception );
+    obs[x2] = 1;
+    e2.addSample( obs );
+    BOOST_CHECK_THROW( pl.run( EvidenceTable( e2 ) ), Exception );
+}
@@ -12,6 +12,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <cstring>
+#include <cstdlib>
 
 
 using namespace dai;
@@ -259,3 +261,44 @@ BOOST_AUTO_TEST_CASE( tokenizeStringTest ) {
     BOOST_CHECK_EQUAL( tokens[1], "there" );
     BOOST_CHECK_EQUAL( tokens[2], "!" );
 }
+
+
+BOOST_AUTO_TEST_CASE( parseNumberTest ) {
+    const char *sizes[] = {"0", "7", "0012", "18446744073709551615"};
+    for( size_t i = 0; i < 4; i++ ) {
+        size_t x = 1;
+        BOOST_CHECK( parseNumber( sizes[i], sizes[i] + strlen(sizes[i]), x ) );
+        BOOST_CHECK_EQUAL( x, fromString<size_t>( sizes[i] ) );
+    }
+    const char *noSizes[] = {"", "-1", "+1", "1.0", "1e3", " 1", "18446744073709551616"};
+    for( size_t i = 0; i < 7; i++ ) {
+        size_t x = 1;
+        BOOST_CHECK( !parseNumber( noSizes[i], noSizes[i] + strlen(noSizes[i]), x ) );
+        BOOST_CHECK_EQUAL( x, 1 );
+    }
+
+    // the results should be identical to those of strtod(), also for numbers that are not converted directly
+    const char *reals[] = {"0", "-0", "1", "+2.5", "0.1", "-3.14159265358979", "1e-05", "2.5E+10", "1.", ".5",
+        "123456789012345678", "0.30000000000000004", "9007199254740993", "1e23", "4.9406564584124654e-324", "1e-400", "inf", "nan"};
+    for( size_t i = 0; i < 18; i++ ) {
+        Real x = 0.0;
+        BOOST_CHECK( parseNumber( reals[i], reals[i] + strlen(reals[i]), x ) );
+        Real y = strtod( reals[i], NULL );
+        BOOST_CHECK( x == y || (dai::isnan(x) && dai::isnan(y)) );
+    }
+    const char *noReals[] = {"", ".", "e5", "1e", "1.5x", "--1", " 1"};
+    for( size_t i = 0; i < 7; i++ ) {
+        Real x = 1.0;
+        BOOST_CHECK( !parseNumber( noReals[i], noReals[i] + strlen(noReals[i]), x ) );
+        BOOST_CHECK_EQUAL( x, 1.0 );
+    }
+
+    // the characters need not be terminated
+    const char *text = "25 0.75";
+    size_t n = 0;
+    Real r = 0.0;
+    BOOST_CHECK( parseNumber( text, text + 1, n ) );
+    BOOST_CHECK_EQUAL( n, 2 );
+    BOOST_CHECK( parseNumber( text + 3, text + 6, r ) );
+    BOOST_CHECK_EQUAL( r, 0.7 );
+}
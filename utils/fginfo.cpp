@@ -69,13 +69,16 @@ bool hasNegatives( const std::vector<Factor> &P ) {
 
 
 int main( int argc, char *argv[] ) {
-    if( argc != 3 ) {
+    if( argc != 3 && argc != 4 ) {
         // Display help message if number of command line arguments is incorrect
         cout << "This program is part of libDAI - http://www.libdai.org/" << endl << endl;
-        cout << "Usage: ./fginfo <in.fg> <maxstates>" << endl << endl;
+        cout << "Usage: ./fginfo <in.fg> <maxstates> [<out.fg>]" << endl << endl;
         cout << "Reports some detailed information about the factor graph <in.fg>." << endl;
         cout << "Also calculates treewidth, with maximum total number of states" << endl;
-        cout << "given by <maxstates>, where 0 means unlimited." << endl << endl;
+        cout << "given by <maxstates>, where 0 means unlimited." << endl;
+        cout << "If <out.fg> is given, the factor graph is first written to <out.fg>." << endl;
+        cout << "Files with extension .fgb are read or written in the binary format," << endl;
+        cout << "so this can be used to convert between .fg and .fgb files." << endl << endl;
         return 1;
     } else {
         // Read factorgraph
@@ -84,6 +87,10 @@ int main( int argc, char *argv[] ) {
         size_t maxstates = fromString<size_t>( argv[2] );
         fg.ReadFromFile( infile );
 
+        // Write factorgraph
+        if( argc == 4 )
+            fg.WriteToFile( argv[3] );
+
         // Output various statistics
         cout << "Number of variables:   " << fg.nrVars() << endl;
         cout << "Number of factors:     " << fg.nrFactors() << endl;
@@ -18,9 +18,9 @@ using namespace dai;
 
 
 int main( int argc, char *argv[] ) {
-    if ( argc != 4 ) {
+    if ( argc != 4 && argc != 5 ) {
         cout << "This program is part of libDAI - http://www.libdai.org/" << endl << endl;
-        cout << "Usage: ./uai2fg <basename> <surgery> <verbose>" << endl << endl;
+        cout << "Usage: ./uai2fg <basename> <surgery> <verbose> [<extension>]" << endl << endl;
         cout << "Converts input files in the UAI 2006/2008/2010 approximate inference evaluation format" << endl;
         cout << "(see http://graphmod.ics.uci.edu/uai08/ and http://www.cs.huji.ac.il/project/UAI10/)" << endl;
         cout << "to the libDAI factor graph format." << endl << endl;
@@ -29,11 +29,18 @@ int main( int argc, char *argv[] ) {
         cout << "where X=0,1,2,... enumerates the different evidence cases." << endl << endl;
         cout << "If surgery!=0, uses surgery on the factor graph (recommended)," << endl;
         cout << "otherwise, just adds delta factors to the factor graph." << endl;
+        cout << "If <extension> is fgb, the factor graphs are written to <basename.X.fgb>" << endl;
+        cout << "in the binary format instead." << endl;
         return 1;
     } else {
         string basename( argv[1] );
         bool surgery = fromString<size_t>( argv[2] );
         size_t verbose = fromString<size_t>( argv[3] );
+        string extension = (argc == 5) ? argv[4] : "fg";
+        if( extension != "fg" && extension != "fgb" ) {
+            cerr << "Unknown extension " << extension << " (should be fg or fgb)" << endl;
+            return 1;
+        }
         string uainame = basename + ".uai";
         string evidname = uainame + ".evid";
 
@@ -66,7 +73,7 @@ int main( int argc, char *argv[] ) {
         vector<string> fgnames;
         fgnames.reserve( evid.size() );
         for( size_t ev = 0; ev < evid.size(); ev++ )
-            fgnames.push_back( basename + '.' + toString(ev) + ".fg" );
+            fgnames.push_back( basename + '.' + toString(ev) + '.' + extension );
 
         // construct clamped factor graphs which reflect observed evidence cases
         if( verbose )